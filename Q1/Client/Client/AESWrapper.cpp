@@ -3,21 +3,25 @@
 #include <modes.h>
 #include <aes.h>
 #include <filters.h>
+#include <osrng.h>
 
 #include <stdexcept>
-#include <immintrin.h>	// _rdrand32_step
 
 
 unsigned char* AESWrapper::GenerateKey(unsigned char* buffer, unsigned int length)
 {
-	for (size_t i = 0; i < length; i += sizeof(unsigned int))
-		_rdrand32_step(reinterpret_cast<unsigned int*>(&buffer[i]));
+	// Seeded by the OS, and throws rather than leaving the buffer as it is, since a repeated nonce breaks GCM.
+	// A pool per thread, as messages are sealed by many threads at once.
+	static thread_local CryptoPP::AutoSeededRandomPool rng;
+
+	rng.GenerateBlock(buffer, length);
 	return buffer;
 }
 
 AESWrapper::AESWrapper()
 {
 	GenerateKey(_key, DEFAULT_KEYLENGTH);
+	expandKey();
 }
 
 AESWrapper::AESWrapper(const unsigned char* key, unsigned int length)
@@ -25,6 +29,36 @@ AESWrapper::AESWrapper(const unsigned char* key, unsigned int length)
 	if (length != DEFAULT_KEYLENGTH)
 		throw std::length_error("key length must be 16 bytes");
 	memcpy_s(_key, DEFAULT_KEYLENGTH, key, length);
+	expandKey();
+}
+
+void AESWrapper::expandKey()
+{
+	_aesEncryption.SetKey(_key, DEFAULT_KEYLENGTH);
+	_aesDecryption.SetKey(_key, DEFAULT_KEYLENGTH);
+}
+
+/**
+	Builds a GCM context under the key, the first time it is needed.
+
+	@param	gcm	-	The context, left as it is if already built.
+	@param	key	-	The key, of DEFAULT_KEYLENGTH bytes.
+
+	@return	T&	-	The context.
+*/
+template <typename T>
+static T& getGcm(std::unique_ptr<T>& gcm, const unsigned char* key)
+{
+	if (gcm == nullptr)
+	{
+		// Each sealed message brings its own nonce, this one is never used.
+		CryptoPP::byte nonce[AESWrapper::NONCE_LENGTH] = { 0 };
+
+		gcm.reset(new T());
+		gcm->SetKeyWithIV(key, AESWrapper::DEFAULT_KEYLENGTH, nonce, AESWrapper::NONCE_LENGTH);
+	}
+
+	return *gcm;
 }
 
 AESWrapper::~AESWrapper()
@@ -36,17 +70,21 @@ const unsigned char* AESWrapper::getKey() const
 	return _key; 
 }
 
-std::string AESWrapper::encrypt(const char* plain, unsigned int length)
+unsigned int AESWrapper::encryptedLength(unsigned int plainLength)
 {
-	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
+	// Padding always adds at least a byte, so a whole block is added to an aligned plaintext.
+	return (plainLength / CryptoPP::AES::BLOCKSIZE + 1) * CryptoPP::AES::BLOCKSIZE;
+}
 
-	CryptoPP::AES::Encryption aesEncryption(_key, DEFAULT_KEYLENGTH);
-	CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
+unsigned int AESWrapper::sealedLength(unsigned int plainLength)
+{
+	return NONCE_LENGTH + plainLength + TAG_LENGTH;
+}
 
-	std::string cipher;
-	CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
-	stfEncryptor.Put(reinterpret_cast<const CryptoPP::byte*>(plain), length);
-	stfEncryptor.MessageEnd();
+std::string AESWrapper::encrypt(const char* plain, unsigned int length)
+{
+	std::string cipher(encryptedLength(length), '\0');
+	encrypt(plain, length, &cipher[0], static_cast<unsigned int>(cipher.size()));
 
 	return cipher;
 }
@@ -54,15 +92,120 @@ std::string AESWrapper::encrypt(const char* plain, unsigned int length)
 
 std::string AESWrapper::decrypt(const char* cipher, unsigned int length)
 {
+	std::string decrypted(length, '\0');
+	decrypted.resize(decrypt(cipher, length, &decrypted[0], static_cast<unsigned int>(decrypted.size())));
+
+	return decrypted;
+}
+
+
+unsigned int AESWrapper::encrypt(const char* plain, unsigned int length, char* out, unsigned int outLength)
+{
+	unsigned int cipherLength = encryptedLength(length);
+	if (outLength < cipherLength)
+		throw std::length_error("buffer is too short for the cipher");
+
 	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
 
-	CryptoPP::AES::Decryption aesDecryption(_key, DEFAULT_KEYLENGTH);
-	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+	CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(_aesEncryption, iv);
 
-	std::string decrypted;
-	CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(decrypted));
-	stfDecryptor.Put(reinterpret_cast<const CryptoPP::byte*>(cipher), length);
-	stfDecryptor.MessageEnd();
+	// The whole blocks are encrypted as they are, and the tail is padded on the stack.
+	unsigned int wholeLength = length - length % CryptoPP::AES::BLOCKSIZE;
+	unsigned int tailLength = length - wholeLength;
 
-	return decrypted;
+	CryptoPP::byte last[CryptoPP::AES::BLOCKSIZE];
+	memcpy(last, plain + wholeLength, tailLength);
+	memset(last + tailLength, CryptoPP::AES::BLOCKSIZE - tailLength, CryptoPP::AES::BLOCKSIZE - tailLength);
+
+	CryptoPP::byte* cipher = reinterpret_cast<CryptoPP::byte*>(out);
+	cbcEncryption.ProcessData(cipher, reinterpret_cast<const CryptoPP::byte*>(plain), wholeLength);
+	cbcEncryption.ProcessData(cipher + wholeLength, last, CryptoPP::AES::BLOCKSIZE);
+
+	return cipherLength;
+}
+
+
+unsigned int AESWrapper::decrypt(const char* cipher, unsigned int length, char* out, unsigned int outLength)
+{
+	if (length == 0 || length % CryptoPP::AES::BLOCKSIZE != 0)
+		throw std::length_error("cipher is not made of whole blocks");
+
+	if (outLength < length)
+		throw std::length_error("buffer is too short for the plain");
+
+	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
+
+	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(_aesDecryption, iv);
+
+	CryptoPP::byte* plain = reinterpret_cast<CryptoPP::byte*>(out);
+	cbcDecryption.ProcessData(plain, reinterpret_cast<const CryptoPP::byte*>(cipher), length);
+
+	CryptoPP::byte padding = plain[length - 1];
+	if (padding == 0 || padding > CryptoPP::AES::BLOCKSIZE)
+		throw std::runtime_error("invalid padding");
+
+	for (unsigned int i = length - padding; i < length; i++)
+		if (plain[i] != padding)
+			throw std::runtime_error("invalid padding");
+
+	return length - padding;
+}
+
+
+std::string AESWrapper::seal(const char* plain, unsigned int length)
+{
+	std::string sealed(sealedLength(length), '\0');
+	seal(plain, length, &sealed[0], static_cast<unsigned int>(sealed.size()));
+
+	return sealed;
+}
+
+
+std::string AESWrapper::open(const char* sealed, unsigned int length)
+{
+	if (length < NONCE_LENGTH + TAG_LENGTH)
+		throw std::length_error("sealed message is too short");
+
+	std::string plain(length - NONCE_LENGTH - TAG_LENGTH, '\0');
+	open(sealed, length, &plain[0], static_cast<unsigned int>(plain.size()));
+
+	return plain;
+}
+
+
+unsigned int AESWrapper::seal(const char* plain, unsigned int length, char* out, unsigned int outLength)
+{
+	if (outLength < sealedLength(length))
+		throw std::length_error("buffer is too short for the sealed message");
+
+	CryptoPP::byte* nonce = reinterpret_cast<CryptoPP::byte*>(out);
+	CryptoPP::byte* cipher = nonce + NONCE_LENGTH;
+
+	// A nonce must never repeat under the same key, so each message gets a random one.
+	GenerateKey(nonce, NONCE_LENGTH);
+
+	getGcm(_gcmEncryption, _key).EncryptAndAuthenticate(cipher, cipher + length, TAG_LENGTH, nonce, NONCE_LENGTH,
+		nullptr, 0, reinterpret_cast<const CryptoPP::byte*>(plain), length);
+
+	return sealedLength(length);
+}
+
+
+unsigned int AESWrapper::open(const char* sealed, unsigned int length, char* out, unsigned int outLength)
+{
+	if (length < NONCE_LENGTH + TAG_LENGTH)
+		throw std::length_error("sealed message is too short");
+
+	const CryptoPP::byte* nonce = reinterpret_cast<const CryptoPP::byte*>(sealed);
+	const CryptoPP::byte* cipher = nonce + NONCE_LENGTH;
+	unsigned int plainLength = length - NONCE_LENGTH - TAG_LENGTH;
+
+	if (outLength < plainLength)
+		throw std::length_error("buffer is too short for the plain");
+
+	if (getGcm(_gcmDecryption, _key).DecryptAndVerify(reinterpret_cast<CryptoPP::byte*>(out), cipher + plainLength, TAG_LENGTH,
+		nonce, NONCE_LENGTH, nullptr, 0, cipher, plainLength) == false)
+		throw std::runtime_error("sealed message failed authentication");
+
+	return plainLength;
 }
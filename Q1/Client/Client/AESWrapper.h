@@ -1,5 +1,9 @@
 #pragma once
 
+#include <aes.h>
+#include <gcm.h>
+
+#include <memory>
 #include <string>
 
 
@@ -7,9 +11,25 @@ class AESWrapper
 {
 public:
 	static const unsigned int DEFAULT_KEYLENGTH = 16;
+
+	// Sealed messages are laid out as nonce | ciphertext | tag.
+	static const unsigned int NONCE_LENGTH = 12;
+	static const unsigned int TAG_LENGTH = 16;
 private:
 	unsigned char _key[DEFAULT_KEYLENGTH];
+
+	// The key is expanded once, when set, and the schedules are reused by every message.
+	// Since they are updated per message, an instance must not be used by two threads at once.
+	CryptoPP::AES::Encryption _aesEncryption;
+	CryptoPP::AES::Decryption _aesDecryption;
+
+	// Most keys are only ever used for CBC, so the GCM contexts are built by the first seal or open.
+	std::unique_ptr<CryptoPP::GCM<CryptoPP::AES>::Encryption> _gcmEncryption;
+	std::unique_ptr<CryptoPP::GCM<CryptoPP::AES>::Decryption> _gcmDecryption;
+
 	AESWrapper(const AESWrapper& aes);
+
+	void expandKey();
 public:
 	static unsigned char* GenerateKey(unsigned char* buffer, unsigned int length);
 
@@ -19,6 +39,63 @@ public:
 
 	const unsigned char* getKey() const;
 
+	// The exact output lengths, so buffers may be sized before coding.
+	static unsigned int encryptedLength(unsigned int plainLength);
+	static unsigned int sealedLength(unsigned int plainLength);
+
 	std::string encrypt(const char* plain, unsigned int length);
 	std::string decrypt(const char* cipher, unsigned int length);
+
+	/**
+		Encrypts with AES-CBC and PKCS #7 padding into the given buffer.
+		The buffer may be the plaintext itself, but must not overlap it otherwise.
+
+		@param	out			-	Must hold encryptedLength(length) bytes.
+
+		@return	unsigned int	-	The number of bytes written, exactly encryptedLength(length).
+	*/
+	unsigned int encrypt(const char* plain, unsigned int length, char* out, unsigned int outLength);
+
+	/**
+		Decrypts into the given buffer, which may be the ciphertext itself, but must not overlap it otherwise.
+
+		@param	out			-	Must hold length bytes.
+
+		@return	unsigned int	-	The number of bytes written. Throws if the ciphertext or its padding is invalid.
+	*/
+	unsigned int decrypt(const char* cipher, unsigned int length, char* out, unsigned int outLength);
+
+	/**
+		Encrypts and authenticates with AES-GCM, under a new random nonce carried in the result.
+
+		@return	string	-	The nonce, followed by the ciphertext and the tag.
+	*/
+	std::string seal(const char* plain, unsigned int length);
+
+	/**
+		Verifies and decrypts the result of seal.
+
+		@return	string	-	The plaintext. Throws if the message is too short or has been tampered with.
+	*/
+	std::string open(const char* sealed, unsigned int length);
+
+	/**
+		Same as seal, into the given buffer. The plaintext may already be in place, at out + NONCE_LENGTH,
+		but must not overlap the buffer otherwise.
+
+		@param	out			-	Must hold sealedLength(length) bytes.
+
+		@return	unsigned int	-	The number of bytes written, exactly sealedLength(length).
+	*/
+	unsigned int seal(const char* plain, unsigned int length, char* out, unsigned int outLength);
+
+	/**
+		Same as open, into the given buffer. It may be the ciphertext in place, at sealed + NONCE_LENGTH,
+		but must not overlap the message otherwise.
+
+		@param	out			-	Must hold length - NONCE_LENGTH - TAG_LENGTH bytes.
+
+		@return	unsigned int	-	The number of bytes written. Throws if the message is too short or has been tampered with.
+	*/
+	unsigned int open(const char* sealed, unsigned int length, char* out, unsigned int outLength);
 };
\ No newline at end of file
@@ -1,26 +1,421 @@
 #include "Base64Wrapper.h"
 
+#include <intrin.h>		// __cpuid
+#include <immintrin.h>	// SSSE3 / AVX2
+#include <string.h>
+
+#include <stdexcept>
+
+
+static const char ENCODE_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Values of chars out of the alphabet, all above the 6 bits of a valid value.
+static const unsigned char PADDING = 0xFD;
+static const unsigned char WHITESPACE = 0xFE;
+static const unsigned char INVALID = 0xFF;
+
+struct DecodeTable
+{
+	unsigned char values[256];
+
+	DecodeTable()
+	{
+		memset(values, INVALID, sizeof(values));
+
+		for (unsigned char i = 0; i < 64; i++)
+			values[(unsigned char)ENCODE_TABLE[i]] = i;
+
+		values['='] = PADDING;
+		values[' '] = values['\t'] = values['\r'] = values['\n'] = WHITESPACE;
+	}
+};
+
+static const DecodeTable DECODE_TABLE;
+
+enum class Isa { Scalar, Ssse3, Avx2 };
+
+static Isa DetectIsa()
+{
+	int info[4];
+
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool hasSsse3 = (info[2] & (1 << 9)) != 0;
+	bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+	bool hasAvx = (info[2] & (1 << 28)) != 0;
+
+	// AVX2 also needs the OS to save the YMM registers.
+	if (maxLeaf >= 7 && hasOsxsave && hasAvx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+
+		if ((info[1] & (1 << 5)) != 0)
+			return Isa::Avx2;
+	}
+
+	return hasSsse3 ? Isa::Ssse3 : Isa::Scalar;
+}
+
+static const Isa CPU_ISA = DetectIsa();
+
+/*
+	The vectorized coders follow Wojciech Muła's SSE/AVX2 base64 algorithms:
+	the 6-bit values are split or merged with multiplies, and mapped to or from
+	the alphabet with 16-entry lookups on their high bits.
+*/
+
+static const __m128i ENCODE_SHUFFLE = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+static const __m128i ENCODE_OFFSETS = _mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0);
+
+static const __m128i DECODE_LUT_LO = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+static const __m128i DECODE_LUT_HI = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+static const __m128i DECODE_ROLL = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+static const __m128i DECODE_SHUFFLE = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+static void EncodeGroup(const unsigned char* data, char* out)
+{
+	out[0] = ENCODE_TABLE[data[0] >> 2];
+	out[1] = ENCODE_TABLE[((data[0] & 0x03) << 4) | (data[1] >> 4)];
+	out[2] = ENCODE_TABLE[((data[1] & 0x0F) << 2) | (data[2] >> 6)];
+	out[3] = ENCODE_TABLE[data[2] & 0x3F];
+}
+
+static bool DecodeGroup(const char* data, unsigned char* out)
+{
+	unsigned char v0 = DECODE_TABLE.values[(unsigned char)data[0]];
+	unsigned char v1 = DECODE_TABLE.values[(unsigned char)data[1]];
+	unsigned char v2 = DECODE_TABLE.values[(unsigned char)data[2]];
+	unsigned char v3 = DECODE_TABLE.values[(unsigned char)data[3]];
+
+	if ((v0 | v1 | v2 | v3) >= 64)
+		return false;
+
+	out[0] = (unsigned char)((v0 << 2) | (v1 >> 4));
+	out[1] = (unsigned char)((v1 << 4) | (v2 >> 2));
+	out[2] = (unsigned char)((v2 << 6) | v3);
+	return true;
+}
+
+// Reads 16 bytes, and encodes the first 12 of them into 16 chars.
+static void EncodeSsse3(const unsigned char* data, char* out)
+{
+	__m128i in = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), ENCODE_SHUFFLE);
+
+	__m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+	__m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+	__m128i values = _mm_or_si128(high, low);
+
+	__m128i ranges = _mm_subs_epu8(values, _mm_set1_epi8(51));
+	ranges = _mm_or_si128(ranges, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), values), _mm_set1_epi8(13)));
+
+	__m128i chars = _mm_add_epi8(values, _mm_shuffle_epi8(ENCODE_OFFSETS, ranges));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+}
+
+// Reads 28 bytes, and encodes the first 24 of them into 32 chars.
+static void EncodeAvx2(const unsigned char* data, char* out)
+{
+	__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 12)), 1);
+	in = _mm256_shuffle_epi8(in, _mm256_broadcastsi128_si256(ENCODE_SHUFFLE));
+
+	__m256i high = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+	__m256i low = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+	__m256i values = _mm256_or_si256(high, low);
+
+	__m256i ranges = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+	ranges = _mm256_or_si256(ranges, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), values), _mm256_set1_epi8(13)));
+
+	__m256i chars = _mm256_add_epi8(values, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(ENCODE_OFFSETS), ranges));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+}
+
+// Decodes 16 chars into 12 bytes. Returns false, writing nothing, if any of them is out of the alphabet.
+static bool DecodeSsse3(const char* data, unsigned char* out)
+{
+	__m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+	__m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+	__m128i loNibbles = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+
+	__m128i invalid = _mm_and_si128(_mm_shuffle_epi8(DECODE_LUT_LO, loNibbles), _mm_shuffle_epi8(DECODE_LUT_HI, hiNibbles));
+	if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128())) != 0)
+		return false;
+
+	__m128i roll = _mm_shuffle_epi8(DECODE_ROLL, _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hiNibbles));
+	__m128i values = _mm_add_epi8(in, roll);
+
+	__m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+	alignas(16) unsigned char bytes[16];
+	_mm_store_si128(reinterpret_cast<__m128i*>(bytes), _mm_shuffle_epi8(merged, DECODE_SHUFFLE));
+	memcpy(out, bytes, 12);
+	return true;
+}
+
+// Decodes 32 chars into 24 bytes. Returns false, writing nothing, if any of them is out of the alphabet.
+static bool DecodeAvx2(const char* data, unsigned char* out)
+{
+	__m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+
+	__m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+	__m256i loNibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0F));
+
+	__m256i invalid = _mm256_and_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(DECODE_LUT_LO), loNibbles),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(DECODE_LUT_HI), hiNibbles));
+	if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(invalid, _mm256_setzero_si256())) != 0)
+		return false;
+
+	__m256i roll = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(DECODE_ROLL),
+		_mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), hiNibbles));
+	__m256i values = _mm256_add_epi8(in, roll);
+
+	__m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+	merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+	merged = _mm256_shuffle_epi8(merged, _mm256_broadcastsi128_si256(DECODE_SHUFFLE));
+
+	// Each lane holds 12 bytes, which are joined together.
+	merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+	alignas(32) unsigned char bytes[32];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(bytes), merged);
+	memcpy(out, bytes, 24);
+	return true;
+}
+
+// Encodes whole groups of 3 bytes. Returns the number of bytes consumed.
+static size_t EncodeGroups(const unsigned char* data, size_t length, char* out)
+{
+	size_t done = 0;
+
+	// The vectorized coders read a few bytes past those they encode.
+	if (CPU_ISA == Isa::Avx2)
+		for (; length - done >= 28; done += 24, out += 32)
+			EncodeAvx2(data + done, out);
+
+	if (CPU_ISA != Isa::Scalar)
+		for (; length - done >= 16; done += 12, out += 16)
+			EncodeSsse3(data + done, out);
+
+	for (; length - done >= 3; done += 3, out += 4)
+		EncodeGroup(data + done, out);
+
+	return done;
+}
+
+// Decodes whole groups of 4 chars, up to the first char out of the alphabet (e.g. whitespace or padding).
+// Returns the number of chars consumed.
+static size_t DecodeGroups(const char* data, size_t length, unsigned char* out, size_t& o_written)
+{
+	size_t done = 0;
+	unsigned char* start = out;
+
+	if (CPU_ISA == Isa::Avx2)
+		for (; length - done >= 32 && DecodeAvx2(data + done, out); done += 32, out += 24);
+
+	if (CPU_ISA != Isa::Scalar)
+		for (; length - done >= 16 && DecodeSsse3(data + done, out); done += 16, out += 12);
+
+	for (; length - done >= 4 && DecodeGroup(data + done, out); done += 4, out += 3);
+
+	o_written = out - start;
+	return done;
+}
+
+// Decodes a group which may be padded. Throws if it is invalid.
+static size_t DecodeLastGroup(const char* data, unsigned char* out, bool& o_isPadded)
+{
+	unsigned char v0 = DECODE_TABLE.values[(unsigned char)data[0]];
+	unsigned char v1 = DECODE_TABLE.values[(unsigned char)data[1]];
+	unsigned char v2 = DECODE_TABLE.values[(unsigned char)data[2]];
+	unsigned char v3 = DECODE_TABLE.values[(unsigned char)data[3]];
+
+	if (v0 >= 64 || v1 >= 64 ||
+		(v2 == PADDING && v3 != PADDING) ||
+		(v2 != PADDING && v2 >= 64) ||
+		(v3 != PADDING && v3 >= 64))
+		throw std::invalid_argument("invalid base64 group");
+
+	out[0] = (unsigned char)((v0 << 2) | (v1 >> 4));
+	if (v2 == PADDING)
+	{
+		o_isPadded = true;
+		return 1;
+	}
+
+	out[1] = (unsigned char)((v1 << 4) | (v2 >> 2));
+	if (v3 == PADDING)
+	{
+		o_isPadded = true;
+		return 2;
+	}
+
+	out[2] = (unsigned char)((v2 << 6) | v3);
+	return 3;
+}
+
+
+Base64Wrapper::Encoder::Encoder() : _pending(), _pendingLength(0)
+{
+}
+
+size_t Base64Wrapper::Encoder::update(const unsigned char* data, size_t length, char* out)
+{
+	size_t written = 0;
+
+	// Completing the group left over by the previous piece.
+	if (_pendingLength > 0)
+	{
+		size_t needed = 3 - _pendingLength;
+		if (length < needed)
+		{
+			memcpy(_pending + _pendingLength, data, length);
+			_pendingLength += length;
+			return 0;
+		}
+
+		unsigned char group[3];
+		memcpy(group, _pending, _pendingLength);
+		memcpy(group + _pendingLength, data, needed);
+		EncodeGroup(group, out);
+
+		data += needed;
+		length -= needed;
+		written += 4;
+		_pendingLength = 0;
+	}
+
+	size_t consumed = EncodeGroups(data, length, out + written);
+	written += consumed / 3 * 4;
+
+	_pendingLength = length - consumed;
+	memcpy(_pending, data + consumed, _pendingLength);
+
+	return written;
+}
+
+size_t Base64Wrapper::Encoder::final(char* out)
+{
+	size_t pendingLength = _pendingLength;
+	_pendingLength = 0;
+
+	if (pendingLength == 0)
+		return 0;
+
+	unsigned char second = pendingLength == 2 ? _pending[1] : 0;
+
+	out[0] = ENCODE_TABLE[_pending[0] >> 2];
+	out[1] = ENCODE_TABLE[((_pending[0] & 0x03) << 4) | (second >> 4)];
+	out[2] = pendingLength == 2 ? ENCODE_TABLE[(second & 0x0F) << 2] : '=';
+	out[3] = '=';
+	return 4;
+}
+
+
+Base64Wrapper::Decoder::Decoder() : _pending(), _pendingLength(0), _isPadded(false)
+{
+}
+
+size_t Base64Wrapper::Decoder::update(const char* data, size_t length, unsigned char* out)
+{
+	size_t written = 0;
+
+	while (length > 0)
+	{
+		// Decoding in bulk while aligned to a group, until a char which needs care.
+		if (_pendingLength == 0 && _isPadded == false)
+		{
+			size_t bulkWritten = 0;
+			size_t consumed = DecodeGroups(data, length, out + written, bulkWritten);
+
+			data += consumed;
+			length -= consumed;
+			written += bulkWritten;
+
+			if (length == 0)
+				break;
+		}
+
+		char c = *data++;
+		length--;
+
+		unsigned char value = DECODE_TABLE.values[(unsigned char)c];
+		if (value == WHITESPACE)
+			continue;
+
+		if (value == INVALID || _isPadded == true)
+			throw std::invalid_argument("invalid base64 character");
+
+		_pending[_pendingLength++] = c;
+		if (_pendingLength < 4)
+			continue;
+
+		written += DecodeLastGroup(_pending, out + written, _isPadded);
+		_pendingLength = 0;
+	}
+
+	return written;
+}
+
+size_t Base64Wrapper::Decoder::final(unsigned char* out)
+{
+	size_t pendingLength = _pendingLength;
+	_pendingLength = 0;
+	_isPadded = false;
+
+	if (pendingLength == 0)
+		return 0;
+
+	if (pendingLength == 1)
+		throw std::invalid_argument("truncated base64 input");
+
+	char group[4] = { '=', '=', '=', '=' };
+	memcpy(group, _pending, pendingLength);
+
+	bool isPadded = false;
+	return DecodeLastGroup(group, out, isPadded);
+}
+
+
+size_t Base64Wrapper::encodedLength(size_t length)
+{
+	return (length + 2) / 3 * 4;
+}
+
+size_t Base64Wrapper::maxDecodedLength(size_t length)
+{
+	return (length + 3) / 4 * 3;
+}
+
+size_t Base64Wrapper::encode(const unsigned char* data, size_t length, char* out)
+{
+	Encoder encoder;
+	size_t written = encoder.update(data, length, out);
+	return written + encoder.final(out + written);
+}
+
+size_t Base64Wrapper::decode(const char* data, size_t length, unsigned char* out)
+{
+	Decoder decoder;
+	size_t written = decoder.update(data, length, out);
+	return written + decoder.final(out + written);
+}
 
 std::string Base64Wrapper::encode(const std::string& str)
 {
-	std::string encoded;
-	CryptoPP::StringSource ss(str, true,
-		new CryptoPP::Base64Encoder(
-			new CryptoPP::StringSink(encoded)
-		) // Base64Encoder
-	); // StringSource
+	std::string encoded(encodedLength(str.size()), '\0');
+	encode(reinterpret_cast<const unsigned char*>(str.data()), str.size(), &encoded[0]);
 
 	return encoded;
 }
 
 std::string Base64Wrapper::decode(const std::string& str)
 {
-	std::string decoded;
-	CryptoPP::StringSource ss(str, true,
-		new CryptoPP::Base64Decoder(
-			new CryptoPP::StringSink(decoded)
-		) // Base64Decoder
-	); // StringSource
+	std::string decoded(maxDecodedLength(str.size()), '\0');
+	decoded.resize(decode(str.data(), str.size(), reinterpret_cast<unsigned char*>(&decoded[0])));
 
 	return decoded;
 }
@@ -1,12 +1,98 @@
 #pragma once
 
+#include <stddef.h>
+
 #include <string>
-#include <base64.h>
 
 
+/**
+	Base64 (RFC 4648, padded, without line breaks) over caller-given buffers.
+	Long inputs are coded 24 or 12 bytes at a time with AVX2 or SSSE3, whichever the CPU has,
+	and any remainder byte by byte.
+
+	Decoding skips whitespace, so line-wrapped text is accepted, and throws upon any other invalid character.
+*/
 class Base64Wrapper
 {
 public:
+	/**
+		Encodes a stream given in pieces of any length, e.g. a file read a block at a time.
+	*/
+	class Encoder
+	{
+	private:
+		// Input bytes not making a whole group of 3 yet.
+		unsigned char _pending[2];
+		size_t _pendingLength;
+	public:
+		Encoder();
+
+		/**
+			@param	out	-	Must hold encodedLength(length) chars.
+
+			@return	size_t	-	The number of chars written.
+		*/
+		size_t update(const unsigned char* data, size_t length, char* out);
+
+		/**
+			Pads the last group. The encoder is ready for a new stream afterwards.
+
+			@param	out	-	Must hold 4 chars.
+
+			@return	size_t	-	The number of chars written.
+		*/
+		size_t final(char* out);
+	};
+
+	/**
+		Decodes a stream given in pieces of any length, split anywhere.
+	*/
+	class Decoder
+	{
+	private:
+		// Input chars not making a whole group of 4 yet.
+		char _pending[4];
+		size_t _pendingLength;
+
+		// Set once a padded group was decoded, after which only whitespace may follow.
+		bool _isPadded;
+	public:
+		Decoder();
+
+		/**
+			@param	out	-	Must hold maxDecodedLength(length) bytes.
+
+			@return	size_t	-	The number of bytes written. Throws upon an invalid character.
+		*/
+		size_t update(const char* data, size_t length, unsigned char* out);
+
+		/**
+			Decodes a last group given without padding. The decoder is ready for a new stream afterwards.
+
+			@param	out	-	Must hold 2 bytes.
+
+			@return	size_t	-	The number of bytes written. Throws if a single char is left over.
+		*/
+		size_t final(unsigned char* out);
+	};
+
+	static size_t encodedLength(size_t length);
+	static size_t maxDecodedLength(size_t length);
+
+	/**
+		@param	out	-	Must hold encodedLength(length) chars.
+
+		@return	size_t	-	The number of chars written, exactly encodedLength(length).
+	*/
+	static size_t encode(const unsigned char* data, size_t length, char* out);
+
+	/**
+		@param	out	-	Must hold maxDecodedLength(length) bytes.
+
+		@return	size_t	-	The number of bytes written. Throws upon invalid input.
+	*/
+	static size_t decode(const char* data, size_t length, unsigned char* out);
+
 	static std::string encode(const std::string& str);
 	static std::string decode(const std::string& str);
 };
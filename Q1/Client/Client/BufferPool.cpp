@@ -0,0 +1,57 @@
+#include "BufferPool.h"
+
+BufferPool::Buffer::Buffer(BufferPool& pool, std::unique_ptr<std::vector<uint8_t>> buffer) : m_pool(&pool), m_buffer(std::move(buffer)) {}
+
+BufferPool::Buffer::Buffer(Buffer&& other) : m_pool(other.m_pool), m_buffer(std::move(other.m_buffer)) {}
+
+BufferPool::Buffer::~Buffer() {
+	if (this->m_buffer != nullptr) {
+		this->m_pool->Release(std::move(this->m_buffer));
+	}
+}
+
+std::vector<uint8_t>& BufferPool::Buffer::Get() {
+	return *this->m_buffer;
+}
+
+ByteView BufferPool::Buffer::GetView(size_t offset) const {
+	return ByteView(*this->m_buffer).SubView(offset);
+}
+
+BufferPool::BufferPool() {
+	this->m_free.reserve(MAX_POOLED_BUFFERS);
+}
+
+BufferPool::Buffer BufferPool::Acquire() {
+	std::unique_ptr<std::vector<uint8_t>> buffer;
+
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		if (this->m_free.empty() == false) {
+			buffer = std::move(this->m_free.back());
+			this->m_free.pop_back();
+		}
+	}
+
+	if (buffer == nullptr) {
+		buffer.reset(new std::vector<uint8_t>());
+	}
+
+	return Buffer(*this, std::move(buffer));
+}
+
+void BufferPool::Release(std::unique_ptr<std::vector<uint8_t>> buffer) {
+	if (buffer->capacity() > MAX_POOLED_CAPACITY) {
+		return;
+	}
+
+	// Keeping the capacity, the content is meaningless from now on.
+	buffer->clear();
+
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	if (this->m_free.size() < MAX_POOLED_BUFFERS) {
+		this->m_free.push_back(std::move(buffer));
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ByteView.h"
+
+/**
+	This class keeps receive buffers for reuse, so reading a response doesn't
+	allocate once the pool has warmed up.
+
+	A buffer is leased with Acquire, and returns to the pool along with its capacity
+	once the lease is destroyed. Buffers which grew too large are released instead,
+	so a single huge response won't pin its memory forever.
+*/
+class BufferPool {
+public:
+	// Most buffers kept in the pool at once.
+	static constexpr size_t MAX_POOLED_BUFFERS = 4;
+
+	// Buffers with a larger capacity are freed instead of being pooled.
+	static constexpr size_t MAX_POOLED_CAPACITY = 16 * 1024 * 1024;
+
+	class Buffer {
+	public:
+		Buffer(BufferPool& pool, std::unique_ptr<std::vector<uint8_t>> buffer);
+		Buffer(Buffer&& other);
+		~Buffer();
+
+		/**
+			@return	vector	-	The leased buffer. Its content is unspecified once acquired.
+		*/
+		std::vector<uint8_t>& Get();
+
+		/**
+			@param	offset	-	The offset of the view from the start of the buffer.
+
+			@return	ByteView	-	A view from the given offset to the end of the buffer.
+		*/
+		ByteView GetView(size_t offset = 0) const;
+
+	private:
+		Buffer(const Buffer&);
+		Buffer& operator=(const Buffer&);
+
+		BufferPool* m_pool;
+		std::unique_ptr<std::vector<uint8_t>> m_buffer;
+	};
+
+	BufferPool();
+
+	/**
+		@return	Buffer	-	A pooled buffer if any is free, a new buffer otherwise.
+	*/
+	Buffer Acquire();
+
+private:
+	void Release(std::unique_ptr<std::vector<uint8_t>> buffer);
+
+	BufferPool(const BufferPool&);
+	BufferPool& operator=(const BufferPool&);
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<std::vector<uint8_t>>> m_free;
+};
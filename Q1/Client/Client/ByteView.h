@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdexcept>
+#include <vector>
+
+/**
+	A non-owning view over a range of bytes, e.g. the payload inside a received response.
+	The viewed buffer must outlive the view, and mustn't be resized while viewed.
+*/
+class ByteView {
+public:
+	ByteView() : m_data(nullptr), m_size(0) {}
+	ByteView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+	ByteView(const std::vector<uint8_t>& inVector) : m_data(inVector.data()), m_size(inVector.size()) {}
+
+	const uint8_t* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+	bool IsEmpty() const { return m_size == 0; }
+
+	const uint8_t* begin() const { return m_data; }
+	const uint8_t* end() const { return m_data + m_size; }
+
+	/**
+		@param	offset	-	The offset of the sub view from the start of this view.
+		@param	length	-	The length of the sub view.
+
+		@return	ByteView	-	A view over the given range. Throws if it exceeds this view.
+	*/
+	ByteView SubView(size_t offset, size_t length) const {
+		if (offset > m_size || length > m_size - offset) {
+			throw std::out_of_range("Sub view exceeds the viewed buffer");
+		}
+
+		return ByteView(m_data + offset, length);
+	}
+
+	/**
+		@param	offset	-	The offset of the sub view from the start of this view.
+
+		@return	ByteView	-	A view from the given offset to the end. Throws if it exceeds this view.
+	*/
+	ByteView SubView(size_t offset) const {
+		if (offset > m_size) {
+			throw std::out_of_range("Sub view exceeds the viewed buffer");
+		}
+
+		return ByteView(m_data + offset, m_size - offset);
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+	This class keeps track of whether the server is reachable, so requests fail fast
+	while it is known to be down instead of each paying for a connect timeout.
+
+	After enough consecutive failures the breaker opens, and requests are refused.
+	While open, the endpoint is probed periodically, and a successful probe closes the breaker.
+
+	It is not thread safe. It is used by the connection's I/O thread only,
+	and before pipelining by the thread whose requests run the connection's context.
+*/
+class CircuitBreaker {
+public:
+	// Consecutive failures which open the breaker.
+	static constexpr uint32_t FAILURE_THRESHOLD = 3;
+
+	// Time between probes of the endpoint while the breaker is open.
+	static constexpr uint32_t PROBE_INTERVAL_MS = 2000;
+
+	CircuitBreaker() : m_failures(0) {}
+
+	/**
+		@return	bool	-	True if requests shall be refused, false otherwise.
+	*/
+	bool IsOpen() const { return m_failures >= FAILURE_THRESHOLD; }
+
+	/**
+		Closes the breaker, since the endpoint has just proven reachable.
+	*/
+	void RecordSuccess() { m_failures = 0; }
+
+	/**
+		@return	bool	-	True if this failure has just opened the breaker, so probing shall start.
+	*/
+	bool RecordFailure() {
+		if (IsOpen() == true) {
+			return false;
+		}
+
+		m_failures++;
+		return IsOpen();
+	}
+
+private:
+	uint32_t m_failures;
+};
@@ -1,13 +1,24 @@
 #include "Client.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
 
 #include "SystemUtils.h"
 
 static constexpr const char* ME_INFO_PATH = "me.info";
 static constexpr const char* SERVER_INFO_PATH = "server.info";
 
+// The roster and the keys, kept next to 'me.info' for fast restarts.
+static constexpr const char* CLIENT_STATE_PATH = "client.state";
+
 // Four three digit numbers, and four dots for seperation.
 static constexpr size_t MAX_IP_STR_LENGTH = (4 * 3) + 3;
 static constexpr size_t MIN_IP_STR_LENGTH = (4 * 1) + 3;
@@ -16,26 +27,124 @@ static constexpr size_t MIN_IP_STR_LENGTH = (4 * 1) + 3;
 static constexpr size_t MAX_PORT_STR_LENGTH = 5; 
 static constexpr size_t MIN_PORT_STR_LENGTH = 1;
 
-Client::Client() : m_isInit(false), m_port(0), m_privateKey(nullptr) {}
+// Limits of a single page of waiting messages, so a large backlog is fetched in bounded requests.
+static constexpr uint32_t MESSAGES_PAGE_MAX_BYTES = 1024 * 1024;
+static constexpr uint32_t MESSAGES_PAGE_MAX_COUNT = 0;
+
+// Limits of a window of messages decrypted in parallel. A page is read and handled a window at a time.
+static constexpr size_t PARALLEL_WINDOW_MAX_COUNT = 256;
+static constexpr size_t PARALLEL_WINDOW_MAX_BYTES = 256 * 1024;
+
+// Texts shorter than this are sent as they are, since deflating them hardly pays off.
+static constexpr size_t COMPRESSION_THRESHOLD = 256;
+
+// Received texts which inflate beyond this are rejected.
+static constexpr size_t MAX_DECOMPRESSED_LENGTH = 16 * 1024 * 1024;
+
+// How many times a file chunk is sent again while the destination's mailbox is full, a second apart.
+static constexpr size_t FILE_CHUNK_RETRIES = 30;
+
+// How long each wait request is held by the server. The server may hold it for less.
+static constexpr uint32_t WAIT_MESSAGES_TIMEOUT_MS = 20 * 1000;
+
+// A wait request's deadline is its timeout, with a margin for the round trip.
+static constexpr uint32_t WAIT_MESSAGES_DEADLINE_MS = WAIT_MESSAGES_TIMEOUT_MS + Connection::DEFAULT_TIMEOUT_MS;
+
+// Requests which may be safely sent twice are attempted up to this many times.
+static constexpr size_t MAX_ATTEMPTS = 3;
+
+// Retries wait a random time of up to the base delay, doubled with every retry and capped.
+static constexpr uint32_t RETRY_BASE_DELAY_MS = 100;
+static constexpr uint32_t RETRY_MAX_DELAY_MS = 2000;
+
+/**
+	Fetching messages isn't idempotent, since the server removes the messages it sends.
+	A retry after a lost response would go on as if the lost messages had never been waiting.
+
+	@param	request	-	The segments of a request, starting with its header.
+
+	@return	bool	-	True if the request has no effect when sent twice, so it may be retried.
+*/
+static bool IsIdempotent(const RequestSegments& request) {
+	switch (PipelinedRequestHeader(request, 0).GetCode()) {
+	case Opcode::RequestList:
+	case Opcode::RequestPK:
+	case Opcode::RequestDirectorySync:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+	Sleeps before a retry, for a random time so many clients won't retry in lockstep.
+
+	@param	attempt	-	The number of attempts made so far.
+*/
+static void BackoffBeforeRetry(size_t attempt) {
+	static thread_local std::mt19937 generator(std::random_device{}());
+
+	uint32_t maxDelay = std::min<uint32_t>(RETRY_MAX_DELAY_MS, RETRY_BASE_DELAY_MS << std::min<size_t>(attempt, 16));
+	std::uniform_int_distribution<uint32_t> delay(0, maxDelay);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(delay(generator)));
+}
+
+/**
+	@param	error	-	The error which failed an attempt.
+
+	@return	bool	-	True if another attempt may succeed, false if the server is known to be down.
+*/
+static bool IsRetriable(const boost::system::system_error& error) {
+	return error.code() != boost::asio::error::host_unreachable;
+}
+
+Client::Client() : m_isInit(false), m_infoPath(ME_INFO_PATH), m_statePath(CLIENT_STATE_PATH), m_port(0),
+					m_ownedConnection(new Connection()), m_connection(*m_ownedConnection),
+					m_ownedBufferPool(new BufferPool()), m_bufferPool(*m_ownedBufferPool),
+					m_directoryEpoch(0), m_directoryVersion(0), m_store(CLIENT_STATE_PATH), m_keyPoolDepth(KeyPool::DEFAULT_DEPTH),
+					m_keyPoolThreads(KeyPool::DEFAULT_THREAD_COUNT), m_keyPoolHits(0), m_keyPoolMisses(0), m_privateKey(nullptr),
+					m_agreementKey(nullptr), m_isAgreementKeyPublished(false), m_batchMessages(nullptr), m_deferredMessages(nullptr) {}
+
+Client::Client(const std::string& infoPath, const std::string& statePath, Connection& connection, BufferPool& bufferPool) :
+					m_isInit(false), m_infoPath(infoPath), m_statePath(statePath), m_port(0),
+					m_connection(connection), m_bufferPool(bufferPool),
+					m_directoryEpoch(0), m_directoryVersion(0), m_store(statePath), m_keyPoolDepth(KeyPool::DEFAULT_DEPTH),
+					m_keyPoolThreads(KeyPool::DEFAULT_THREAD_COUNT), m_keyPoolHits(0), m_keyPoolMisses(0), m_privateKey(nullptr),
+					m_agreementKey(nullptr), m_isAgreementKeyPublished(false), m_batchMessages(nullptr), m_deferredMessages(nullptr) {}
 
 Client::~Client() {
 	if (this->m_privateKey != nullptr) {
 		delete this->m_privateKey;
 	}
 
-	for (auto& currTuple : this->m_data) {
-		delete currTuple.second;
+	if (this->m_agreementKey != nullptr) {
+		delete this->m_agreementKey;
 	}
 }
 
+void Client::SetKeyPool(size_t depth, size_t threadCount) {
+	this->m_keyPoolDepth = depth;
+	this->m_keyPoolThreads = threadCount;
+}
+
 bool Client::Init() {
 
-	// Parsing server info
-	if (ParseServerInfo() == false) {
-		return false;
+	// Parsing server info, unless hosted on a connection which is already set.
+	if (this->m_ownedConnection != nullptr) {
+		if (ParseServerInfo(this->m_ipAddr, this->m_port) == false) {
+			return false;
+		}
+
+		this->m_connection.SetEndpoint(this->m_ipAddr, this->m_port);
+
+		// Pipelined frames let requests be sent without waiting for each other, but older servers reject them,
+		// so they are used only once the server has answered with a version which supports them.
+		this->m_connection.EnablePipeliningWhenSupported();
 	}
 
-	if (SystemUtils::IsFileExists(ME_INFO_PATH) == false) {
+	if (SystemUtils::IsFileExists(this->m_infoPath) == false) {
 		// If the personal information doesn't exists, the user hasn't
 		// registered yet, so the m_init field won't be set to true.
 
@@ -44,6 +153,10 @@ bool Client::Init() {
 		// and the client are aware of him being registered.
 
 		this->m_isInit = false;
+
+		// Generating the key pair meanwhile, while the user is still choosing a name.
+		this->m_keyPool.reset(new KeyPool(this->m_keyPoolDepth, this->m_keyPoolThreads));
+
 		return true;
 	}
 
@@ -51,7 +164,22 @@ bool Client::Init() {
 		return false;
 	}
 
+	// Without a store the client still works, only the roster and keys must be fetched again.
+	uuid_t ownerUuid;
+	this->m_uuid.Serialize(ownerUuid, sizeof(ownerUuid));
+
+	if (this->m_store.Open(ownerUuid, this->m_roster, this->m_directoryEpoch, this->m_directoryVersion) == false) {
+		std::cout << "Failed opening " << this->m_statePath << std::endl;
+	}
+
 	this->m_isInit = true;
+
+	// Friends may only agree on keys with a user whose key is registered, so it is done before anything else.
+	// A failure only means texts to this user keep coming over RSA.
+	if (PublishAgreementKey() != Client::ReturnStatus::Success) {
+		std::cout << "Failed registering agreement key" << std::endl;
+	}
+
 	return true;
 }
 
@@ -77,7 +205,15 @@ void Client::Run(){
 			break;
 
 		case Client::MenuOptions::GetMessages:
-			ret = HandleWaitingMessages();
+			ret = HandleWaitingMessages(false);
+			break;
+
+		case Client::MenuOptions::GetMessagesParallel:
+			ret = HandleWaitingMessages(true);
+			break;
+
+		case Client::MenuOptions::ListenForMessages:
+			ret = HandleListenForMessages();
 			break;
 
 		case Client::MenuOptions::SendMessageToFriend:
@@ -92,6 +228,14 @@ void Client::Run(){
 			ret = HandleSendSymKey();
 			break;
 
+		case Client::MenuOptions::SendMessageToMany:
+			ret = HandleSendMessageToMany();
+			break;
+
+		case Client::MenuOptions::SendFile:
+			ret = HandleSendFile();
+			break;
+
 		case Client::MenuOptions::Exit:
 			// End the program and de-allocate memory in d'tor.
 			return;
@@ -101,6 +245,11 @@ void Client::Run(){
 			break;
 		}
 
+		// Anything learned by the request is kept, even if it has failed midway.
+		if (this->m_isInit == true) {
+			SaveChanges();
+		}
+
 		if (ret == Client::ReturnStatus::ServerError) {
 			std::cout << "Server responded with an error" << std::endl;
 		}
@@ -110,16 +259,280 @@ void Client::Run(){
 	}
 }
 
+void Client::RunBatch(std::istream& commands) {
+
+	// The results go where std::cout writes, since std::cout itself is taken over to capture what the handlers print.
+	std::ostream results(std::cout.rdbuf());
+
+	// Reading a command mustn't flush the results. They are flushed only once no more commands are pending.
+	commands.tie(nullptr);
+
+	std::string line;
+	uint64_t lineNumber = 0;
+
+	while (true) {
+
+		if (commands.rdbuf()->in_avail() <= 0) {
+			results.flush();
+		}
+
+		if (std::getline(commands, line).fail() == true) {
+			break;
+		}
+
+		lineNumber++;
+
+		std::istringstream args(line);
+		std::string command;
+
+		// Blank lines and comments are skipped.
+		if ((args >> command).fail() == true || command[0] == '#') {
+			continue;
+		}
+
+		if (command == "exit") {
+			break;
+		}
+
+		JsonObject result;
+		result.AddNumber("line", lineNumber).AddString("command", command);
+
+		std::ostringstream diagnostics;
+		std::streambuf* stdoutBuffer = std::cout.rdbuf(diagnostics.rdbuf());
+
+		bool isSuccess = RunCommand(command, args, result);
+
+		std::cout.rdbuf(stdoutBuffer);
+
+		// What the handlers printed explains a failure, or is merely noted upon success.
+		std::string printed = diagnostics.str();
+
+		while (printed.empty() == false && printed.back() == '\n') {
+			printed.pop_back();
+		}
+
+		if (printed.empty() == false) {
+			result.AddString(isSuccess == true ? "log" : "error", printed);
+		}
+
+		results << result.ToString() << '\n';
+	}
+
+	results.flush();
+}
+
+bool Client::RunCommand(const std::string& command, std::istream& args, JsonObject& o_result) {
+
+	Client::ReturnStatus ret = Client::ReturnStatus::GeneralError;
+
+	try {
+		ret = RunBatchCommand(command, args, o_result);
+
+		// Anything learned by the command is kept, even if it has failed midway.
+		if (this->m_isInit == true) {
+			SaveChanges();
+		}
+	}
+	catch (...) {
+		std::cout << "Unexpected error" << std::endl;
+	}
+
+	AddStatus(ret, o_result);
+
+	return ret == Client::ReturnStatus::Success;
+}
+
+bool Client::Poll(JsonObject& o_result, bool& o_isMorePending) {
+
+	o_isMorePending = false;
+
+	if (this->m_isInit == false) {
+		std::cout << "Must register before making this action." << std::endl;
+		AddStatus(Client::ReturnStatus::GeneralError, o_result);
+		return true;
+	}
+
+	std::vector<JsonObject> messages;
+	Client::ReturnStatus ret = Client::ReturnStatus::GeneralError;
+
+	try {
+		ret = FetchMessagesPage(messages, o_isMorePending);
+
+		// Keys received along with the messages are kept.
+		SaveChanges();
+	}
+	catch (...) {
+		std::cout << "Unexpected error" << std::endl;
+	}
+
+	AddStatus(ret, o_result);
+	o_result.AddObjects("messages", messages);
+
+	return ret != Client::ReturnStatus::Success || messages.empty() == false;
+}
+
+Client::ReturnStatus Client::RunBatchCommand(const std::string& command, std::istream& args, JsonObject& o_result) {
+
+	if (command != "register" &&
+		command != "list" &&
+		command != "pk" &&
+		command != "send" &&
+		command != "send-sym" &&
+		command != "request-sym" &&
+		command != "fetch") {
+		std::cout << "Unknown command" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	// The same as the menu, an unregistered user may only register.
+	if (this->m_isInit == false && command != "register") {
+		std::cout << "Must register before making this action." << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	// All the commands but the list and fetch are given a name, either the user's or the destination's.
+	std::string name;
+	args >> name;
+
+	if (command == "register") {
+		Client::ReturnStatus ret = Register(name);
+
+		std::string uuid;
+		if (ret == Client::ReturnStatus::Success && this->m_uuid.ToFile(uuid) == true) {
+			o_result.AddString("uuid", uuid);
+		}
+
+		if (ret == Client::ReturnStatus::Success) {
+			o_result.AddNumber("key_pool_hits", this->m_keyPoolHits).AddNumber("key_pool_misses", this->m_keyPoolMisses);
+		}
+
+		return ret;
+	}
+
+	if (command == "list") {
+		Client::ReturnStatus ret = SyncDirectory();
+
+		std::vector<std::string> names;
+		names.reserve(this->m_roster.GetSize());
+
+		for (const auto& currFriend : this->m_roster) {
+			names.push_back(currFriend.GetName());
+		}
+
+		o_result.AddStrings("users", names);
+
+		return ret;
+	}
+
+	if (command == "pk") {
+		return RequestPublicKey(name);
+	}
+
+	if (command == "send") {
+		// The text is the rest of the line.
+		std::string message;
+		std::getline(args >> std::ws, message);
+
+		return SendText(name, message);
+	}
+
+	if (command == "send-sym") {
+		return SendSymKey(name);
+	}
+
+	if (command == "request-sym") {
+		return RequestSymKey(name);
+	}
+
+	std::vector<JsonObject> messages;
+	Client::ReturnStatus ret = FetchMessages(messages);
+
+	o_result.AddObjects("messages", messages);
+
+	return ret;
+}
+
+Client::ReturnStatus Client::FetchMessages(std::vector<JsonObject>& o_messages) {
+
+	// The messages are reported rather than printed.
+	this->m_batchMessages = &o_messages;
+	Client::ReturnStatus ret = HandleWaitingMessages(false);
+	this->m_batchMessages = nullptr;
+
+	return ret;
+}
+
+Client::ReturnStatus Client::FetchMessagesPage(std::vector<JsonObject>& o_messages, bool& o_isMorePending) {
+
+	o_isMorePending = false;
+
+	RequestGetMessagesPage request(this->m_uuid);
+	request.body.maxBytes = MESSAGES_PAGE_MAX_BYTES;
+	request.body.maxCount = MESSAGES_PAGE_MAX_COUNT;
+
+	RequestSegments requestSegments;
+	request.GetSegments(requestSegments);
+
+	// Not streamed, since a streamed page would hold the read side of the connection until all its messages are decrypted.
+	BufferPool::Buffer pageBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& pageVec = pageBuffer.Get();
+
+	Client::ReturnStatus ret = Exchange(requestSegments, pageVec);
+
+	if (ret != Client::ReturnStatus::Success) {
+		return ret;
+	}
+
+	ByteView payload = ByteView(pageVec).SubView(sizeof(BaseResponseHeader));
+
+	if (payload.GetSize() < ResponseGetMessagesPageHeader::GetSize()) {
+		std::cout << "Read invalid page header from server" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	ResponseGetMessagesPageHeader pageHeader;
+	memcpy(&pageHeader, payload.GetData(), ResponseGetMessagesPageHeader::GetSize());
+	o_isMorePending = pageHeader.morePending != 0;
+
+	// The messages are reported rather than printed.
+	this->m_batchMessages = &o_messages;
+	ret = ProcessMessages(payload.SubView(ResponseGetMessagesPageHeader::GetSize()));
+	this->m_batchMessages = nullptr;
+
+	return ret;
+}
+
+
 //-------------------------------------------- UTILITIES --------------------------------------------
 
+void Client::AddStatus(Client::ReturnStatus status, JsonObject& o_result) {
+	switch (status) {
+	case Client::ReturnStatus::Success:
+		o_result.AddString("status", "ok");
+		break;
+
+	case Client::ReturnStatus::ServerError:
+		o_result.AddString("status", "server_error");
+		break;
+
+	default:
+		o_result.AddString("status", "error");
+		break;
+	}
+}
+
 void Client::PrintOption() {
 	std::cout << "10) Register" << std::endl;
 	std::cout << "20) Request for client list" << std::endl;
 	std::cout << "30) Request for public key" << std::endl;
 	std::cout << "40) Request for waiting messages" << std::endl;
+	std::cout << "41) Listen for incoming messages" << std::endl;
+	std::cout << "42) Request for waiting messages, decrypting them in parallel" << std::endl;
 	std::cout << "50) Send a text message" << std::endl;
 	std::cout << "51) Send a request for symmetric key" << std::endl;
 	std::cout << "52) Send your symmetric key" << std::endl;
+	std::cout << "53) Send a text message to several friends" << std::endl;
+	std::cout << "54) Send a file" << std::endl;
 	std::cout << " 0) Exit client" << std::endl;
 }
 
@@ -151,9 +564,13 @@ Client::MenuOptions Client::GetMenuChoise() const {
 			userInput != (uint16_t)Client::MenuOptions::ClientList &&
 			userInput != (uint16_t)Client::MenuOptions::PublicKey &&
 			userInput != (uint16_t)Client::MenuOptions::GetMessages &&
+			userInput != (uint16_t)Client::MenuOptions::ListenForMessages &&
+			userInput != (uint16_t)Client::MenuOptions::GetMessagesParallel &&
 			userInput != (uint16_t)Client::MenuOptions::SendMessageToFriend &&
 			userInput != (uint16_t)Client::MenuOptions::GetSymKey &&
 			userInput != (uint16_t)Client::MenuOptions::SendSymKey &&
+			userInput != (uint16_t)Client::MenuOptions::SendMessageToMany &&
+			userInput != (uint16_t)Client::MenuOptions::SendFile &&
 			userInput != (uint16_t)Client::MenuOptions::Exit) {
 			// (I hate c++ and its un-iterable enums.)
 			std::cout << "Invalid option, please try choosing from the menu again." << std::endl;
@@ -180,7 +597,7 @@ Client::MenuOptions Client::GetMenuChoise() const {
 	return static_cast<Client::MenuOptions>(userInput);
 }
 
-bool Client::ParseServerInfo() {
+bool Client::ParseServerInfo(std::string& o_ipAddr, uint16_t& o_port) {
 
 	if (SystemUtils::IsFileExists(SERVER_INFO_PATH) == false) {
 		std::cout << "Server info file doesn't exists" << std::endl;
@@ -230,8 +647,8 @@ bool Client::ParseServerInfo() {
 
 	// Trying to cast the values read from the file in case 'stoi' fails or more.
 	try {
-		this->m_ipAddr = line.substr(0, delimiterIndex);
-		boost::asio::ip::address::from_string(this->m_ipAddr);
+		o_ipAddr = line.substr(0, delimiterIndex);
+		boost::asio::ip::address::from_string(o_ipAddr);
 
 		tmp = stoi(line.substr(delimiterIndex + 1));
 	}
@@ -251,7 +668,7 @@ bool Client::ParseServerInfo() {
 		return false;
 	}
 
-	this->m_port = (uint16_t)tmp;
+	o_port = (uint16_t)tmp;
 
 	return true;
 }
@@ -270,27 +687,27 @@ bool Client::ParseMeInfo() {
 	}
 
 	// Openning file for reading.
-	infoFile.open(ME_INFO_PATH);
+	infoFile.open(this->m_infoPath);
 	if (infoFile.is_open() == false) {
-		std::cout << "Failed openning " << ME_INFO_PATH << std::endl;
+		std::cout << "Failed openning " << this->m_infoPath << std::endl;
 		return false;
 	}
 
 	// Reading exactly three lines, as difined.
 	if (!std::getline(infoFile, inputName)) {
-		std::cout << "Failed reading name from " << ME_INFO_PATH << std::endl;
+		std::cout << "Failed reading name from " << this->m_infoPath << std::endl;
 		infoFile.close();
 		return false;
 	}
 
 	if (!std::getline(infoFile, inputUuid)) {
-		std::cout << "Failed reading uuid from " << ME_INFO_PATH << std::endl;
+		std::cout << "Failed reading uuid from " << this->m_infoPath << std::endl;
 		infoFile.close();
 		return false;
 	}
 
 	if (!std::getline(infoFile, inputPrivateKey)) {
-		std::cout << "Failed reading private key from " << ME_INFO_PATH << std::endl;
+		std::cout << "Failed reading private key from " << this->m_infoPath << std::endl;
 		infoFile.close();
 		return false;
 	}
@@ -312,14 +729,8 @@ bool Client::ParseMeInfo() {
 		return false;
 	}
 
-	// Validating the private key.
-	try {
-		this->m_privateKey = new RSAPrivateWrapper(Base64Wrapper::decode(inputPrivateKey));
-	}
-	catch (const std::exception&) {
-		std::cout << "Invalid key" << std::endl;
-		return false;
-	}
+	// The private key is decoded and parsed only once used, so starting up doesn't wait for it.
+	this->m_encodedPrivateKey = inputPrivateKey;
 
 	// Updating only after succesfully initializing through the file.
 	this->m_isInit = true;
@@ -354,15 +765,14 @@ bool Client::UpdateMeInfo(uuid_t newUuid) {
 		return false;
 	}
 
-	// Remove newlines from string.
+	// Encoded as a single line.
 	std::string encodedPrivateKey = Base64Wrapper::encode(this->m_privateKey->getPrivateKey());
-	encodedPrivateKey.erase(std::remove(encodedPrivateKey.begin(), encodedPrivateKey.end(), '\n'), encodedPrivateKey.end());
 
 	// Updated all relevant fields, so the instance is initialized.
 	this->m_isInit = true;
 
 	// Writing all parsed data to the file.
-	std::ofstream infoFile(ME_INFO_PATH);
+	std::ofstream infoFile(this->m_infoPath);
 
 	infoFile << nameBuffer << std::endl;
 	infoFile << uuidString << std::endl;
@@ -373,266 +783,1322 @@ bool Client::UpdateMeInfo(uuid_t newUuid) {
 	return true;
 }
 
-std::string Client::GetNameFromUuid(const uuid_t &uuid) {
-	for (const auto& currTuple : this->m_data) {
-		Friend* currFirend = currTuple.second;
+void Client::PrepareText(const std::string& message, std::string& o_plain) {
+
+	o_plain.clear();
 
-		if (currFirend->IsUuidEqual(uuid) == true) {
-			return currFirend->GetName();
+	if (message.size() >= COMPRESSION_THRESHOLD) {
+		std::string compressed = CompressionWrapper::compress(message);
+
+		// Incompressible text is sent as it is.
+		if (compressed.size() < message.size()) {
+			o_plain.reserve(1 + compressed.size());
+			o_plain.push_back((char)MessageType::SendCompressedText);
+			o_plain.append(compressed);
+			return;
 		}
 	}
 
-	return "";
+	o_plain.reserve(1 + message.size());
+	o_plain.push_back((char)MessageType::SendText);
+	o_plain.append(message);
 }
 
-//--------------------------------------------- HANDLERS ---------------------------------------------
-Client::ReturnStatus Client::HandleRegister() {
-	
-	// Making sure a registered user is not registering again.
-	if (this->m_isInit == true) {
-		std::cout << "Error: Client is already registered." << std::endl;
-		return Client::ReturnStatus::GeneralError;
+RSAPrivateWrapper* Client::GetPrivateKey() {
+
+	if (this->m_privateKey != nullptr) {
+		return this->m_privateKey;
 	}
 
-	std::string name;
+	try {
+		this->m_privateKey = new RSAPrivateWrapper(Base64Wrapper::decode(this->m_encodedPrivateKey));
+	}
+	catch (const std::exception&) {
+		std::cout << "Invalid key" << std::endl;
+		return nullptr;
+	}
 
-	std::cout << "Insert your name: ";
-	std::cin >> name;
+	return this->m_privateKey;
+}
 
-	if (this->m_name.Deserialize(name) == false) {
-		std::cout << "Invalid name. Name should contain only alphabetic charecters." << std::endl;
-		return ReturnStatus::GeneralError;
-	}
+X25519Wrapper* Client::GetAgreementKey() {
 
-	RequestRegister request;
-	ResponseRegister response;
+	if (this->m_agreementKey != nullptr) {
+		return this->m_agreementKey;
+	}
 
-	if (this->m_name.Serialize(request.body.name, sizeof(request.body.name)) == false) {
-		std::cout << "Failed serializing name to message" << std::endl;
-		this->m_name.Reset();
-		return ReturnStatus::GeneralError;
+	RSAPrivateWrapper* privateKey = GetPrivateKey();
+	if (privateKey == nullptr) {
+		return nullptr;
 	}
 
-	// Generating the key pair for RSA
-	this->m_privateKey = new RSAPrivateWrapper();
-	this->m_privateKey->getPublicKey((char*)request.body.publicKey, sizeof(request.body.publicKey));
+	std::string seed = privateKey->getPrivateKey();
+	this->m_agreementKey = new X25519Wrapper(seed.data(), (unsigned int)seed.size());
 
-	// Sending request and waiting for response.
-	ReturnStatus ret = Exchange(request, response);
+	return this->m_agreementKey;
+}
 
-	if (ret == ReturnStatus::Success) {
-		// Update me.info with all new values.
-		if (UpdateMeInfo(response.body.uuid) == false) {
-			// Making sure no traces left after failure.
-			delete this->m_privateKey;
-			this->m_privateKey = nullptr;
+Client::ReturnStatus Client::PublishAgreementKey() {
 
-			this->m_name.Reset();
+	if (this->m_isAgreementKeyPublished == true) {
+		return Client::ReturnStatus::Success;
+	}
 
-			std::cout << "Failed updating UUID from server" << std::endl;
-			return ReturnStatus::GeneralError;
+	// The server's version is known only once it has answered a request, so until then it is asked
+	// for the user's own public key, which servers of every version serve.
+	if (this->m_connection.GetServerVersion() == 0) {
+		RequestPK request(this->m_uuid);
+		ResponsePK response;
+
+		this->m_uuid.Serialize(request.body.uuid, sizeof(request.body.uuid));
+
+		Client::ReturnStatus ret = Exchange(request, response);
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
 		}
+	}
 
-		this->m_isInit = true;
+	// Older servers would refuse the request, so their clients keep sending keys over RSA.
+	if (this->m_connection.GetServerVersion() < KEY_AGREEMENT_VERSION) {
+		return Client::ReturnStatus::Success;
 	}
-	else {
-		// Making sure no traces left after failure.
-		delete this->m_privateKey;
-		this->m_privateKey = nullptr;
 
-		this->m_name.Reset();
+	X25519Wrapper* agreementKey = GetAgreementKey();
+	if (agreementKey == nullptr) {
+		return Client::ReturnStatus::GeneralError;
 	}
 
-	return ret;
-}
+	RequestSetAgreementKey request(this->m_uuid);
+	ResponseSetAgreementKey response;
 
-Client::ReturnStatus Client::HandleList() {
-	RequestList request(this->m_uuid);
-	std::vector<uint8_t> responseVec;
+	agreementKey->getPublicKey((char*)request.body.agreementKey, sizeof(request.body.agreementKey));
 
-	// Sending request and waiting for response.
-	Client::ReturnStatus ret = Exchange(request, responseVec);
+	Client::ReturnStatus ret = Exchange(request, response);
 	if (ret != Client::ReturnStatus::Success) {
 		return ret;
 	}
 
-	// The exchange function has aleady validated the data is deserializeable and the lengths match.
-	auto payloadSize = responseVec.size() - sizeof(BaseResponseHeader);
-
-	if (payloadSize % ResponseUsersListNode::GetSize() != 0) {
+	if (memcmp(response.body.agreementKey, request.body.agreementKey, sizeof(agreementKey_t)) != 0) {
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	auto numerOfNodes = payloadSize / ResponseUsersListNode::GetSize();
+	this->m_isAgreementKeyPublished = true;
+	return Client::ReturnStatus::Success;
+}
 
-	for (auto i = 0; i < numerOfNodes; i++) {
+void Client::FetchAgreementKey(Friend& currFriend) {
+
+	if (currFriend.HasAgreement() == true ||
+		this->m_connection.GetServerVersion() < KEY_AGREEMENT_VERSION) {
+		return;
+	}
+
+	RequestGetAgreementKey request(this->m_uuid);
+	ResponseGetAgreementKey response;
+
+	if (currFriend.GetUuid(request.body.uuid) != true) {
+		return;
+	}
+
+	// A failure only means texts to this friend keep using the symmetric key.
+	if (Exchange(request, response) != Client::ReturnStatus::Success ||
+		currFriend.IsUuidEqual(response.body.uuid) == false) {
+		return;
+	}
+
+	currFriend.SetAgreementKey(response.body.agreementKey);
+}
+
+bool Client::SealText(Friend& currFriend, const std::string& message, std::string& io_plain, MessageType& o_type,
+	std::vector<uint8_t>& o_content) {
+
+	X25519Wrapper* agreementKey = currFriend.HasAgreement() == true ? GetAgreementKey() : nullptr;
+	size_t offset = o_content.size();
+
+	try {
+		if (agreementKey != nullptr) {
+			AESWrapper* agreedKey = currFriend.GetAgreedKey(*agreementKey);
+
+			if (io_plain.empty() == true) {
+				PrepareText(message, io_plain);
+			}
+
+			unsigned int sealedLength = AESWrapper::sealedLength((unsigned int)io_plain.size());
+
+			// The friend may not know the client's agreement key yet, so it leads the sealed text.
+			o_type = MessageType::SendAgreedText;
+			o_content.resize(offset + AGREEMENT_KEY_LENGTH + sealedLength);
+
+			agreementKey->getPublicKey((char*)&o_content[offset], AGREEMENT_KEY_LENGTH);
+			agreedKey->seal(io_plain.c_str(), (unsigned int)io_plain.size(), (char*)&o_content[offset + AGREEMENT_KEY_LENGTH], sealedLength);
+			return true;
+		}
+
+		// An older client would drop a sealed or compressed text as unrecognized.
+		if (currFriend.HasSym() == true) {
+			unsigned int encryptedLength = AESWrapper::encryptedLength((unsigned int)message.size());
+
+			o_type = MessageType::SendText;
+			o_content.resize(offset + encryptedLength);
+
+			currFriend.GetSymKey()->encrypt(message.c_str(), (unsigned int)message.size(), (char*)&o_content[offset], encryptedLength);
+			return true;
+		}
+	}
+	catch (...) {
+		// e.g. the friend's agreement key is invalid.
+	}
+
+	o_content.resize(offset);
+	return false;
+}
+
+void Client::SaveChanges() {
+
+	bool isSaved = true;
+
+	for (auto& currFriend : this->m_roster) {
+		if (currFriend.IsChanged() == false) {
+			continue;
+		}
+
+		if (this->m_store.SaveFriend(currFriend) == true) {
+			currFriend.ClearChanged();
+		}
+		else {
+			isSaved = false;
+		}
+	}
+
+	// Saved last, so the version never runs ahead of the saved roster.
+	if (isSaved == true) {
+		this->m_store.SaveDirectoryVersion(this->m_directoryEpoch, this->m_directoryVersion);
+	}
+
+	this->m_store.Flush();
+}
+
+//--------------------------------------------- HANDLERS ---------------------------------------------
+Client::ReturnStatus Client::HandleRegister() {
+
+	std::string name;
+
+	std::cout << "Insert your name: ";
+	std::cin >> name;
+
+	Client::ReturnStatus ret = Register(name);
+
+	if (ret == Client::ReturnStatus::Success) {
+		std::cout << "Key pairs taken ready: " << this->m_keyPoolHits << ", generated on demand: " << this->m_keyPoolMisses << std::endl;
+	}
+
+	return ret;
+}
+
+Client::ReturnStatus Client::Register(const std::string& name) {
+	
+	// Making sure a registered user is not registering again.
+	if (this->m_isInit == true) {
+		std::cout << "Error: Client is already registered." << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	if (this->m_name.Deserialize(name) == false) {
+		std::cout << "Invalid name. Name should contain only alphabetic charecters." << std::endl;
+		return ReturnStatus::GeneralError;
+	}
+
+	RequestRegister request;
+	ResponseRegister response;
+
+	if (this->m_name.Serialize(request.body.name, sizeof(request.body.name)) == false) {
+		std::cout << "Failed serializing name to message" << std::endl;
+		this->m_name.Reset();
+		return ReturnStatus::GeneralError;
+	}
+
+	// Taking the key pair for RSA ready from the pool, or generating it if none is ready.
+	try {
+		this->m_privateKey = this->m_keyPool != nullptr ? this->m_keyPool->Take().release() : new RSAPrivateWrapper();
+	}
+	catch (...) {
+		std::cout << "Failed generating key pair" << std::endl;
+		this->m_name.Reset();
+		return ReturnStatus::GeneralError;
+	}
+
+	this->m_privateKey->getPublicKey((char*)request.body.publicKey, sizeof(request.body.publicKey));
+
+	// Sending request and waiting for response.
+	ReturnStatus ret = Exchange(request, response);
+
+	if (ret == ReturnStatus::Success) {
+		// Update me.info with all new values.
+		if (UpdateMeInfo(response.body.uuid) == false) {
+			// Making sure no traces left after failure.
+			delete this->m_privateKey;
+			this->m_privateKey = nullptr;
+
+			this->m_name.Reset();
+
+			std::cout << "Failed updating UUID from server" << std::endl;
+			return ReturnStatus::GeneralError;
+		}
+
+		uuid_t ownerUuid;
+		this->m_uuid.Serialize(ownerUuid, sizeof(ownerUuid));
+
+		// No more key pairs are needed, so only the pool's counters are kept, to be reported.
+		if (this->m_keyPool != nullptr) {
+			this->m_keyPoolHits = this->m_keyPool->GetHits();
+			this->m_keyPoolMisses = this->m_keyPool->GetMisses();
+			this->m_keyPool.reset();
+		}
+
+		// A new user has no friends yet, so any earlier store is started over.
+		if (this->m_store.Open(ownerUuid, this->m_roster, this->m_directoryEpoch, this->m_directoryVersion) == false) {
+			std::cout << "Failed opening " << this->m_statePath << std::endl;
+		}
+
+		this->m_isInit = true;
+
+		// The server's version is known from the registration's response.
+		if (PublishAgreementKey() != Client::ReturnStatus::Success) {
+			std::cout << "Failed registering agreement key" << std::endl;
+		}
+	}
+	else {
+		// Making sure no traces left after failure.
+		delete this->m_privateKey;
+		this->m_privateKey = nullptr;
+
+		this->m_name.Reset();
+	}
+
+	return ret;
+}
+
+Client::ReturnStatus Client::HandleList() {
+
+	Client::ReturnStatus ret = SyncDirectory();
+
+	if (ret != Client::ReturnStatus::Success) {
+		return ret;
+	}
+
+	for (const auto& currFriend : this->m_roster) {
+		std::cout << currFriend.GetName() << std::endl;
+	}
+	
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::SyncDirectory() {
+	// Asking only for the users registered since the last sync.
+	uint32_t sinceVersion = this->m_directoryVersion;
+
+	BufferPool::Buffer responseBuffer = this->m_bufferPool.Acquire();
+	ResponseDirectorySyncHeader syncHeader;
+	ByteView payload;
+
+	while (true) {
+		RequestDirectorySync request(this->m_uuid);
+		request.body.sinceVersion = sinceVersion;
+
+		// Sending request and waiting for response.
+		Client::ReturnStatus ret = Exchange(request, responseBuffer.Get());
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+
+		// The exchange function has aleady validated the data is deserializeable and the lengths match.
+		payload = responseBuffer.GetView(sizeof(BaseResponseHeader));
+
+		if (payload.GetSize() < ResponseDirectorySyncHeader::GetSize()) {
+			return Client::ReturnStatus::GeneralError;
+		}
+
+		memcpy(&syncHeader, payload.GetData(), ResponseDirectorySyncHeader::GetSize());
+
+		// A version given by an earlier run of the server means nothing to this one, so the whole directory is asked for.
+		if (sinceVersion == 0 || syncHeader.epoch == this->m_directoryEpoch) {
+			break;
+		}
+
+		sinceVersion = 0;
+	}
+
+	payload = payload.SubView(ResponseDirectorySyncHeader::GetSize());
+	auto payloadSize = payload.GetSize();
+
+	if (payloadSize % ResponseUsersListNode::GetSize() != 0) {
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	size_t numerOfNodes = payloadSize / ResponseUsersListNode::GetSize();
+
+	this->m_roster.Reserve(numerOfNodes);
+
+	for (size_t i = 0; i < numerOfNodes; i++) {
 		ResponseUsersListNode currNode;
 
-		// Iterating over the buffer by the pre-defined format.
-		memcpy(&currNode, 
-			responseVec.data() + sizeof(BaseResponseHeader) + (i * ResponseUsersListNode::GetSize()), 
-			ResponseUsersListNode::GetSize());
+		// Iterating over the buffer by the pre-defined format.
+		memcpy(&currNode, 
+			payload.GetData() + (i * ResponseUsersListNode::GetSize()), 
+			ResponseUsersListNode::GetSize());
+
+		std::string currName((char*)currNode.name);
+
+		// Adding the new friend to the roster. Known ones are skipped, since names are also unique,
+		// and so are invalid ones, to keep getting the other clients.
+		this->m_roster.Add(currName, currNode.uuid);
+	}
+
+	// Only once the whole delta is merged, so a failed sync is simply repeated next time.
+	this->m_directoryEpoch = syncHeader.epoch;
+	this->m_directoryVersion = syncHeader.version;
+
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::HandlePublicKey() {
+
+	std::string name;
+
+	std::cout << "Insert destenation name: ";
+	std::cin >> name;
+
+	return RequestPublicKey(name);
+}
+
+Client::ReturnStatus Client::RequestPublicKey(const std::string& name) {
+	RequestPK request(this->m_uuid);
+	ResponsePK response;
+
+	// Making sure the client exists, so a matching UUID can be extracted.
+	Friend* currFriend = this->m_roster.FindByName(name);
+
+	if (currFriend == nullptr) {
+		std::cout << "Name not found" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	if (currFriend->GetUuid(request.body.uuid) != true) {
+		std::cout << "Failed getting UUID for user" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	ReturnStatus ret = Exchange(request, response);
+
+	// Updating the local client's public key for future use.
+	if (ret == ReturnStatus::Success) {
+		currFriend->SetPublicKey(response.body.publicKey);
+		FetchAgreementKey(*currFriend);
+	}
+
+	return ret;
+}
+
+Client::ReturnStatus Client::HandleWaitingMessages(bool isParallel) {
+
+	RequestGetMessagesPage request(this->m_uuid);
+	request.body.maxBytes = MESSAGES_PAGE_MAX_BYTES;
+	request.body.maxCount = MESSAGES_PAGE_MAX_COUNT;
+
+	RequestSegments requestSegments;
+	request.GetSegments(requestSegments);
+
+	// The server removes only the messages it has sent, so pages are fetched until none are left.
+	bool isMorePending = true;
+
+	// No other request may be sent while a page is read, so agreed texts whose sender's key must be fetched
+	// first are handled once the page has been read.
+	std::vector<DeferredMessage> deferredMessages;
+
+	while (isMorePending == true) {
+
+		this->m_deferredMessages = &deferredMessages;
+
+		// Each message is handled as soon as it is read, rather than once the whole page has arrived,
+		// or a window of messages at a time if they are decrypted in parallel.
+		Client::ReturnStatus ret = ExchangeStreamed(requestSegments, [this, &isMorePending, isParallel](PayloadReader& reader) {
+			ResponseGetMessagesPageHeader pageHeader;
+
+			if (reader.GetRemaining() < ResponseGetMessagesPageHeader::GetSize()) {
+				std::cout << "Read invalid page header from server" << std::endl;
+				return Client::ReturnStatus::GeneralError;
+			}
+
+			reader.Read(&pageHeader, ResponseGetMessagesPageHeader::GetSize());
+			isMorePending = pageHeader.morePending != 0;
+
+			if (isParallel == true) {
+				return StreamMessagesInParallel(reader);
+			}
+
+			return StreamMessages(reader);
+		});
+
+		this->m_deferredMessages = nullptr;
+
+		// The deferred messages have been removed from the server, so they are handled even if the page has failed.
+		for (const DeferredMessage& deferred : deferredMessages) {
+			Client::ReturnStatus deferredRet = ProcessMessage(deferred.header, ByteView(deferred.content));
+
+			if (ret == Client::ReturnStatus::Success) {
+				ret = deferredRet;
+			}
+		}
+
+		deferredMessages.clear();
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+	}
+
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::HandleListenForMessages() {
+
+	uint32_t seconds = 0;
+
+	std::cout << "Insert how many seconds to listen: ";
+	std::cin >> seconds;
+
+	if (std::cin.fail()) {
+		std::cin.clear();
+		std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		std::cout << "Bad entry" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	auto listenEnd = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+
+	RequestWaitMessages request(this->m_uuid);
+	request.body.timeoutMs = WAIT_MESSAGES_TIMEOUT_MS;
+
+	BufferPool::Buffer deliveryBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& deliveryVec = deliveryBuffer.Get();
+
+	while (true) {
+		// The next wait is sent only once the current delivery has been handled, since the server removes
+		// the messages it delivers. Messages arriving meanwhile wait on the server, and are delivered right away.
+		Client::ReturnStatus ret = ExchangeAsync(request, deliveryVec, WAIT_MESSAGES_DEADLINE_MS).get();
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+
+		// An expired wait is delivered with no messages at all.
+		ret = ProcessMessages(ByteView(deliveryVec).SubView(sizeof(BaseResponseHeader)));
+
+		// Listening may go on for long, so received keys are kept as they arrive.
+		SaveChanges();
+
+		if (ret != Client::ReturnStatus::Success || std::chrono::steady_clock::now() >= listenEnd) {
+			return ret;
+		}
+	}
+}
+
+Client::ReturnStatus Client::ProcessMessages(ByteView payload) {
+
+	// The exchange function has aleady validated the data is deserializeable and the lengths match.
+	MessageView messages(payload);
+
+	while (messages.Next() == true) {
+		Client::ReturnStatus ret = ProcessMessage(messages.GetHeader(), messages.GetContent());
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+	}
+
+	if (messages.GetError() != nullptr) {
+		std::cout << messages.GetError() << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	return Client::ReturnStatus::Success;
+}
+
+/**
+	Reads a message's header from a streamed page, and makes sure the page holds the whole message.
+
+	@param	reader		-	The reader of the page, at the start of a message.
+	@param	o_header	-	Out parameter for the header.
+
+	@return	bool	-	True if the message may be read, false otherwise.
+*/
+static bool ReadMessageHeader(PayloadReader& reader, MessageHeader& o_header) {
+	uint8_t headerBuffer[MessageHeader::GetSize()];
+
+	if (reader.GetRemaining() < MessageHeader::GetSize()) {
+		std::cout << "Reached an invalid tail length" << std::endl;
+		return false;
+	}
+
+	reader.Read(headerBuffer, sizeof(headerBuffer));
+
+	if (o_header.Deserialize(ByteView(headerBuffer, sizeof(headerBuffer))) != true) {
+		std::cout << "Read invalid header from server" << std::endl;
+		return false;
+	}
+
+	if (reader.GetRemaining() < o_header.contentSize) {
+		std::cout << "Reached an invalid tail length" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+Client::ReturnStatus Client::StreamMessages(PayloadReader& reader) {
+
+	// Only a single message is held at a time, so the memory is bounded by the largest message.
+	BufferPool::Buffer contentBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& content = contentBuffer.Get();
+
+	while (reader.GetRemaining() > 0) {
+		MessageHeader currHeader;
+
+		if (ReadMessageHeader(reader, currHeader) == false) {
+			return Client::ReturnStatus::GeneralError;
+		}
+
+		content.resize(currHeader.contentSize);
+		reader.Read(content.data(), content.size());
+
+		if (DeferMessage(currHeader, ByteView(content)) == true) {
+			continue;
+		}
+
+		Client::ReturnStatus ret = ProcessMessage(currHeader, ByteView(content));
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+	}
+
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::StreamMessagesInParallel(PayloadReader& reader) {
+
+	if (this->m_workerPool == nullptr) {
+		this->m_workerPool.reset(new WorkerPool(std::max<size_t>(std::thread::hardware_concurrency(), 1)));
+	}
+
+	// Only a window of messages is held at a time, so the memory is bounded as when streaming one by one.
+	BufferPool::Buffer windowBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& window = windowBuffer.Get();
+
+	std::vector<MessageHeader> headers;
+	std::vector<size_t> offsets;
+
+	while (reader.GetRemaining() > 0) {
+		Client::ReturnStatus readStatus = Client::ReturnStatus::Success;
+
+		window.clear();
+		headers.clear();
+		offsets.clear();
+
+		// A message larger than the window's bytes still makes a window of its own.
+		while (reader.GetRemaining() > 0 && headers.size() < PARALLEL_WINDOW_MAX_COUNT &&
+			(headers.empty() == true || window.size() < PARALLEL_WINDOW_MAX_BYTES)) {
+			MessageHeader currHeader;
+
+			// The messages read before an invalid one are still handled.
+			if (ReadMessageHeader(reader, currHeader) == false) {
+				readStatus = Client::ReturnStatus::GeneralError;
+				break;
+			}
+
+			offsets.push_back(window.size());
+			headers.push_back(currHeader);
+
+			window.resize(window.size() + currHeader.contentSize);
+			reader.Read(window.data() + offsets.back(), currHeader.contentSize);
+		}
+
+		std::vector<ByteView> contents;
+		for (size_t i = 0; i < headers.size(); i++) {
+			contents.emplace_back(window.data() + offsets[i], headers[i].contentSize);
+		}
+
+		Client::ReturnStatus ret = ProcessWindow(headers, contents);
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+
+		if (readStatus != Client::ReturnStatus::Success) {
+			return readStatus;
+		}
+	}
+
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::ProcessWindow(const std::vector<MessageHeader>& headers, const std::vector<ByteView>& contents) {
+
+	size_t messageCount = headers.size();
+	size_t workerCount = this->m_workerPool->GetWorkerCount();
+
+	std::vector<DecryptedMessage> decrypted(messageCount);
+	std::vector<Friend*> senders(messageCount);
+
+	// Not a vector<bool>, since the workers set their messages' flags at once.
+	std::vector<uint8_t> isReady(messageCount, 0);
+	std::vector<uint8_t> isDeferred(messageCount, 0);
+
+	// The roster isn't changed while decrypting, so the senders are looked up beforehand.
+	std::vector<size_t> keyMessages;
+
+	for (size_t i = 0; i < messageCount; i++) {
+		if (DeferMessage(headers[i], contents[i]) == true) {
+			isDeferred[i] = 1;
+			continue;
+		}
+
+		senders[i] = this->m_roster.FindByUuid(headers[i].uuid);
+
+		// Unknown senders are reported once shown.
+		if (senders[i] == nullptr) {
+			continue;
+		}
+
+		decrypted[i].senderName = senders[i]->GetName();
+
+		if ((MessageType)headers[i].messageType == MessageType::SendSymKey) {
+			keyMessages.push_back(i);
+		}
+	}
+
+	// The received keys are decrypted first, all at once, as RSA takes most of the time.
+	std::vector<std::string> receivedKeys(messageCount);
+
+	if (keyMessages.empty() == false) {
+		RSAPrivateWrapper* sharedKey = GetPrivateKey();
+		if (sharedKey == nullptr) {
+			return Client::ReturnStatus::GeneralError;
+		}
+
+		// RSA decryption draws from the wrapper's random pool, so each worker parses its own copy of the key.
+		std::string privateKey = sharedKey->getPrivateKey();
+		std::vector<std::unique_ptr<RSAPrivateWrapper>> workerKeys(workerCount);
+
+		this->m_workerPool->Run(keyMessages.size(), [&](size_t taskIndex, size_t workerIndex) {
+			size_t messageIndex = keyMessages[taskIndex];
+
+			try {
+				if (workerKeys[workerIndex] == nullptr) {
+					workerKeys[workerIndex].reset(new RSAPrivateWrapper(privateKey));
+				}
+			}
+			catch (...) {
+				decrypted[messageIndex].content = "Failed getting symetric key";
+				return;
+			}
+
+			isReady[messageIndex] = DecryptSymKey(contents[messageIndex], *workerKeys[workerIndex],
+				receivedKeys[messageIndex], decrypted[messageIndex]) == true ? 1 : 0;
+		});
+	}
+
+	// The keys are then set in order, and each text is given the key in effect when it was sent.
+	std::vector<std::array<unsigned char, AESWrapper::DEFAULT_KEYLENGTH>> messageKeys(messageCount);
+	std::vector<uint8_t> hasKey(messageCount, 0);
+
+	for (size_t i = 0; i < messageCount; i++) {
+		Friend* sender = senders[i];
+
+		if (sender == nullptr) {
+			continue;
+		}
+
+		if ((MessageType)headers[i].messageType == MessageType::SendSymKey) {
+			if (isReady[i] == 1) {
+				sender->SetSymKey((const unsigned char*)receivedKeys[i].data(), receivedKeys[i].size());
+			}
+			continue;
+		}
+
+		AESWrapper* key = nullptr;
+		isReady[i] = GetMessageKey(*sender, headers[i], contents[i], key, decrypted[i]) == true ? 1 : 0;
+
+		if (key != nullptr) {
+			memcpy(messageKeys[i].data(), key->getKey(), AESWrapper::DEFAULT_KEYLENGTH);
+			hasKey[i] = 1;
+		}
+	}
+
+	// An AES wrapper can't be shared between threads, so each worker keeps its own, even for the texts of a single sender.
+	std::vector<std::unique_ptr<AESWrapper>> workerWrappers(workerCount);
+
+	this->m_workerPool->Run(messageCount, [&](size_t messageIndex, size_t workerIndex) {
+		if (isReady[messageIndex] == 0) {
+			return;
+		}
+
+		AESWrapper* key = nullptr;
+
+		if (hasKey[messageIndex] == 1) {
+			std::unique_ptr<AESWrapper>& wrapper = workerWrappers[workerIndex];
+			const unsigned char* keyBytes = messageKeys[messageIndex].data();
+
+			// The key is expanded again only once the worker moves on to a text of another key.
+			if (wrapper == nullptr || memcmp(wrapper->getKey(), keyBytes, AESWrapper::DEFAULT_KEYLENGTH) != 0) {
+				wrapper.reset(new AESWrapper(keyBytes, AESWrapper::DEFAULT_KEYLENGTH));
+			}
+
+			key = wrapper.get();
+		}
+
+		DecryptMessage(headers[messageIndex], contents[messageIndex], key, decrypted[messageIndex]);
+	});
+
+	for (size_t i = 0; i < messageCount; i++) {
+		if (isDeferred[i] == 1) {
+			continue;
+		}
+
+		Client::ReturnStatus ret = ShowMessage(decrypted[i]);
+
+		if (ret != Client::ReturnStatus::Success) {
+			return ret;
+		}
+	}
+
+	return Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::ProcessMessage(const MessageHeader& header, ByteView content) {
+
+	DecryptedMessage message;
+
+	Friend* sender = this->m_roster.FindByUuid(header.uuid);
+
+	if (sender != nullptr) {
+		message.senderName = sender->GetName();
+
+		AESWrapper* key = nullptr;
+		bool isReady = true;
+
+		if ((MessageType)header.messageType == MessageType::SendSymKey) {
+			RSAPrivateWrapper* privateKey = GetPrivateKey();
+			if (privateKey == nullptr) {
+				return Client::ReturnStatus::GeneralError;
+			}
+
+			std::string symKey;
+			isReady = DecryptSymKey(content, *privateKey, symKey, message);
+
+			if (isReady == true) {
+				sender->SetSymKey((const unsigned char*)symKey.data(), symKey.size());
+			}
+		}
+		else {
+			isReady = GetMessageKey(*sender, header, content, key, message);
+		}
+
+		if (isReady == true) {
+			DecryptMessage(header, content, key, message);
+		}
+	}
+
+	return ShowMessage(message);
+}
+
+bool Client::DecryptSymKey(ByteView content, RSAPrivateWrapper& privateKey, std::string& o_symKey, DecryptedMessage& o_message) {
+
+	if (content.GetSize() < ENCRYPTED_SYM_KEY_LENGTH) {
+		o_message.content = "Invalid sym key content";
+		return false;
+	}
+
+	try {
+		// Decrypting only as long as needed.
+		o_symKey = privateKey.decrypt((const char*)content.GetData(), ENCRYPTED_SYM_KEY_LENGTH);
+	}
+	catch (...) {
+		o_message.content = "Failed getting symetric key";
+		return false;
+	}
+
+	return true;
+}
+
+bool Client::DeferMessage(const MessageHeader& header, ByteView content) {
+
+	if (this->m_deferredMessages == nullptr || (MessageType)header.messageType != MessageType::SendAgreedText) {
+		return false;
+	}
+
+	Friend* sender = this->m_roster.FindByUuid(header.uuid);
+
+	if (sender == nullptr || sender->HasAgreement() == true) {
+		return false;
+	}
+
+	DeferredMessage deferred;
+	deferred.header = header;
+	deferred.content.assign(content.GetData(), content.GetData() + content.GetSize());
+
+	this->m_deferredMessages->push_back(std::move(deferred));
+	return true;
+}
+
+bool Client::GetMessageKey(Friend& sender, const MessageHeader& header, ByteView content, AESWrapper*& o_key, DecryptedMessage& o_message) {
+
+	o_key = nullptr;
+
+	try {
+		switch ((MessageType)header.messageType)
+		{
+		case MessageType::SendText:
+		case MessageType::SendCompressedText:
+		case MessageType::SendSealedText:
+		case MessageType::SendFileChunk:
+			o_key = sender.GetSymKey();
+			break;
+
+		case MessageType::SendAgreedText: {
+			X25519Wrapper* agreementKey = GetAgreementKey();
+
+			if (agreementKey == nullptr) {
+				o_message.content = "No agreement key";
+				return false;
+			}
+
+			// Anyone may send a message in the sender's name, so the key it carries is only trusted
+			// if it is the one the server has registered for the sender. The header has already made sure it is there.
+			FetchAgreementKey(sender);
+
+			const uint8_t* senderKey = sender.GetRawAgreementKey();
+
+			if (senderKey == nullptr) {
+				o_message.content = "Sender has no registered agreement key";
+				return false;
+			}
+
+			if (memcmp(senderKey, content.GetData(), sizeof(agreementKey_t)) != 0) {
+				o_message.content = "Agreement key isn't the sender's";
+				return false;
+			}
+
+			o_key = sender.GetAgreedKey(*agreementKey);
+			break;
+		}
+
+		// The other messages carry no text.
+		default:
+			break;
+		}
+	}
+	catch (...) {
+		o_message.content = "Failed decrypting message";
+		return false;
+	}
+
+	return true;
+}
+
+void Client::DecryptMessage(const MessageHeader& header, ByteView content, AESWrapper* key, DecryptedMessage& o_message) {
+
+	o_message.type = (MessageType)header.messageType;
+	o_message.status = Client::ReturnStatus::GeneralError;
+
+	try {
+		switch (o_message.type)
+		{
+		case MessageType::GetSymKey: {
+			o_message.content = "Request for symmetric key";
+			break;
+		}
+
+		// The key itself has already been decrypted and set.
+		case MessageType::SendSymKey: {
+			o_message.content = "symmetric key received";
+			break;
+		}
+
+		// The plaintext is never longer than the ciphertext, so it is decrypted straight into the message's content.
+		case MessageType::SendText: {
+			o_message.content.resize(content.GetSize());
+			o_message.content.resize(key->decrypt((const char*)content.GetData(), (unsigned int)content.GetSize(),
+				&o_message.content[0], (unsigned int)o_message.content.size()));
+			break;
+		}
+
+		case MessageType::SendCompressedText: {
+			std::string compressed(content.GetSize(), '\0');
+			compressed.resize(key->decrypt((const char*)content.GetData(), (unsigned int)content.GetSize(),
+				&compressed[0], (unsigned int)compressed.size()));
+
+			try {
+				o_message.content = CompressionWrapper::decompress(compressed, MAX_DECOMPRESSED_LENGTH);
+			}
+			catch (...) {
+				o_message.content = "Failed decompressing text";
+				return;
+			}
+			break;
+		}
+
+		case MessageType::SendSealedText:
+		case MessageType::SendAgreedText: {
+			// An agreed text is led by the sender's agreement key, already checked.
+			ByteView sealed = o_message.type == MessageType::SendAgreedText ? content.SubView(AGREEMENT_KEY_LENGTH) : content;
+
+			std::string& plain = o_message.content;
+
+			try {
+				plain.resize(sealed.GetSize());
+				plain.resize(key->open((const char*)sealed.GetData(), (unsigned int)sealed.GetSize(), &plain[0], (unsigned int)plain.size()));
+			}
+			catch (...) {
+				o_message.content = "Failed authenticating text";
+				return;
+			}
+
+			if (plain.empty() == true) {
+				o_message.content = "Invalid sealed text";
+				return;
+			}
+
+			MessageType innerType = (MessageType)plain[0];
+
+			switch (innerType)
+			{
+			case MessageType::SendText:
+				plain.erase(0, 1);
+				break;
+
+			case MessageType::SendCompressedText:
+				try {
+					o_message.content = CompressionWrapper::decompress(plain.substr(1), MAX_DECOMPRESSED_LENGTH);
+				}
+				catch (...) {
+					o_message.content = "Failed decompressing text";
+					return;
+				}
+				break;
+
+			default:
+				o_message.content = "Unrecognized sealed text type";
+				break;
+			}
+			break;
+		}
+
+		case MessageType::SendFileChunk: {
+			memcpy(&o_message.chunkHeader, content.GetData(), FileChunkHeader::GetSize());
+
+			ByteView cipher = content.SubView(FileChunkHeader::GetSize());
+			o_message.content.resize(cipher.GetSize());
+			o_message.content.resize(key->decrypt((const char*)cipher.GetData(), (unsigned int)cipher.GetSize(),
+				&o_message.content[0], (unsigned int)o_message.content.size()));
+			break;
+		}
+
+		default:
+			o_message.content = "Unrecognized message type";
+			break;
+		}
+	}
+	catch (...) {
+		// Any other failure of the ciphers, e.g. a bad padding.
+		o_message.content = "Failed decrypting message";
+		return;
+	}
+
+	o_message.status = Client::ReturnStatus::Success;
+}
+
+Client::ReturnStatus Client::ShowMessage(const DecryptedMessage& message) {
+
+	if (message.senderName == "") {
+		std::cout << "Failed getting client's name" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
 
-		std::string currName((char*)currNode.name);
-		std::cout << currName << std::endl;
+	std::string receivedPath;
 
-		// No need handling this friend, since names are also unique.
-		if (this->m_data.find(currName) != this->m_data.end()) {
-			continue;
-		}
+	if (message.status == Client::ReturnStatus::Success &&
+		message.type == MessageType::SendFileChunk &&
+		this->m_incomingTransfers.HandleChunk(message.chunkHeader, message.content, receivedPath) != true) {
+		std::cout << "Failed writing file chunk" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
 
-		// Adding the new friend to the list.
-		Friend* currFriend = new Friend();
+	// In batch mode the message is reported along with the command's result.
+	if (this->m_batchMessages != nullptr) {
+		this->m_batchMessages->push_back(MessageToJson(message, receivedPath));
+		return message.status;
+	}
 
-		// Keep getting the other clients.
-		if (currFriend->Init(currName, currNode.uuid) != true) {
-			delete currFriend;
-			continue;
-		}
+	std::cout << "From : " << message.senderName << std::endl;
+	std::cout << "Content : " << std::endl;
 
-		// Adding the new client to the map.
-		this->m_data[currName] = currFriend;
+	if (message.status != Client::ReturnStatus::Success) {
+		std::cout << message.content << std::endl;
+		return message.status;
 	}
-	
+
+	if (message.type == MessageType::SendFileChunk) {
+		std::cout << "File chunk " << message.chunkHeader.sequence + 1 << " of " << message.chunkHeader.chunkCount;
+
+		if (receivedPath.empty() == false) {
+			std::cout << ", file received: " << receivedPath;
+		}
+	}
+	else {
+		std::cout << message.content;
+	}
+
+	std::cout << std::endl;
+
 	return Client::ReturnStatus::Success;
 }
 
-Client::ReturnStatus Client::HandlePublicKey() {
-	RequestPK request(this->m_uuid);
-	ResponsePK response;
-	
+JsonObject Client::MessageToJson(const DecryptedMessage& message, const std::string& receivedPath) {
+	JsonObject record;
+
+	record.AddString("from", message.senderName);
+
+	switch (message.type) {
+	case MessageType::GetSymKey:
+		record.AddString("type", "sym_key_request");
+		break;
+
+	case MessageType::SendSymKey:
+		record.AddString("type", "sym_key");
+		break;
+
+	case MessageType::SendFileChunk:
+		record.AddString("type", "file_chunk");
+		break;
+
+	default:
+		record.AddString("type", "text");
+		break;
+	}
+
+	if (message.status != Client::ReturnStatus::Success) {
+		record.AddString("status", "error").AddString("error", message.content);
+		return record;
+	}
+
+	record.AddString("status", "ok");
+
+	// A chunk's data is already on disk, so only its place in the file is reported.
+	if (message.type == MessageType::SendFileChunk) {
+		record.AddNumber("sequence", message.chunkHeader.sequence).AddNumber("chunk_count", message.chunkHeader.chunkCount);
+
+		if (receivedPath.empty() == false) {
+			record.AddString("file", receivedPath);
+		}
+	}
+	else {
+		record.AddString("content", message.content);
+	}
+
+	return record;
+}
+
+Client::ReturnStatus Client::HandleSendMessage() {
+
 	std::string name;
+	std::string message;
 
 	std::cout << "Insert destenation name: ";
 	std::cin >> name;
 
-	// Making sure the client exists, so a matching UUID can be extracted.
-	if (this->m_data.find(name) == this->m_data.end()) {
-		std::cout << "Name not found" << std::endl;
+	if (std::cin.fail()) {
+		std::cin.clear();
+		std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		std::cout << "Bad entry" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	if (this->m_data[name]->GetUuid(request.body.uuid) != true) {
-		std::cout << "Failed getting UUID for user" << std::endl;
+	// Won't be handling clients who's UUID can not be extracted.
+	Friend* currFriend = this->m_roster.FindByName(name);
+
+	if (currFriend == nullptr) {
+		std::cout << "Username not found" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	ReturnStatus ret = Exchange(request, response);
+	std::cout << "Insert message to send: ";
 
-	// Updating the local client's public key for future use.
-	if (ret == ReturnStatus::Success) {
-		this->m_data[name]->SetPublicKey(response.body.publicKey);
-	}
+	// Clearing the buffer for a string read.
+	std::cin.ignore();
+	std::getline(std::cin, message);
 
-	return ret;
+	return SendText(name, message);
 }
 
-Client::ReturnStatus Client::HandleWaitingMessages() {
+Client::ReturnStatus Client::SendText(const std::string& name, const std::string& message) {
 
-	RequestGetMessages request(this->m_uuid);
-	std::vector<uint8_t> responseVec;
+	ResponseSendMessage response;
 
-	// Sending request and waiting for response.
-	Client::ReturnStatus ret = Exchange(request, responseVec);
+	Friend* currFriend = this->m_roster.FindByName(name);
 
-	if (ret != Client::ReturnStatus::Success) {
-		return ret;
+	if (currFriend == nullptr) {
+		std::cout << "Username not found" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	// Making sure a message can even be encrypted.
+	if (currFriend->HasSym() != true && currFriend->HasAgreement() != true) {
+		std::cout << "Friend has no sym key set" << std::endl;
+		return Client::ReturnStatus::GeneralError;
 	}
 
-	// The header has been validated at the exchange function.
-	std::vector<uint8_t> payload(responseVec.begin() + sizeof(BaseResponseHeader), responseVec.end());
+	// Building message header with UUID and encrypted data.
+	uuid_t friendUUid;
+	currFriend->GetUuid(friendUUid);
 
-	// The exchange function has aleady validated the data is deserializeable and the lengths match.
-	auto bytesLeft = payload.size();
-	auto bytesRead = 0;
+	// Prepared only if the friend's client reads prepared texts.
+	std::string plain;
+
+	// Sealed into a pooled buffer, so sending doesn't allocate once the pool has warmed up.
+	BufferPool::Buffer cipherBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& cipher = cipherBuffer.Get();
+	cipher.clear();
+
+	MessageType type;
+
+	if (SealText(*currFriend, message, plain, type, cipher) != true) {
+		std::cout << "Failed encrypting message" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	MessageHeader header(friendUUid, (uint8_t)type, cipher.size());
+	
+	// Building the request body out of the sub-header and the cipher, without copying either.
+	RequestSegments requestContent;
+	requestContent.Add(&header, MessageHeader::GetSize());
+	requestContent.Add(cipher.data(), cipher.size());
+	
+	// Encapsulating the body with a request header.
+	DynamicRequest request(this->m_uuid, (uint16_t)Opcode::RequestSendMessage, requestContent);
+
+	RequestSegments requestSegments;
+	request.GetSegments(requestSegments);
+
+	return Exchange(requestSegments, response);
+}
+
+Client::ReturnStatus Client::HandleSendMessageToMany() {
+
+	std::string namesLine;
+	std::string message;
+
+	std::cout << "Insert destenation names, separated by spaces: ";
+
+	// Clearing the buffer for a string read.
+	std::cin.ignore();
+	std::getline(std::cin, namesLine);
 
-	while (bytesLeft > 0) {
+	std::vector<std::string> names;
+	std::istringstream namesStream(namesLine);
 
-		if (bytesLeft < MessageHeader::GetSize()) {
-			std::cout << "Reached an invalid tail length" << std::endl;
+	for (std::string name; namesStream >> name; ) {
+		// Won't be handling clients who's UUID can not be extracted.
+		Friend* currFriend = this->m_roster.FindByName(name);
+
+		if (currFriend == nullptr) {
+			std::cout << "Username not found: " << name << std::endl;
 			return Client::ReturnStatus::GeneralError;
 		}
 
-		MessageHeader currHeader;
-		std::vector<uint8_t> consume(payload.begin() + bytesRead, payload.end());
-
-		if (currHeader.Deserialize(consume) != true) {
-			std::cout << "Read invalid header from server" << std::endl;
+		// Making sure a message can even be encrypted.
+		if (currFriend->HasSym() != true && currFriend->HasAgreement() != true) {
+			std::cout << "Friend has no sym key set: " << name << std::endl;
 			return Client::ReturnStatus::GeneralError;
 		}
 
-		bytesLeft -= MessageHeader::GetSize();
-		bytesRead += MessageHeader::GetSize();
+		names.push_back(name);
+	}
+
+	if (names.empty() == true) {
+		std::cout << "No destenation given" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	std::cout << "Insert message to send: ";
+	std::getline(std::cin, message);
+
+	// Each friend has its own symmetric key, so the records are built one after the other
+	// into a single payload, to be sent with a single request.
+	BufferPool::Buffer requestBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& requestContent = requestBuffer.Get();
+	requestContent.clear();
+
+	// The text is the same for all, so it is prepared only once, for the first friend whose client reads prepared texts.
+	std::string plain;
 
-		// Get friend name from UUID
-		std::string clientName = GetNameFromUuid(currHeader.uuid);
+	for (const auto& name : names) {
+		Friend* currFriend = this->m_roster.FindByName(name);
 
-		if (clientName == "" ||
-			this->m_data.find(clientName) == this->m_data.end()) {
-			std::cout << "Failed getting client's name" << std::endl;
+		uuid_t friendUUid;
+		currFriend->GetUuid(friendUUid);
+
+		// The record is sealed right after room for its header, which is written once its length is known.
+		size_t headerOffset = requestContent.size();
+		requestContent.resize(headerOffset + MessageHeader::GetSize());
+
+		MessageType type;
+
+		if (SealText(*currFriend, message, plain, type, requestContent) != true) {
+			std::cout << "Failed encrypting message to " << name << std::endl;
 			return Client::ReturnStatus::GeneralError;
 		}
 
-		std::cout << "From : " << clientName << std::endl;
-		std::cout << "Content : " << std::endl;
+		MessageHeader header(friendUUid, (uint8_t)type, (uint32_t)(requestContent.size() - headerOffset - MessageHeader::GetSize()));
+		memcpy(&requestContent[headerOffset], &header, MessageHeader::GetSize());
+	}
 
-		switch (currHeader.GetMessageType())
-		{
-		case MessageType::GetSymKey: {
-			std::cout << "Request for symmetric key";
-			break;
-		}
+	RequestSegments payload;
+	payload.Add(ByteView(requestContent));
 
-		case MessageType::SendSymKey: {
-			std::vector<uint8_t> content(consume.begin() + MessageHeader::GetSize(), consume.end());
+	DynamicRequest request(this->m_uuid, (uint16_t)Opcode::RequestSendMessages, payload);
 
-			if (content.size() < ENCRYPTED_SYM_KEY_LENGTH) {
-				std::cout << "Invalid sym key content" << std::endl;
-				return Client::ReturnStatus::GeneralError;
-			}
+	RequestSegments requestSegments;
+	request.GetSegments(requestSegments);
 
-			try {
-				// Decrypting only as long as needed.
-				std::string symKey = this->m_privateKey->decrypt((char*)content.data(), ENCRYPTED_SYM_KEY_LENGTH);
-				this->m_data[clientName]->SetSymKey((unsigned char*)symKey.c_str(), symKey.size());
-			}
-			catch (...) {
-				std::cout << "Failed getting symetric key" << std::endl;
-				return Client::ReturnStatus::GeneralError;
-			}
+	BufferPool::Buffer responseBuffer = this->m_bufferPool.Acquire();
 
-			std::cout << "symmetric key received";
-			break;
-		}
+	Client::ReturnStatus ret = Exchange(requestSegments, responseBuffer.Get());
+	if (ret != Client::ReturnStatus::Success) {
+		return ret;
+	}
 
-		case MessageType::SendText: {
-			std::vector<uint8_t> content(consume.begin() + MessageHeader::GetSize(), consume.end());
-			
-			std::string plain = this->m_data[clientName]->GetSymKey()->decrypt((char*)content.data(), currHeader.contentSize);
-			
-			std::cout << plain;
-			break;
-		}
+	BaseResponseHeader responseHeader;
+	if (responseHeader.Deserialize(responseBuffer.Get()) == false ||
+		responseHeader.GetCode() != Opcode::ResponseSendMessages) {
+		return Client::ReturnStatus::GeneralError;
+	}
 
-		default:
-			std::cout << "Unrecognized message type";
-			break;
-		}
+	// The server answers with one message ID per recipient, in the order they were sent.
+	ByteView responsePayload = responseBuffer.GetView(sizeof(BaseResponseHeader));
 
-		bytesLeft -= currHeader.contentSize;
-		bytesRead += currHeader.contentSize;
-		std::cout << std::endl;
+	if (responsePayload.GetSize() != names.size() * ResponseSendMessageBody::GetSize()) {
+		std::cout << "Unexpected response length" << std::endl;
+		return Client::ReturnStatus::GeneralError;
 	}
 
 	return Client::ReturnStatus::Success;
 }
 
-Client::ReturnStatus Client::HandleSendMessage() {
-
-	ResponseSendMessage response;
+Client::ReturnStatus Client::HandleSendFile() {
 
 	std::string name;
-	std::string message;
+	std::string path;
 
 	std::cout << "Insert destenation name: ";
 	std::cin >> name;
@@ -644,65 +2110,136 @@ Client::ReturnStatus Client::HandleSendMessage() {
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	// Won't be handling clients who's UUID can not be extracted.
-	if (this->m_data.find(name) == this->m_data.end()) {
+	Friend* currFriend = this->m_roster.FindByName(name);
+
+	if (currFriend == nullptr) {
 		std::cout << "Username not found" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	std::cout << "Insert message to send: ";
+	if (currFriend->HasSym() != true) {
+		std::cout << "Friend has no sym key set" << std::endl;
+		return Client::ReturnStatus::GeneralError;
+	}
+
+	std::cout << "Insert path of the file to send: ";
 
 	// Clearing the buffer for a string read.
 	std::cin.ignore();
-	std::getline(std::cin, message);
+	std::getline(std::cin, path);
 
-	// Making sure a message can even be encrypted.
-	if (this->m_data[name]->HasSym() != true) {
-		std::cout << "Friend has no sym key set" << std::endl;
+	std::ifstream file(path, std::ios::binary);
+	if (file.is_open() == false) {
+		std::cout << "Failed openning " << path << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	// The vector which will hold the request body's inner body.
-	std::vector<uint8_t> requestContent;
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = file.tellg();
+
+	OutgoingTransfer transfer(path, name, fileSize);
+
+	if (transfer.GetNextSequence() > 0) {
+		std::cout << "Resuming from chunk " << transfer.GetNextSequence() + 1 << " of " << transfer.GetChunkCount() << std::endl;
+	}
 
-	// Building message header with UUID and encrypted data.
 	uuid_t friendUUid;
-	this->m_data[name]->GetUuid(friendUUid);
+	currFriend->GetUuid(friendUUid);
 
-	std::string cipher = this->m_data[name]->GetSymKey()->encrypt(message.c_str(), message.size());
+	// A single chunk is held at a time, and encrypted in place.
+	std::string chunk;
+	chunk.reserve(AESWrapper::encryptedLength(FILE_CHUNK_LENGTH));
 
-	MessageHeader header(friendUUid, (uint8_t)MessageType::SendText, cipher.size());
-	
-	// Building the request body.
-	header.Serialize(requestContent);
-	requestContent.insert(requestContent.end(), cipher.begin(), cipher.end());
-	
-	// Encapsulating the body with a request header.
-	DynamicRequest request(this->m_uuid, (uint16_t)Opcode::RequestSendMessage, requestContent);
+	while (transfer.IsDone() == false) {
+		uint32_t sequence = transfer.GetNextSequence();
+
+		// Only the file's name is sent, so the sender's directories aren't disclosed.
+		if (sequence == 0) {
+			chunk = std::filesystem::path(path).filename().string();
+		}
+		else {
+			chunk.resize(FILE_CHUNK_LENGTH);
+
+			file.seekg((std::streamoff)(sequence - 1) * FILE_CHUNK_LENGTH);
+			file.read(&chunk[0], FILE_CHUNK_LENGTH);
+			chunk.resize((size_t)file.gcount());
+
+			// The last chunk is expected to be short, so the end of file isn't an error.
+			file.clear();
+		}
+
+		unsigned int plainLength = (unsigned int)chunk.size();
+		chunk.resize(AESWrapper::encryptedLength(plainLength));
+
+		ByteView cipher((const uint8_t*)chunk.data(),
+			currFriend->GetSymKey()->encrypt(chunk.data(), plainLength, &chunk[0], (unsigned int)chunk.size()));
+
+		FileChunkHeader chunkHeader;
+		chunkHeader.transferId = transfer.GetTransferId();
+		chunkHeader.sequence = sequence;
+		chunkHeader.chunkCount = transfer.GetChunkCount();
 
-	std::vector<uint8_t> requestBuff;
-	request.Serialize(requestBuff);
+		MessageHeader header(friendUUid, (uint8_t)MessageType::SendFileChunk, FileChunkHeader::GetSize() + cipher.GetSize());
 
-	return Exchange(requestBuff, response);
+		RequestSegments requestContent;
+		requestContent.Add(&header, MessageHeader::GetSize());
+		requestContent.Add(&chunkHeader, FileChunkHeader::GetSize());
+		requestContent.Add(cipher);
+
+		DynamicRequest request(this->m_uuid, (uint16_t)Opcode::RequestSendMessage, requestContent);
+
+		RequestSegments requestSegments;
+		request.GetSegments(requestSegments);
+
+		ResponseSendMessage response;
+		Client::ReturnStatus ret = Exchange(requestSegments, response);
+
+		// The server refuses chunks while the friend's mailbox holds too many, until they are fetched.
+		for (size_t retry = 0; ret == Client::ReturnStatus::ServerError && retry < FILE_CHUNK_RETRIES; retry++) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			ret = Exchange(requestSegments, response);
+		}
+
+		if (ret != Client::ReturnStatus::Success) {
+			std::cout << "Transfer interrupted at chunk " << sequence + 1 << " of " << transfer.GetChunkCount()
+				<< ", sending the file again resumes it" << std::endl;
+			return ret;
+		}
+
+		if (transfer.Advance() != true) {
+			std::cout << "Failed saving the transfer's progress" << std::endl;
+		}
+	}
+
+	std::cout << "File sent in " << transfer.GetChunkCount() << " chunks" << std::endl;
+
+	return Client::ReturnStatus::Success;
 }
 
 Client::ReturnStatus Client::HandleRequestSymKey() {
 
-	RequestGetSymKey request(this->m_uuid);
-	ResponseSendMessage response;
-
 	std::string name;
 
 	std::cout << "Insert destenation name: ";
 	std::cin >> name;
 
+	return RequestSymKey(name);
+}
+
+Client::ReturnStatus Client::RequestSymKey(const std::string& name) {
+
+	RequestGetSymKey request(this->m_uuid);
+	ResponseSendMessage response;
+
 	// Won't request sym key from client who's UUID can not be extracted.
-	if (this->m_data.find(name) == this->m_data.end()) {
+	Friend* currFriend = this->m_roster.FindByName(name);
+
+	if (currFriend == nullptr) {
 		std::cout << "Username not found" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 	
-	if (this->m_data[name]->GetUuid(request.body.messageHeader.uuid) == false) {
+	if (currFriend->GetUuid(request.body.messageHeader.uuid) == false) {
 
 		std::cout << "Failed getting UUID for user" << std::endl;
 		return Client::ReturnStatus::GeneralError;
@@ -713,35 +2250,42 @@ Client::ReturnStatus Client::HandleRequestSymKey() {
 
 Client::ReturnStatus Client::HandleSendSymKey(){
 
-	RequestSendSymKey request(this->m_uuid);
-	ResponseSendMessage response;
-
 	std::string name;
 
 	std::cout << "Insert destenation name: ";
 	std::cin >> name;
 
+	return SendSymKey(name);
+}
+
+Client::ReturnStatus Client::SendSymKey(const std::string& name) {
+
+	RequestSendSymKey request(this->m_uuid);
+	ResponseSendMessage response;
+
 	// Won't request sym key from client who's UUID can not be extracted.
-	if (this->m_data.find(name) == this->m_data.end()) {
+	Friend* currFriend = this->m_roster.FindByName(name);
+
+	if (currFriend == nullptr) {
 		std::cout << "Username not found" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	if (this->m_data[name]->GetUuid(request.body.messageHeader.uuid) != true) {
+	if (currFriend->GetUuid(request.body.messageHeader.uuid) != true) {
 		std::cout << "Failed getting UUID for user" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
-	if (this->m_data[name]->HasPublic() != true) {
+	if (currFriend->HasPublic() != true) {
 		std::cout << "Ask for public key first!" << std::endl;
 		return Client::ReturnStatus::GeneralError;
 	}
 
 	try {
-		AESWrapper* symKey = this->m_data[name]->GetSymKey();
+		AESWrapper* symKey = currFriend->GetSymKey();
 		memcpy((char*)&request.body.content, symKey->getKey(), SYM_KEY_LENGTH);
 
-		std::string cipher = this->m_data[name]->GetPublicKey()->encrypt((char*)&request.body.content, SYM_KEY_LENGTH);
+		std::string cipher = currFriend->GetPublicKey()->encrypt((char*)&request.body.content, SYM_KEY_LENGTH);
 		memcpy((char*)&request.body.content, cipher.c_str(), request.body.messageHeader.contentSize);
 	}
 	catch (...) {
@@ -752,48 +2296,33 @@ Client::ReturnStatus Client::HandleSendSymKey(){
 	return Exchange(request, response);
 }
 
-Client::ReturnStatus Client::Exchange(const std::vector<uint8_t>& requestVec, std::vector<uint8_t>& responseVec) const {
+Client::ReturnStatus Client::Exchange(const RequestSegments& request, std::vector<uint8_t>& responseVec) {
 
 	BaseResponseHeader tempHeader;
-	responseVec.clear();
-
-	try {
-		boost::asio::io_context io_context;
-		boost::asio::ip::tcp::socket socket(io_context);
-
-		boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(this->m_ipAddr), this->m_port);
+	size_t maxAttempts = IsIdempotent(request) == true ? MAX_ATTEMPTS : 1;
 
-		socket.connect(endpoint);
+	for (size_t attempt = 1; ; attempt++) {
+		responseVec.clear();
 
-		// Sending the request.
-		boost::asio::write(socket, boost::asio::buffer(requestVec.data(), requestVec.size()));
+		try {
+			this->m_connection.Exchange(request, tempHeader, responseVec);
+			break;
+		}
+		catch (boost::system::system_error& e) {
 
-		// Reading header.
-		boost::asio::streambuf header;
-		boost::asio::read(socket, header, boost::asio::transfer_exactly(sizeof(tempHeader)));
-		
-		responseVec.insert(responseVec.end(),
-							boost::asio::buffer_cast<const unsigned char*>(header.data()),
-							boost::asio::buffer_cast<const unsigned char*>(header.data()) + sizeof(tempHeader));
+			std::cerr << "[ERROR] " << e.what() << std::endl;
 
-		if (tempHeader.Deserialize(responseVec) != true) {
-			throw std::runtime_error("Failed deserialize");
+			if (attempt == maxAttempts || IsRetriable(e) == false) {
+				return Client::ReturnStatus::GeneralError;
+			}
 		}
+		catch (std::exception& e) {
 
-		// Reading payload.
-		boost::asio::streambuf payload;
-		boost::asio::read(socket, payload, boost::asio::transfer_exactly(tempHeader.GetPayloadSize()));
-		
-		responseVec.insert(responseVec.end(),
-							boost::asio::buffer_cast<const unsigned char*>(payload.data()), 
-							boost::asio::buffer_cast<const unsigned char*>(payload.data()) + tempHeader.GetPayloadSize());
-		
-		socket.close();
-	}
-	catch (std::exception& e) {
+			std::cerr << "[ERROR] " << e.what() << std::endl;
+			return Client::ReturnStatus::GeneralError;
+		}
 
-		std::cerr << "[ERROR] " << e.what() << std::endl;
-		return Client::ReturnStatus::GeneralError;
+		BackoffBeforeRetry(attempt);
 	}
 
 	// Make sure the server hasn't responded with an error.
@@ -803,3 +2332,84 @@ Client::ReturnStatus Client::Exchange(const std::vector<uint8_t>& requestVec, st
 
 	return Client::ReturnStatus::Success;
 }
+
+Client::ReturnStatus Client::ExchangeStreamed(const RequestSegments& request, const std::function<ReturnStatus(PayloadReader&)>& consumer) {
+
+	BaseResponseHeader tempHeader;
+	Client::ReturnStatus ret = Client::ReturnStatus::Success;
+
+	size_t maxAttempts = IsIdempotent(request) == true ? MAX_ATTEMPTS : 1;
+	bool isConsumed = false;
+
+	for (size_t attempt = 1; ; attempt++) {
+		try {
+			this->m_connection.ExchangeStreamed(request, tempHeader, [&](PayloadReader& reader) {
+				isConsumed = true;
+
+				// Make sure the server hasn't responded with an error.
+				if (tempHeader.GetCode() == Opcode::ResponseFailure) {
+					ret = Client::ReturnStatus::ServerError;
+					return;
+				}
+
+				ret = consumer(reader);
+			});
+			break;
+		}
+		catch (boost::system::system_error& e) {
+
+			std::cerr << "[ERROR] " << e.what() << std::endl;
+
+			// Part of the response may have already been handled, so it mustn't be handled twice.
+			if (attempt == maxAttempts || isConsumed == true || IsRetriable(e) == false) {
+				return Client::ReturnStatus::GeneralError;
+			}
+		}
+		catch (std::exception& e) {
+
+			std::cerr << "[ERROR] " << e.what() << std::endl;
+			return Client::ReturnStatus::GeneralError;
+		}
+
+		BackoffBeforeRetry(attempt);
+	}
+
+	return ret;
+}
+
+std::future<Client::ReturnStatus> Client::ExchangeAsync(const RequestSegments& request, std::vector<uint8_t>& responseVec, uint32_t timeoutMs) {
+
+	auto status = std::make_shared<std::promise<Client::ReturnStatus>>();
+	std::future<Client::ReturnStatus> result = status->get_future();
+
+	// Until the server is known to support pipelining, the request is simply exchanged right away.
+	if (this->m_connection.IsPipelined() == false) {
+		status->set_value(Exchange(request, responseVec));
+		return result;
+	}
+
+	try {
+		this->m_connection.ExchangeAsync(request, responseVec,
+			[status](const boost::system::error_code& error, BaseResponseHeader& header) {
+				if (error) {
+					std::cerr << "[ERROR] " << error.message() << std::endl;
+					status->set_value(Client::ReturnStatus::GeneralError);
+					return;
+				}
+
+				// Make sure the server hasn't responded with an error.
+				if (header.GetCode() == Opcode::ResponseFailure) {
+					status->set_value(Client::ReturnStatus::ServerError);
+					return;
+				}
+
+				status->set_value(Client::ReturnStatus::Success);
+			}, timeoutMs);
+	}
+	catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		status->set_value(Client::ReturnStatus::GeneralError);
+	}
+
+	return result;
+}
@@ -1,21 +1,58 @@
 #pragma once
 
+#include <functional>
+#include <future>
 #include <string>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
 
 #include "Protocol.h"
+#include "BufferPool.h"
+#include "ClientStore.h"
+#include "Connection.h"
+#include "FileTransfer.h"
 #include "Friend.h"
+#include "JsonObject.h"
+#include "KeyPool.h"
+#include "MessageView.h"
+#include "Roster.h"
+#include "WorkerPool.h"
 #include "RSAWrapper.h"
 #include "AESWrapper.h"
+#include "X25519Wrapper.h"
 #include "Base64Wrapper.h"
+#include "CompressionWrapper.h"
 
 class Client {
 public:
+	/**
+		A client of its own, whose identity is kept in 'me.info', and which connects by 'server.info'.
+	*/
 	Client();
+
+	/**
+		A client hosted along with many others in a single process (see Engine).
+		Its connection and buffers are shared with the other clients, so it costs little more than its roster.
+
+		@param	infoPath	-	The path of the client's info file, in the format of 'me.info'.
+		@param	statePath	-	The path of the client's store.
+		@param	connection	-	A pipelined connection, which must outlive the client.
+		@param	bufferPool	-	The pool receive buffers are leased from, which must outlive the client.
+	*/
+	Client(const std::string& infoPath, const std::string& statePath, Connection& connection, BufferPool& bufferPool);
+
 	~Client();
 
+	/**
+		Sets the key pool an unregistered client generates its key pair in ahead of registering.
+		Must be called before Init, which starts the pool.
+
+		@param	depth		-	The most key pairs kept ready at once.
+		@param	threadCount	-	The number of workers generating key pairs.
+	*/
+	void SetKeyPool(size_t depth, size_t threadCount);
+
 	/**
 		This function parses the user's info file to find the name, UUID and PK.
 		In case no file exists, the function won't fail, but will set the instance as uninitialized.
@@ -35,6 +72,68 @@ public:
 	*/
 	void Run();
 
+	/**
+		Runs commands one per line, back to back over a single session, instead of showing the menu.
+		Each command's result is written as a single JSON line, and the results are flushed only
+		once no more commands are pending, so a whole script is run without waiting on the output.
+
+		The commands are:
+			register <name>
+			list
+			pk <name>
+			send <name> <text, to the end of the line>
+			send-sym <name>
+			request-sym <name>
+			fetch
+			exit
+		Blank lines and lines starting with '#' are skipped.
+
+		Each result holds the command's line number, the command, and its status ("ok", "server_error" or "error").
+		Anything the client would print is given as the result's "error", or its "log" upon success.
+		A registration also gives the user's "uuid", and how many key pairs were taken ready from the key pool
+		("key_pool_hits") or generated on demand ("key_pool_misses"). A list gives all the known "users",
+		and a fetch gives the received "messages".
+
+		@param	commands	-	The stream the commands are read from, until it ends or an exit command.
+	*/
+	void RunBatch(std::istream& commands);
+
+	/**
+		Runs a single command of the batch mode, and adds its status to its result.
+		Anything the client would print is printed, the caller may capture it.
+
+		@param	command		-	The command's name, neither blank nor exit.
+		@param	args		-	The rest of the command's line.
+		@param	o_result	-	The command's result, to which anything the command gives is added.
+
+		@return	bool	-	True if the command has succeeded, false otherwise.
+	*/
+	bool RunCommand(const std::string& command, std::istream& args, JsonObject& o_result);
+
+	/**
+		Fetches a single page of the waiting messages, reported the same as by the batch mode's fetch command.
+		The page is read whole before any of its messages is decrypted, so a connection shared with
+		other clients is free for their responses meanwhile.
+
+		@param	o_result		-	The fetch's result, to which its status and the received "messages" are added.
+		@param	o_isMorePending	-	Out parameter, set if the server holds more messages than the page.
+
+		@return	bool	-	True if anything is worth reporting, i.e. a message was received or the fetch has failed.
+	*/
+	bool Poll(JsonObject& o_result, bool& o_isMorePending);
+
+	/**
+		The function parses the 'server.info' file by the format:
+			ip_address:port
+		e.g. "127.0.0.1:1234"
+
+		@param	o_ipAddr	-	Out parameter for the server's IP address.
+		@param	o_port		-	Out parameter for the server's port.
+
+		@return bool	-	True upon success, false otherwise (file not found / wrong format / etc)
+	*/
+	static bool ParseServerInfo(std::string& o_ipAddr, uint16_t& o_port);
+
 private:
 	// All possible choises from the menu.
 	enum class MenuOptions {
@@ -42,9 +141,13 @@ private:
 		ClientList = 20,
 		PublicKey = 30,
 		GetMessages = 40,
+		ListenForMessages = 41,
+		GetMessagesParallel = 42,
 		SendMessageToFriend = 50,
 		GetSymKey = 51,
 		SendSymKey = 52,
+		SendMessageToMany = 53,
+		SendFile = 54,
 		Exit = 0,
 	};
 
@@ -55,7 +158,29 @@ private:
 		GeneralError
 	};
 
+	// A received message, decrypted ahead of being shown, so messages may be decrypted on other threads.
+	struct DecryptedMessage {
+		DecryptedMessage() : status(ReturnStatus::GeneralError), type(MessageType::SendText), chunkHeader() {}
+
+		// Empty if the sender is unknown.
+		std::string senderName;
+
+		ReturnStatus status;
+		MessageType type;
+
+		// What is shown as the message's content, or why it has failed.
+		// For a file chunk it is the decrypted chunk, written to disk once shown.
+		std::string content;
+		FileChunkHeader chunkHeader;
+	};
+
 private:
+	// An agreed text kept aside until its sender's agreement key has been fetched.
+	struct DeferredMessage {
+		MessageHeader header;
+		std::vector<uint8_t> content;
+	};
+
 	/**
 		Prints the entire menu for the user.
 	*/
@@ -74,16 +199,38 @@ private:
 	MenuOptions GetMenuChoise() const;
 
 	/**
-		The function parses the 'server.info' file by the format:
-			ip_address:port
-		e.g. "127.0.0.1:1234"
+		Runs a single command of the batch mode.
 
-		@return bool	-	True upon success, false otherwise (file not found / wrong format / etc)
+		@param	command		-	The command's name, already known to be neither blank nor exit.
+		@param	args		-	The rest of the command's line.
+		@param	o_result	-	The command's result, to which anything the command gives is added.
+
+		@return	ReturnStatus	-	The command's status, the same as its handler's.
 	*/
-	bool ParseServerInfo();
+	ReturnStatus RunBatchCommand(const std::string& command, std::istream& args, JsonObject& o_result);
 
 	/**
-		This function parses the content of `me.info` file and updates the instances fields.
+		Fetches the waiting messages, collecting them instead of printing them.
+
+		@param	o_messages	-	Out parameter to which the received messages are added.
+
+		@return	ReturnStatus	-	The same as HandleWaitingMessages.
+	*/
+	ReturnStatus FetchMessages(std::vector<JsonObject>& o_messages);
+
+	/**
+		Fetches a single page of the waiting messages into a buffer, then handles them, collecting them instead of printing them.
+
+		@param	o_messages		-	Out parameter to which the received messages are added.
+		@param	o_isMorePending	-	Out parameter, set if the server holds more messages than the page.
+
+		@return	ReturnStatus	-	Success if the page was received and all its messages were handled,
+									ServerError if the server has failed, GeneralError otherwise.
+	*/
+	ReturnStatus FetchMessagesPage(std::vector<JsonObject>& o_messages, bool& o_isMorePending);
+
+	/**
+		This function parses the content of the `me.info` file and updates the instances fields.
 
 		@return	bool	-	True if file's content is valid and the fields successfully update, false otherwise.
 	*/
@@ -109,7 +256,7 @@ private:
 								-	GeneralError otherwise.
 	*/
 	template<Opcode _reqCode, typename ReqBody, Opcode _resCode, typename ResBody>
-	ReturnStatus Exchange(const StaticRequest<_reqCode, ReqBody> request, StaticResponse<_resCode, ResBody>& response) const;
+	ReturnStatus Exchange(const StaticRequest<_reqCode, ReqBody>& request, StaticResponse<_resCode, ResBody>& response);
 
 	/**
 		A template function for sending a request and receiving a response with unknown length from the server.
@@ -124,14 +271,14 @@ private:
 								-	GeneralError otherwise.
 	*/
 	template<Opcode _reqCode, typename ReqBody>
-	ReturnStatus Exchange(const StaticRequest<_reqCode, ReqBody> request, std::vector<uint8_t>& responseVec) const;
+	ReturnStatus Exchange(const StaticRequest<_reqCode, ReqBody>& request, std::vector<uint8_t>& responseVec);
 
 	/**
 		A template function for sending a request of unknown length and receiving a response from the server.
 		At this implementation the response is pre-defined at compile time, but the request shall be
 		interpreted as it is being written.
 
-		@param	requestVec	-	A vector of the sent data to the server.
+		@param	request		-	The segments of the request to be sent, written as a single gather write.
 		@param	response	-	A static response which will be filled by the received data.
 
 		@return	ReturnStatus	-	ServerError if the response is a valid error message from the server.
@@ -139,33 +286,247 @@ private:
 								-	GeneralError otherwise.
 	*/
 	template<Opcode _resCode, typename ResBody>
-	ReturnStatus Exchange(const std::vector<uint8_t>& requestVec, StaticResponse<_resCode, ResBody>& response) const;
+	ReturnStatus Exchange(const RequestSegments& request, StaticResponse<_resCode, ResBody>& response);
 
 	/**
 		A template function for sending a request of unknown length and receiving a response 
 		with unknown length from the server.
 		At this implementation the request and the response shall be interpreted at run time.
 
-		@param	requestVec	-	A vector of the sent data to the server.
+		All the other variants end up here. The connection to the server is kept open
+		between calls, and re-opened if it was broken meanwhile.
+
+		Requests which may be safely sent twice (e.g. the client list) are retried
+		after a jittered exponential backoff, unless the server is known to be down.
+
+		@param	request		-	The segments of the request to be sent, written as a single gather write.
 		@param	responseVec	-	A vector of the received data from the server.
 
 		@return	ReturnStatus	-	ServerError if the response is a valid error message from the server.
 								-	Success if the request has been handled successfuly.
 								-	GeneralError otherwise.
 	*/
-	ReturnStatus Exchange(const std::vector<uint8_t>& requestVec, std::vector<uint8_t>& responseVec) const;
+	ReturnStatus Exchange(const RequestSegments& request, std::vector<uint8_t>& responseVec);
+
+	/**
+		A function for sending a request without waiting for its response.
+		Once the connection is pipelined many requests may be in flight at once,
+		and their responses may arrive in any order. Until then, the request is exchanged before returning.
+
+		@param	request		-	The segments of the request to be sent. They are copied, so they may be released right away.
+		@param	responseVec	-	A vector of the received data from the server.
+								It must be kept alive until the returned future is ready.
+		@param	timeoutMs	-	The request's deadline.
+
+		@return	future<ReturnStatus>	-	Becomes ready with the same statuses as the blocking exchange.
+	*/
+	std::future<ReturnStatus> ExchangeAsync(const RequestSegments& request, std::vector<uint8_t>& responseVec,
+		uint32_t timeoutMs = Connection::DEFAULT_TIMEOUT_MS);
+
+	template<Opcode _reqCode, typename ReqBody>
+	std::future<ReturnStatus> ExchangeAsync(const StaticRequest<_reqCode, ReqBody>& request, std::vector<uint8_t>& responseVec,
+		uint32_t timeoutMs = Connection::DEFAULT_TIMEOUT_MS);
+
+	/**
+		A function for sending a request whose response is consumed as it is being read,
+		so the response is never held in memory as a whole.
+
+		@param	request		-	The segments of the request to be sent, written as a single gather write.
+		@param	consumer	-	Reads the payload of the response. Not invoked for an error response.
+								Any payload left unread is discarded.
+
+		@return	ReturnStatus	-	ServerError if the response is a valid error message from the server.
+								-	The consumer's status if it has been invoked.
+								-	GeneralError otherwise.
+	*/
+	ReturnStatus ExchangeStreamed(const RequestSegments& request, const std::function<ReturnStatus(PayloadReader&)>& consumer);
+
+	/**
+		The private key is decoded and parsed from 'me.info' on first use.
+
+		@return	RSAPrivateWrapper*	-	The client's private key, nullptr if it is invalid.
+	*/
+	RSAPrivateWrapper* GetPrivateKey();
+
+	/**
+		The agreement key pair is derived from the private key on first use.
+
+		@return	X25519Wrapper*	-	The client's agreement key pair, nullptr if the private key is invalid.
+	*/
+	X25519Wrapper* GetAgreementKey();
+
+	/**
+		Registers the client's agreement key with the server, once per run, upon registration or Init,
+		if the server is recent enough to keep it. If no request has been answered yet, one is sent
+		first to learn the server's version.
+
+		@return	ReturnStatus	-	Success if the key is registered or the server doesn't support it, the error otherwise.
+	*/
+	ReturnStatus PublishAgreementKey();
+
+	/**
+		Asks the server for a friend's agreement key, if the server is recent enough to keep it.
+		A friend whose client has registered no key is simply left without one.
+
+		@param	currFriend	-	The friend whose key is requested.
+	*/
+	void FetchAgreementKey(Friend& currFriend);
+
+	/**
+		Encrypts a text to a friend, in the newest format the friend's client is known to read.
+
+		A friend who has registered an agreement key runs a client which reads sealed and compressed texts,
+		so the text is prepared and sealed under the key agreed with the friend. Nothing is known of the client
+		of any other friend, so the text is sent as a plain SendText under the symmetric key, as all clients read it.
+
+		@param	currFriend	-	The destination of the text.
+		@param	message		-	The text to be sent.
+		@param	io_plain	-	The text as prepared by PrepareText. Prepared here if empty, so it is reused for the next friends.
+		@param	o_type		-	Out parameter for the message's type (SendAgreedText or SendText).
+		@param	o_content	-	The message's content is appended to it, encrypted in place.
+
+		@return	bool	-	True upon success, false if the friend has neither key or encrypting has failed.
+	*/
+	bool SealText(Friend& currFriend, const std::string& message, std::string& io_plain, MessageType& o_type, std::vector<uint8_t>& o_content);
+
+	/**
+		This function writes the friends which have changed since last saved to the client's store,
+		along with the directory's version.
+	*/
+	void SaveChanges();
+
+	/**
+		Texts are deflated before being sealed when they are long enough,
+		and only if deflating actually makes them shorter.
+
+		@param	message	-	The text to be sent.
+		@param	o_plain	-	Out parameter for the plaintext to be sealed, led by its inner type
+							(SendCompressedText if the text has been deflated, SendText otherwise).
+	*/
+	static void PrepareText(const std::string& message, std::string& o_plain);
 
 	/**
-		The map which holds all the other clients' relevant data is an unordered map
-		with the name as the key.
-		Thus this funtcion helps for the otherway around when needed to get the name 
-		from a given UUID.
+		This function prints the messages in a get messages response, and handles their content.
 
-		@param	uuid	-	The UUID of the user whose name we want.
+		@param	payload	-	The payload of the response, without its header.
 
-		@return	string	-	The name if succesful, empty string otherwise.
+		@return	ReturnStatus	-	Success if all the messages were handled, GeneralError otherwise.
 	*/
-	std::string GetNameFromUuid(const uuid_t &uuid);
+	ReturnStatus ProcessMessages(ByteView payload);
+
+	/**
+		Same as ProcessMessages, but the messages are read one at a time from the response as it arrives.
+
+		@param	reader	-	The reader of the response's payload.
+
+		@return	ReturnStatus	-	Success if all the messages were handled, GeneralError otherwise.
+	*/
+	ReturnStatus StreamMessages(PayloadReader& reader);
+
+	/**
+		Same as StreamMessages, but the messages are decrypted by a pool of workers, one per core.
+		The page is read a window of messages at a time, and each window is shown before the next is read.
+
+		@param	reader	-	The reader of the response's payload.
+
+		@return	ReturnStatus	-	Success if all the messages were handled, GeneralError otherwise.
+	*/
+	ReturnStatus StreamMessagesInParallel(PayloadReader& reader);
+
+	/**
+		Decrypts a window of messages on the worker pool, then shows them in the order they were received.
+		The received keys are decrypted at once, then set in order, so each text is decrypted with the key
+		its sender had set before it. Each worker keeps AES wrappers of its own, so even the texts of a single
+		sender are decrypted in parallel.
+
+		@param	headers		-	The messages' headers, already validated.
+		@param	contents	-	The messages' contents, each exactly as long as its header states.
+
+		@return	ReturnStatus	-	Success if all the messages were handled, GeneralError otherwise.
+	*/
+	ReturnStatus ProcessWindow(const std::vector<MessageHeader>& headers, const std::vector<ByteView>& contents);
+
+	/**
+		This function prints a single message, and handles its content.
+
+		@param	header	-	The message's header, already validated.
+		@param	content	-	The message's content, exactly as long as its header states.
+
+		@return	ReturnStatus	-	Success if the message was handled, GeneralError otherwise.
+	*/
+	ReturnStatus ProcessMessage(const MessageHeader& header, ByteView content);
+
+	/**
+		Decrypts the symmetric key a key message carries. The key isn't set, so many may be decrypted at once.
+
+		@param	content		-	The message's content, exactly as long as its header states.
+		@param	privateKey	-	The client's private key.
+		@param	o_symKey	-	Out parameter for the decrypted key.
+		@param	o_message	-	Out parameter for the decrypted message, told why upon failure.
+
+		@return	bool	-	True upon success, false otherwise.
+	*/
+	static bool DecryptSymKey(ByteView content, RSAPrivateWrapper& privateKey, std::string& o_symKey, DecryptedMessage& o_message);
+
+	/**
+		Keeps an agreed text aside while a page is read, if its sender's agreement key must be fetched first.
+
+		@param	header	-	The message's header, already validated.
+		@param	content	-	The message's content, exactly as long as its header states.
+
+		@return	bool	-	True if the message has been kept aside, to be handled once the page has been read.
+	*/
+	bool DeferMessage(const MessageHeader& header, ByteView content);
+
+	/**
+		Gets the key a message is decrypted with. An agreed text is only accepted if the key it carries
+		is the one the server has registered for its sender, which is fetched if not known yet.
+		Since the sender's keys may be created, derived or fetched here, it is called on the calling thread only,
+		in the order the messages were received. While a page is read, DeferMessage keeps aside the texts whose key must be fetched.
+
+		@param	sender		-	The sender of the message.
+		@param	header		-	The message's header, already validated.
+		@param	content		-	The message's content, exactly as long as its header states.
+		@param	o_key		-	Out parameter for the key, nullptr if the message carries no text.
+		@param	o_message	-	Out parameter for the decrypted message, told why upon failure.
+
+		@return	bool	-	True if the message may be decrypted, false otherwise.
+	*/
+	bool GetMessageKey(Friend& sender, const MessageHeader& header, ByteView content, AESWrapper*& o_key, DecryptedMessage& o_message);
+
+	/**
+		This function decrypts a single message, whose key, if it carries one, has already been set.
+		It touches nothing but its arguments, so many messages may be decrypted at once, each with a key of its own.
+
+		@param	header		-	The message's header, already validated.
+		@param	content		-	The message's content, exactly as long as its header states.
+		@param	key			-	The key given by GetMessageKey, or a copy of it.
+		@param	o_message	-	Out parameter for the decrypted message. Its sender's name is left as it is.
+	*/
+	static void DecryptMessage(const MessageHeader& header, ByteView content, AESWrapper* key, DecryptedMessage& o_message);
+
+	/**
+		This function prints a decrypted message, and writes it to disk if it is a file chunk.
+
+		@param	message	-	The decrypted message.
+
+		@return	ReturnStatus	-	Success if the message was handled, GeneralError otherwise.
+	*/
+	ReturnStatus ShowMessage(const DecryptedMessage& message);
+
+	/**
+		@param	message			-	The decrypted message, already handled.
+		@param	receivedPath	-	The path of the file the message has completed, if any.
+
+		@return	JsonObject	-	The message as reported by the batch mode.
+	*/
+	static JsonObject MessageToJson(const DecryptedMessage& message, const std::string& receivedPath);
+
+	/**
+		@param	status		-	The status of a command.
+		@param	o_result	-	The command's result, to which the status is added as the batch mode reports it.
+	*/
+	static void AddStatus(ReturnStatus status, JsonObject& o_result);
 
 	/*
 		Each of these functions implements a single option from the menu.
@@ -178,51 +539,123 @@ private:
 	ReturnStatus HandleRegister();
 	ReturnStatus HandleList();
 	ReturnStatus HandlePublicKey();
-	ReturnStatus HandleWaitingMessages();
+	ReturnStatus HandleWaitingMessages(bool isParallel);
+	ReturnStatus HandleListenForMessages();
 	ReturnStatus HandleSendMessage();
+	ReturnStatus HandleSendMessageToMany();
+	ReturnStatus HandleSendFile();
 	ReturnStatus HandleRequestSymKey();
 	ReturnStatus HandleSendSymKey();
 
+	/*
+		The handlers of the options which take input, without asking for it,
+		so the batch mode may run them as well. They return the same as the handlers.
+	*/
+	ReturnStatus Register(const std::string& name);
+	ReturnStatus SyncDirectory();
+	ReturnStatus RequestPublicKey(const std::string& name);
+	ReturnStatus SendText(const std::string& name, const std::string& message);
+	ReturnStatus RequestSymKey(const std::string& name);
+	ReturnStatus SendSymKey(const std::string& name);
+
 private:
 	// To keep track if the client has been refistered or not.
 	bool m_isInit;
 
+	// The paths of the client's info file and store, 'me.info' and 'client.state' unless hosted.
+	std::string m_infoPath;
+	std::string m_statePath;
+
 	// Connection to server info.
 	std::string m_ipAddr;
 	uint16_t m_port;
 
-	// The client uses names as identifiers.
-	std::unordered_map<std::string, Friend*> m_data;
+	// A single connection to the server, reused by all requests. Owned only unless hosted.
+	std::unique_ptr<Connection> m_ownedConnection;
+	Connection& m_connection;
+
+	// Responses are read into pooled buffers, so receiving doesn't allocate per request. Owned only unless hosted.
+	std::unique_ptr<BufferPool> m_ownedBufferPool;
+	BufferPool& m_bufferPool;
+
+	// The epoch and version of the server's directory the last time it was synced, zero if never.
+	uint32_t m_directoryEpoch;
+	uint32_t m_directoryVersion;
+
+	// Files being received, reassembled on disk as their chunks arrive.
+	IncomingTransfers m_incomingTransfers;
+
+	// The roster and the keys on disk, kept in sync with m_roster.
+	ClientStore m_store;
+
+	// The other clients, found by name as the user knows them, or by UUID as the server does.
+	Roster m_roster;
+
+	// Key pairs generated in the background, kept only until registered.
+	std::unique_ptr<KeyPool> m_keyPool;
+	size_t m_keyPoolDepth;
+	size_t m_keyPoolThreads;
 
+	// The key pool's counters, kept once it is stopped upon registration.
+	uint64_t m_keyPoolHits;
+	uint64_t m_keyPoolMisses;
+
+	// Decrypts waiting messages in parallel. Started on first use, and kept for the following pages.
+	std::unique_ptr<WorkerPool> m_workerPool;
+
+	// Set from 'me.info' or on registration. Use GetPrivateKey, which parses it on first use.
 	RSAPrivateWrapper *m_privateKey;
+	std::string m_encodedPrivateKey;
+
+	// Derived from the private key on first use. Use GetAgreementKey.
+	X25519Wrapper *m_agreementKey;
+
+	// Set once the agreement key has been registered with the server in this run.
+	bool m_isAgreementKeyPublished;
 
 	// Client's name, UUID and given public key.
 	Name m_name;
 	UUID m_uuid;
+
+	// Set by the batch mode while fetching, so messages are reported to it instead of being printed.
+	std::vector<JsonObject>* m_batchMessages;
+
+	// Set while a page of messages is read, so agreed texts whose sender's key is unknown are handled after it.
+	std::vector<DeferredMessage>* m_deferredMessages;
 };
 
 template<Opcode _reqCode, typename ReqBody, Opcode _resCode, typename ResBody>
-Client::ReturnStatus Client ::Exchange(const StaticRequest<_reqCode, ReqBody> request, StaticResponse<_resCode, ResBody>& response) const {
-	std::vector<uint8_t> requestVec;
-	request.Serialize(requestVec);
+Client::ReturnStatus Client ::Exchange(const StaticRequest<_reqCode, ReqBody>& request, StaticResponse<_resCode, ResBody>& response) {
+	RequestSegments segments;
+	request.GetSegments(segments);
+
+	return Exchange(segments, response);
+}
+
+template<Opcode _reqCode, typename ReqBody>
+Client::ReturnStatus Client::Exchange(const StaticRequest<_reqCode, ReqBody>& request, std::vector<uint8_t>& responseVec) {
+	RequestSegments segments;
+	request.GetSegments(segments);
 
-	return Exchange(requestVec, response);
+	return Exchange(segments, responseVec);
 }
 
 template<Opcode _reqCode, typename ReqBody>
-Client::ReturnStatus Client::Exchange(const StaticRequest<_reqCode, ReqBody> request, std::vector<uint8_t>& responseVec) const {
-	std::vector<uint8_t> requestVec;
-	request.Serialize(requestVec);
+std::future<Client::ReturnStatus> Client::ExchangeAsync(const StaticRequest<_reqCode, ReqBody>& request, std::vector<uint8_t>& responseVec,
+	uint32_t timeoutMs) {
+	RequestSegments segments;
+	request.GetSegments(segments);
 
-	return Exchange(requestVec, responseVec);
+	return ExchangeAsync(segments, responseVec, timeoutMs);
 }
 
 template<Opcode _resCode, typename ResBody>
-Client::ReturnStatus Client::Exchange(const std::vector<uint8_t>& requestVec, StaticResponse<_resCode, ResBody>& response) const {
+Client::ReturnStatus Client::Exchange(const RequestSegments& request, StaticResponse<_resCode, ResBody>& response) {
 
-	std::vector<uint8_t> responseVec;
+	BufferPool::Buffer responseBuffer = this->m_bufferPool.Acquire();
+	std::vector<uint8_t>& responseVec = responseBuffer.Get();
 
-	switch (Exchange(requestVec, responseVec)) {
+	switch (Exchange(request, responseVec)) {
 	case Client::ReturnStatus::ServerError:
 		return Client::ReturnStatus::ServerError;
 
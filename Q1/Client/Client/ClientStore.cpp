@@ -0,0 +1,264 @@
+#include "ClientStore.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Identifies the store's file, and its layout's version.
+static constexpr uint32_t STORE_MAGIC = 0x4D555354;
+static constexpr uint32_t STORE_FORMAT_VERSION = 3;
+
+#pragma pack(push, 1)
+
+struct StoreHeader {
+	uint32_t magic;
+	uint32_t formatVersion;
+	uuid_t owner;
+	uint32_t directoryEpoch;
+	uint32_t directoryVersion;
+	uint32_t recordCount;
+};
+
+struct FriendRecord {
+	uuid_t uuid;
+	name_t name;
+	uint8_t hasPublicKey;
+	publicKey_t publicKey;
+	uint8_t hasSymKey;
+	uint8_t symKey[SYM_KEY_LENGTH];
+	uint8_t hasAgreementKey;
+	agreementKey_t agreementKey;
+};
+
+#pragma pack(pop)
+
+ClientStore::ClientStore(const std::string& path) : m_path(path), m_isOpen(false), m_directoryEpoch(0), m_directoryVersion(0), m_recordCount(0) {}
+
+bool ClientStore::Open(const uuid_t owner, Roster& o_friends, uint32_t& o_directoryEpoch, uint32_t& o_directoryVersion) {
+
+	if (this->m_file.is_open() == true) {
+		this->m_file.close();
+	}
+
+	this->m_isOpen = false;
+	this->m_slots.clear();
+	this->m_recordCount = 0;
+
+	// The mapping is released once loaded, so the file may be written. It is opened once, to make sure it can be.
+	if (Load(owner, o_friends, o_directoryEpoch, o_directoryVersion) == true) {
+		this->m_directoryEpoch = o_directoryEpoch;
+		this->m_directoryVersion = o_directoryVersion;
+		this->m_isOpen = OpenFile();
+
+		return Flush();
+	}
+
+	// Starting over, with no friends at all.
+	o_directoryEpoch = 0;
+	o_directoryVersion = 0;
+	this->m_directoryEpoch = 0;
+	this->m_directoryVersion = 0;
+
+	StoreHeader header = { STORE_MAGIC, STORE_FORMAT_VERSION, { 0 }, 0, 0, 0 };
+	memcpy(header.owner, owner, sizeof(uuid_t));
+
+	this->m_file.open(this->m_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	this->m_file.write((const char*)&header, sizeof(header));
+	this->m_isOpen = this->m_file.is_open();
+
+	return Flush();
+}
+
+bool ClientStore::OpenFile() {
+
+	if (this->m_file.is_open() == false) {
+		this->m_file.clear();
+		this->m_file.open(this->m_path, std::ios::binary | std::ios::in | std::ios::out);
+	}
+
+	return this->m_file.is_open();
+}
+
+bool ClientStore::Load(const uuid_t owner, Roster& o_friends, uint32_t& o_directoryEpoch, uint32_t& o_directoryVersion) {
+
+	try {
+		boost::interprocess::file_mapping mapping(this->m_path.c_str(), boost::interprocess::read_only);
+		boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+
+		const uint8_t* data = (const uint8_t*)region.get_address();
+		size_t size = region.get_size();
+
+		if (size < sizeof(StoreHeader)) {
+			return false;
+		}
+
+		StoreHeader header;
+		memcpy(&header, data, sizeof(header));
+
+		if (header.magic != STORE_MAGIC ||
+			header.formatVersion != STORE_FORMAT_VERSION ||
+			memcmp(header.owner, owner, sizeof(uuid_t)) != 0 ||
+			(size - sizeof(StoreHeader)) / sizeof(FriendRecord) < header.recordCount) {
+			return false;
+		}
+
+		const FriendRecord* records = (const FriendRecord*)(data + sizeof(StoreHeader));
+
+		for (uint32_t i = 0; i < header.recordCount; i++) {
+			const FriendRecord& record = records[i];
+			std::string name((const char*)record.name, strnlen((const char*)record.name, sizeof(name_t)));
+
+			// A broken record keeps its place, and its friend is saved anew once listed again.
+			Friend* currFriend = o_friends.Add(name, record.uuid);
+
+			if (currFriend == nullptr) {
+				continue;
+			}
+
+			if (record.hasPublicKey != 0) {
+				currFriend->SetPublicKey(record.publicKey);
+			}
+
+			if (record.hasAgreementKey != 0) {
+				currFriend->SetAgreementKey(record.agreementKey);
+			}
+
+			// A friend whose key is broken is kept without it, and is asked for a new one.
+			try {
+				if (record.hasSymKey != 0) {
+					currFriend->SetSymKey(record.symKey, sizeof(record.symKey));
+				}
+			}
+			catch (...) {}
+
+			currFriend->ClearChanged();
+
+			this->m_slots[std::string((const char*)record.uuid, sizeof(uuid_t))] = i;
+		}
+
+		this->m_recordCount = header.recordCount;
+		o_directoryEpoch = header.directoryEpoch;
+		o_directoryVersion = header.directoryVersion;
+	}
+	catch (const boost::interprocess::interprocess_exception&) {
+		// No file to be mapped, e.g. on the first run.
+		return false;
+	}
+
+	return true;
+}
+
+bool ClientStore::SaveFriend(const Friend& currFriend) {
+
+	if (this->m_isOpen == false || OpenFile() == false) {
+		return false;
+	}
+
+	FriendRecord record;
+	memset(&record, 0, sizeof(record));
+
+	if (currFriend.GetUuid(record.uuid) != true) {
+		return false;
+	}
+
+	std::string name = currFriend.GetName();
+	memcpy(record.name, name.c_str(), std::min(name.size(), sizeof(name_t) - 1));
+
+	const uint8_t* publicKey = currFriend.GetRawPublicKey();
+	if (publicKey != nullptr) {
+		record.hasPublicKey = 1;
+		memcpy(record.publicKey, publicKey, sizeof(publicKey_t));
+	}
+
+	const unsigned char* symKey = currFriend.GetRawSymKey();
+	if (symKey != nullptr) {
+		record.hasSymKey = 1;
+		memcpy(record.symKey, symKey, sizeof(record.symKey));
+	}
+
+	const uint8_t* agreementKey = currFriend.GetRawAgreementKey();
+	if (agreementKey != nullptr) {
+		record.hasAgreementKey = 1;
+		memcpy(record.agreementKey, agreementKey, sizeof(agreementKey_t));
+	}
+
+	std::string uuidKey((const char*)record.uuid, sizeof(uuid_t));
+	auto found = this->m_slots.find(uuidKey);
+	bool isNew = found == this->m_slots.end();
+	uint32_t slot = isNew == true ? this->m_recordCount : found->second;
+
+	this->m_file.seekp(sizeof(StoreHeader) + (std::streamoff)slot * sizeof(FriendRecord));
+	this->m_file.write((const char*)&record, sizeof(record));
+
+	if (this->m_file.good() == false) {
+		this->m_file.clear();
+		return false;
+	}
+
+	if (isNew == false) {
+		return true;
+	}
+
+	// Counting the record only once it is written, so a torn append is simply ignored.
+	this->m_slots[uuidKey] = slot;
+	this->m_recordCount++;
+
+	this->m_file.seekp(offsetof(StoreHeader, recordCount));
+	this->m_file.write((const char*)&this->m_recordCount, sizeof(this->m_recordCount));
+
+	return this->m_file.good();
+}
+
+bool ClientStore::SaveDirectoryVersion(uint32_t epoch, uint32_t version) {
+
+	if (this->m_isOpen == false) {
+		return false;
+	}
+
+	// Most saves change no friend and no version, so the file isn't even opened for them.
+	if (epoch == this->m_directoryEpoch && version == this->m_directoryVersion) {
+		return true;
+	}
+
+	if (OpenFile() == false) {
+		return false;
+	}
+
+	// The two are next to each other, so they are written at once.
+	uint32_t fields[] = { epoch, version };
+
+	this->m_file.seekp(offsetof(StoreHeader, directoryEpoch));
+	this->m_file.write((const char*)fields, sizeof(fields));
+
+	if (this->m_file.good() == false) {
+		this->m_file.clear();
+		return false;
+	}
+
+	this->m_directoryEpoch = epoch;
+	this->m_directoryVersion = version;
+	return true;
+}
+
+bool ClientStore::Flush() {
+
+	if (this->m_isOpen == false) {
+		return false;
+	}
+
+	// Nothing has been written since the last flush.
+	if (this->m_file.is_open() == false) {
+		return true;
+	}
+
+	this->m_file.flush();
+
+	bool isGood = this->m_file.good();
+	this->m_file.close();
+
+	return isGood;
+}
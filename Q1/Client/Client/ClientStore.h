@@ -0,0 +1,92 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "Roster.h"
+
+/**
+	This class keeps the client's roster on disk, next to 'me.info', so a restarted client knows
+	its friends and their keys without asking the server, or the friends, for them again.
+
+	The file is a header followed by a fixed-size record per friend, so a changed friend is
+	rewritten in place and a new one is appended. It is memory-mapped to be loaded at startup.
+	Otherwise the file is open only from the first write until flushed, so a process hosting many clients
+	doesn't run out of open files.
+
+	Symmetric keys are kept as they are, the same as the private key is kept in 'me.info'.
+*/
+class ClientStore {
+public:
+	/**
+		@param	path	-	The path of the store's file. Nothing is read until it is opened.
+	*/
+	ClientStore(const std::string& path);
+
+	/**
+		Loads the friends saved by the given user. If the file is missing, invalid, or belongs
+		to another user, it is started over empty.
+
+		@param	owner				-	The UUID of the user the store belongs to.
+		@param	o_friends			-	Out parameter to which the saved friends are added.
+		@param	o_directoryEpoch	-	Out parameter for the epoch of the server which gave the version, zero if empty.
+		@param	o_directoryVersion	-	Out parameter for the directory's version when the roster was saved, zero if empty.
+
+		@return	bool	-	True if the store is ready for saving, false otherwise.
+	*/
+	bool Open(const uuid_t owner, Roster& o_friends, uint32_t& o_directoryEpoch, uint32_t& o_directoryVersion);
+
+	/**
+		Writes a friend's record, in its place if it was saved before, or at the end otherwise.
+
+		@param	currFriend	-	The friend to be saved.
+
+		@return	bool	-	True upon success, false otherwise.
+	*/
+	bool SaveFriend(const Friend& currFriend);
+
+	/**
+		Nothing is written if the version is already saved.
+
+		@param	epoch	-	The epoch of the server which gave the version.
+		@param	version	-	The directory's version the saved roster is synced to.
+
+		@return	bool	-	True upon success, false otherwise.
+	*/
+	bool SaveDirectoryVersion(uint32_t epoch, uint32_t version);
+
+	/**
+		Makes sure everything saved so far has reached the file, and closes it until the next write.
+
+		@return	bool	-	True upon success, false otherwise.
+	*/
+	bool Flush();
+
+private:
+	/**
+		Reads the friends from the mapped file, without changing it.
+
+		@return	bool	-	True if the file is valid and belongs to the owner, false otherwise.
+	*/
+	bool Load(const uuid_t owner, Roster& o_friends, uint32_t& o_directoryEpoch, uint32_t& o_directoryVersion);
+
+	/**
+		Opens the file for writing, unless it is open already.
+
+		@return	bool	-	True if the file is open, false otherwise.
+	*/
+	bool OpenFile();
+
+	std::string m_path;
+	std::fstream m_file;
+
+	// Set once opened for the owner, even while the file itself is closed.
+	bool m_isOpen;
+	uint32_t m_directoryEpoch;
+	uint32_t m_directoryVersion;
+
+	// The index of each saved friend's record, by UUID.
+	std::unordered_map<std::string, uint32_t> m_slots;
+	uint32_t m_recordCount;
+};
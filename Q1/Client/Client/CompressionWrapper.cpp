@@ -0,0 +1,46 @@
+#include "CompressionWrapper.h"
+
+#include <stdexcept>
+
+// The input is inflated a piece at a time, so the output's length is checked as it grows.
+static constexpr size_t INFLATE_CHUNK_LENGTH = 4096;
+
+
+std::string CompressionWrapper::compress(const std::string& str)
+{
+	std::string compressed;
+	CryptoPP::StringSource ss(str, true,
+		new CryptoPP::Deflator(
+			new CryptoPP::StringSink(compressed)
+		) // Deflator
+	); // StringSource
+
+	return compressed;
+}
+
+std::string CompressionWrapper::decompress(const std::string& str, size_t maxLength)
+{
+	std::string decompressed;
+	CryptoPP::StringSource ss(str, false,
+		new CryptoPP::Inflator(
+			new CryptoPP::StringSink(decompressed)
+		) // Inflator
+	); // StringSource
+
+	while (ss.SourceExhausted() == false) {
+		ss.Pump(INFLATE_CHUNK_LENGTH);
+
+		if (decompressed.size() > maxLength) {
+			throw std::length_error("Decompressed data is too long");
+		}
+	}
+
+	// Flushing whatever the inflator still holds.
+	ss.PumpAll();
+
+	if (decompressed.size() > maxLength) {
+		throw std::length_error("Decompressed data is too long");
+	}
+
+	return decompressed;
+}
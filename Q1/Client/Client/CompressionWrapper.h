@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <zdeflate.h>
+#include <zinflate.h>
+
+
+class CompressionWrapper
+{
+public:
+	static std::string compress(const std::string& str);
+
+	/**
+		@param	str			-	Deflated data, as given by compress.
+		@param	maxLength	-	The longest output accepted, so a small input can't inflate without a limit.
+
+		Throws if the data is invalid or inflates beyond maxLength.
+	*/
+	static std::string decompress(const std::string& str, size_t maxLength);
+};
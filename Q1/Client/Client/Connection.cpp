@@ -0,0 +1,741 @@
+#include "Connection.h"
+
+#include <algorithm>
+#include <array>
+#include <future>
+
+/**
+	A gather sequence over the segments of a frame, kept on the stack.
+	It satisfies asio's ConstBufferSequence, so it is passed directly to (async_)write.
+*/
+class GatherBuffers {
+public:
+	typedef boost::asio::const_buffer value_type;
+	typedef const boost::asio::const_buffer* const_iterator;
+
+	GatherBuffers() : m_count(0) {}
+
+	void Add(const void* data, size_t size) {
+		this->m_buffers[this->m_count++] = boost::asio::const_buffer(data, size);
+	}
+
+	void Add(const RequestSegments& segments) {
+		for (size_t i = 0; i < segments.GetCount(); i++) {
+			Add(segments[i].GetData(), segments[i].GetSize());
+		}
+	}
+
+	const_iterator begin() const { return this->m_buffers.data(); }
+	const_iterator end() const { return this->m_buffers.data() + this->m_count; }
+
+private:
+	// The pipelined header is the only segment added to a request's own segments.
+	std::array<boost::asio::const_buffer, RequestSegments::MAX_SEGMENTS + 1> m_buffers;
+	size_t m_count;
+};
+
+Connection::Connection() : m_ownedIoContext(new boost::asio::io_context()), m_ioContext(*m_ownedIoContext), m_socket(m_ioContext),
+							m_isPipelined(false), m_isPipeliningWanted(false), m_work(boost::asio::make_work_guard(m_ioContext)),
+							m_generation(0), m_nextRequestId(0), m_isConnecting(false), m_isReading(false), m_isShuttingDown(false),
+							m_probeSocket(m_ioContext), m_probeTimer(m_ioContext), m_serverVersion(0) {}
+
+Connection::Connection(boost::asio::io_context& ioContext) : m_ioContext(ioContext), m_socket(m_ioContext),
+							m_isPipelined(true), m_isPipeliningWanted(false), m_work(boost::asio::make_work_guard(m_ioContext)),
+							m_generation(0), m_nextRequestId(0), m_isConnecting(false), m_isReading(false), m_isShuttingDown(false),
+							m_probeSocket(m_ioContext), m_probeTimer(m_ioContext), m_serverVersion(0) {}
+
+Connection::~Connection() {
+	if (this->m_isPipelined == false) {
+		Close();
+		return;
+	}
+
+	// The owner of a shared context has already shut the connection down, and ran the context out of work.
+	if (this->m_ownedIoContext == nullptr) {
+		return;
+	}
+
+	Shutdown();
+	this->m_ioThread.join();
+}
+
+void Connection::Shutdown() {
+	if (this->m_isPipelined == false) {
+		return;
+	}
+
+	// The socket and the pending requests belong to the I/O thread.
+	boost::asio::post(this->m_ioContext, [this]() {
+		this->m_isShuttingDown = true;
+
+		boost::system::error_code ignored;
+		this->m_probeTimer.cancel();
+		this->m_probeSocket.close(ignored);
+
+		FailAll(boost::asio::error::operation_aborted);
+	});
+
+	this->m_work.reset();
+}
+
+void Connection::SetEndpoint(const std::string& ipAddr, uint16_t port) {
+	Close();
+
+	this->m_endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(ipAddr), port);
+}
+
+void Connection::EnablePipelining() {
+	// A connection on a shared context is pipelined from the start.
+	if (this->m_isPipelined == true) {
+		return;
+	}
+
+	Close();
+
+	this->m_isPipelined = true;
+	this->m_ioThread = std::thread([this]() { this->m_ioContext.run(); });
+}
+
+void Connection::EnablePipeliningWhenSupported() {
+	this->m_isPipeliningWanted = true;
+}
+
+void Connection::UpgradeIfSupported() {
+	// Only done between requests, once the whole response has been read over the blocking socket.
+	if (this->m_isPipeliningWanted == true && this->m_serverVersion >= PIPELINED_VERSION) {
+		EnablePipelining();
+	}
+}
+
+void Connection::Exchange(const RequestSegments& request, BaseResponseHeader& o_header, std::vector<uint8_t>& responseVec,
+	uint32_t timeoutMs) {
+
+	if (this->m_isPipelined == true) {
+		std::promise<void> released;
+		auto isReleased = released.get_future();
+
+		std::promise<boost::system::error_code> done;
+		auto result = done.get_future();
+
+		Enqueue(MakeBorrowedFrame(request, released), &responseVec, [&done, &o_header](const boost::system::error_code& error, BaseResponseHeader& header) {
+			o_header = header;
+			done.set_value(error);
+		}, timeoutMs);
+
+		boost::system::error_code error = result.get();
+
+		// A failed request may still be being written, so its segments are held until the I/O thread is done with them.
+		isReleased.wait();
+
+		if (error) {
+			throw boost::system::system_error(error);
+		}
+
+		return;
+	}
+
+	ExchangeHeader(request, o_header, responseVec, timeoutMs);
+
+	// Reading payload.
+	responseVec.resize(sizeof(BaseResponseHeader) + o_header.GetPayloadSize());
+
+	size_t bytesRead = 0;
+	boost::system::error_code error = ReadBlocking(responseVec.data() + sizeof(BaseResponseHeader), o_header.GetPayloadSize(),
+		bytesRead, timeoutMs);
+
+	if (error) {
+		Close();
+		throw boost::system::system_error(error);
+	}
+
+	UpgradeIfSupported();
+}
+
+void Connection::ExchangeStreamed(const RequestSegments& request, BaseResponseHeader& o_header, const PayloadConsumer& consumer,
+	uint32_t timeoutMs) {
+
+	if (this->m_isPipelined == true) {
+		std::promise<void> released;
+		auto isReleased = released.get_future();
+
+		std::promise<boost::system::error_code> done;
+		auto result = done.get_future();
+		uint32_t generation = 0;
+
+		// The I/O thread stops reading once the header arrives, until the payload has been consumed here.
+		Enqueue(MakeBorrowedFrame(request, released), nullptr,
+			[this, &done, &o_header, &generation](const boost::system::error_code& error, BaseResponseHeader& header) {
+				o_header = header;
+				generation = this->m_generation;
+				done.set_value(error);
+			}, timeoutMs);
+
+		boost::system::error_code error = result.get();
+		isReleased.wait();
+
+		if (error) {
+			throw boost::system::system_error(error);
+		}
+
+		auto resumeReading = [this, generation]() {
+			boost::asio::post(this->m_ioContext, [this, generation]() {
+				// Otherwise the connection has been dropped meanwhile, and reading starts over with the next request.
+				if (generation == this->m_generation) {
+					ReadNextHeader();
+				}
+			});
+		};
+
+		try {
+			ConsumePayload(consumer, o_header.GetPayloadSize(), generation, timeoutMs);
+		}
+		catch (...) {
+			resumeReading();
+			throw;
+		}
+
+		resumeReading();
+		return;
+	}
+
+	std::vector<uint8_t> headerVec;
+	ExchangeHeader(request, o_header, headerVec, timeoutMs);
+
+	ConsumePayload(consumer, o_header.GetPayloadSize(), this->m_generation, timeoutMs);
+
+	UpgradeIfSupported();
+}
+
+void Connection::ConsumePayload(const PayloadConsumer& consumer, size_t payloadSize, uint32_t generation, uint32_t timeoutMs) {
+	PayloadReader reader(*this, payloadSize, generation, timeoutMs);
+
+	try {
+		consumer(reader);
+	}
+	catch (...) {
+		try {
+			reader.Discard();
+		}
+		catch (...) {
+			// The connection has already been dropped, the consumer's error is the one worth reporting.
+		}
+		throw;
+	}
+
+	reader.Discard();
+}
+
+void Connection::ReadStreamed(void* data, size_t size, uint32_t generation, uint32_t timeoutMs) {
+
+	if (this->m_isPipelined == false) {
+		size_t bytesRead = 0;
+		boost::system::error_code error = ReadBlocking(data, size, bytesRead, timeoutMs);
+
+		if (error) {
+			Close();
+			throw boost::system::system_error(error);
+		}
+		return;
+	}
+
+	std::promise<boost::system::error_code> done;
+	auto result = done.get_future();
+
+	boost::asio::post(this->m_ioContext, [this, data, size, generation, timeoutMs, &done]() {
+		if (generation != this->m_generation) {
+			done.set_value(boost::asio::error::operation_aborted);
+			return;
+		}
+
+		auto deadline = std::make_shared<boost::asio::steady_timer>(this->m_ioContext);
+		StartDeadline(deadline, timeoutMs);
+
+		boost::asio::async_read(this->m_socket, boost::asio::buffer(data, size),
+			[this, generation, deadline, &done](const boost::system::error_code& error, size_t) {
+				StopDeadline(*deadline);
+
+				if (generation != this->m_generation) {
+					done.set_value(boost::asio::error::operation_aborted);
+					return;
+				}
+
+				if (error) {
+					FailAll(error);
+				}
+
+				done.set_value(error);
+			});
+	});
+
+	boost::system::error_code error = result.get();
+	if (error) {
+		throw boost::system::system_error(error);
+	}
+}
+
+void PayloadReader::Read(void* data, size_t size) {
+	if (size > this->m_remaining) {
+		throw std::out_of_range("Read exceeds the payload");
+	}
+
+	this->m_connection.ReadStreamed(data, size, this->m_generation, this->m_timeoutMs);
+	this->m_remaining -= size;
+}
+
+void PayloadReader::Discard() {
+	uint8_t discarded[4096];
+
+	while (this->m_remaining > 0) {
+		Read(discarded, std::min(this->m_remaining, sizeof(discarded)));
+	}
+}
+
+void Connection::ExchangeHeader(const RequestSegments& request, BaseResponseHeader& o_header, std::vector<uint8_t>& responseVec,
+	uint32_t timeoutMs) {
+
+	// A stale socket is only detected once used, so a reused socket gets a second chance.
+	bool isReused = IsOpen();
+
+	while (true) {
+		responseVec.clear();
+		responseVec.resize(sizeof(BaseResponseHeader));
+
+		size_t headerBytesRead = 0;
+
+		Connect();
+
+		// Sending the request, then reading the header.
+		boost::system::error_code error = WriteBlocking(request, timeoutMs);
+
+		if (!error) {
+			error = ReadBlocking(responseVec.data(), responseVec.size(), headerBytesRead, timeoutMs);
+		}
+
+		if (error) {
+			Close();
+
+			// Nothing of the response was received, so the request can be safely sent again,
+			// unless the server has stalled rather than closed the idle connection.
+			if (isReused == true && headerBytesRead == 0 && error != boost::asio::error::timed_out) {
+				isReused = false;
+				continue;
+			}
+
+			throw boost::system::system_error(error);
+		}
+
+		break;
+	}
+
+	if (o_header.Deserialize(responseVec) != true) {
+		// The stream can't be trusted anymore.
+		Close();
+		throw std::runtime_error("Failed deserialize");
+	}
+
+	this->m_serverVersion = o_header.GetVersion();
+
+	// Only an answer proves the server is well, a stalled one still accepts connections.
+	this->m_breaker.RecordSuccess();
+}
+
+void Connection::ExchangeAsync(const RequestSegments& request, std::vector<uint8_t>& responseVec, ResponseHandler handler,
+	uint32_t timeoutMs) {
+
+	if (this->m_isPipelined == false) {
+		throw std::logic_error("Connection is not pipelined");
+	}
+
+	// The caller may release the request right away, so its payload is copied.
+	auto frame = std::make_shared<OutgoingFrame>();
+	frame->header = PipelinedRequestHeader(request, 0);
+	request.Skip(sizeof(BaseRequestHeader)).Flatten(frame->ownedPayload);
+	frame->payload.Add(ByteView(frame->ownedPayload));
+
+	Enqueue(frame, &responseVec, handler, timeoutMs);
+}
+
+std::shared_ptr<Connection::OutgoingFrame> Connection::MakeBorrowedFrame(const RequestSegments& request, std::promise<void>& released) {
+	// Whoever drops the last reference, the queue or an outstanding write, tells the caller its segments are free.
+	std::shared_ptr<OutgoingFrame> frame(new OutgoingFrame(), [&released](OutgoingFrame* frame) {
+		delete frame;
+		released.set_value();
+	});
+
+	frame->header = PipelinedRequestHeader(request, 0);
+	frame->payload = request.Skip(sizeof(BaseRequestHeader));
+
+	return frame;
+}
+
+void Connection::Enqueue(std::shared_ptr<OutgoingFrame> frame, std::vector<uint8_t>* responseVec, ResponseHandler handler, uint32_t timeoutMs) {
+
+	boost::asio::post(this->m_ioContext, [this, frame, responseVec, handler, timeoutMs]() {
+		// The server is known to be down, so failing right away rather than waiting for a connect timeout.
+		if (this->m_breaker.IsOpen() == true) {
+			BaseResponseHeader emptyHeader;
+			if (responseVec != nullptr) {
+				responseVec->clear();
+			}
+			handler(boost::asio::error::host_unreachable, emptyHeader);
+			return;
+		}
+
+		requestId_t requestId = this->m_nextRequestId++;
+		frame->header.SetRequestId(requestId);
+
+		auto deadline = std::make_shared<boost::asio::steady_timer>(this->m_ioContext);
+		StartDeadline(deadline, timeoutMs);
+
+		this->m_pending[requestId] = PendingRequest{ responseVec, handler, deadline };
+		this->m_writeQueue.push_back(frame);
+
+		// The queue is written once connected.
+		if (this->m_isConnecting == true) {
+			return;
+		}
+
+		if (IsOpen() == false) {
+			StartConnect();
+			return;
+		}
+
+		// Otherwise the queue is already being written.
+		if (this->m_writeQueue.size() == 1) {
+			WriteNext();
+		}
+
+		if (this->m_isReading == false) {
+			ReadNextHeader();
+		}
+	});
+}
+
+void Connection::StartConnect() {
+	uint32_t generation = this->m_generation;
+	this->m_isConnecting = true;
+
+	// Closing the socket aborts the connection attempt.
+	auto connectTimer = std::make_shared<boost::asio::steady_timer>(this->m_ioContext, std::chrono::milliseconds(CONNECT_TIMEOUT_MS));
+	connectTimer->async_wait([this, generation](const boost::system::error_code& error) {
+		if (!error && generation == this->m_generation && this->m_isConnecting == true) {
+			Close();
+		}
+	});
+
+	this->m_socket.async_connect(this->m_endpoint, [this, generation, connectTimer](const boost::system::error_code& error) {
+		connectTimer->cancel();
+
+		if (generation != this->m_generation) {
+			return;
+		}
+
+		this->m_isConnecting = false;
+
+		if (error) {
+			if (this->m_breaker.RecordFailure() == true) {
+				StartProbing();
+			}
+
+			FailAll(error == boost::asio::error::operation_aborted ? boost::asio::error::timed_out : error);
+			return;
+		}
+
+		// The breaker is reset only by a response, since a stalled server still accepts connections.
+		if (this->m_writeQueue.empty() == false) {
+			WriteNext();
+		}
+
+		ReadNextHeader();
+	});
+}
+
+void Connection::StartProbing() {
+	this->m_probeTimer.expires_after(std::chrono::milliseconds(CircuitBreaker::PROBE_INTERVAL_MS));
+	this->m_probeTimer.async_wait([this](const boost::system::error_code& error) {
+		if (error || this->m_isShuttingDown == true) {
+			return;
+		}
+
+		// The same timer bounds the probe, so a black-holed endpoint is probed again in time.
+		this->m_probeTimer.expires_after(std::chrono::milliseconds(CONNECT_TIMEOUT_MS));
+		this->m_probeTimer.async_wait([this](const boost::system::error_code& error) {
+			if (!error) {
+				boost::system::error_code ignored;
+				this->m_probeSocket.close(ignored);
+			}
+		});
+
+		this->m_probeSocket.async_connect(this->m_endpoint, [this](const boost::system::error_code& error) {
+			this->m_probeTimer.cancel();
+
+			// The probe's connection is only a test, requests open their own.
+			boost::system::error_code ignored;
+			this->m_probeSocket.close(ignored);
+
+			if (this->m_isShuttingDown == true) {
+				return;
+			}
+
+			if (error) {
+				StartProbing();
+				return;
+			}
+
+			this->m_breaker.RecordSuccess();
+		});
+	});
+}
+
+void Connection::StartDeadline(std::shared_ptr<boost::asio::steady_timer> deadline, uint32_t timeoutMs) {
+	deadline->expires_after(std::chrono::milliseconds(timeoutMs));
+	deadline->async_wait([this, deadline](const boost::system::error_code&) {
+		// A stopped deadline never expires, even if its expiry has already been queued.
+		if (deadline->expiry() > boost::asio::steady_timer::clock_type::now()) {
+			return;
+		}
+
+		// The server has stalled, so the connection can't be trusted anymore.
+		if (this->m_breaker.RecordFailure() == true) {
+			StartProbing();
+		}
+
+		FailAll(boost::asio::error::timed_out);
+	});
+}
+
+void Connection::StopDeadline(boost::asio::steady_timer& deadline) {
+	deadline.expires_at(boost::asio::steady_timer::time_point::max());
+}
+
+void Connection::Close() {
+	if (IsOpen() == false) {
+		return;
+	}
+
+	boost::system::error_code ignored;
+	this->m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+	this->m_socket.close(ignored);
+}
+
+void Connection::Connect() {
+	// Nobody else runs the context before pipelining, so a probe of the circuit breaker progresses only here.
+	this->m_ioContext.poll();
+
+	if (IsOpen() == true) {
+		return;
+	}
+
+	// The server is known to be down, so failing right away rather than waiting for a connect timeout.
+	if (this->m_breaker.IsOpen() == true) {
+		throw boost::system::system_error(boost::asio::error::host_unreachable);
+	}
+
+	BlockingOperation operation;
+
+	this->m_socket.async_connect(this->m_endpoint, [&operation](const boost::system::error_code& error) {
+		operation.Complete(error, 0);
+	});
+
+	RunBlocking(operation, CONNECT_TIMEOUT_MS);
+
+	if (operation.error) {
+		Close();
+
+		if (this->m_breaker.RecordFailure() == true) {
+			StartProbing();
+		}
+
+		throw boost::system::system_error(operation.error);
+	}
+}
+
+void Connection::RunBlocking(BlockingOperation& operation, uint32_t timeoutMs) {
+	auto expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+	while (operation.isDone == false) {
+		// The context never runs out of work, so nothing was run only if the timeout has passed.
+		if (this->m_ioContext.run_one_until(expiry) > 0) {
+			continue;
+		}
+
+		// Closing the socket aborts the operation, whose handler must still run before its state is released.
+		Close();
+
+		while (operation.isDone == false) {
+			this->m_ioContext.run_one();
+		}
+
+		operation.error = boost::asio::error::timed_out;
+	}
+}
+
+boost::system::error_code Connection::WriteBlocking(const RequestSegments& request, uint32_t timeoutMs) {
+	GatherBuffers requestBuffers;
+	requestBuffers.Add(request);
+
+	BlockingOperation operation;
+
+	boost::asio::async_write(this->m_socket, requestBuffers, [&operation](const boost::system::error_code& error, size_t bytes) {
+		operation.Complete(error, bytes);
+	});
+
+	RunBlocking(operation, timeoutMs);
+	RecordTimeout(operation.error);
+
+	return operation.error;
+}
+
+boost::system::error_code Connection::ReadBlocking(void* data, size_t size, size_t& o_bytesRead, uint32_t timeoutMs) {
+	BlockingOperation operation;
+
+	boost::asio::async_read(this->m_socket, boost::asio::buffer(data, size), [&operation](const boost::system::error_code& error, size_t bytes) {
+		operation.Complete(error, bytes);
+	});
+
+	RunBlocking(operation, timeoutMs);
+	RecordTimeout(operation.error);
+
+	o_bytesRead = operation.bytes;
+	return operation.error;
+}
+
+void Connection::RecordTimeout(const boost::system::error_code& error) {
+	// The same as a deadline of the pipelined mode, a stalled server counts against the circuit breaker.
+	if (error == boost::asio::error::timed_out && this->m_breaker.RecordFailure() == true) {
+		StartProbing();
+	}
+}
+
+bool Connection::IsOpen() const {
+	return this->m_socket.is_open();
+}
+
+void Connection::WriteNext() {
+	uint32_t generation = this->m_generation;
+
+	// Holding the frame until the write completes, even if the queue is dropped meanwhile.
+	std::shared_ptr<OutgoingFrame> frame = this->m_writeQueue.front();
+
+	GatherBuffers frameBuffers;
+	frameBuffers.Add(&frame->header, sizeof(frame->header));
+	frameBuffers.Add(frame->payload);
+
+	boost::asio::async_write(this->m_socket, frameBuffers,
+		[this, generation, frame](const boost::system::error_code& error, size_t) {
+			if (generation != this->m_generation) {
+				return;
+			}
+
+			if (error) {
+				FailAll(error);
+				return;
+			}
+
+			this->m_writeQueue.pop_front();
+
+			if (this->m_writeQueue.empty() == false) {
+				WriteNext();
+			}
+		});
+}
+
+void Connection::ReadNextHeader() {
+	uint32_t generation = this->m_generation;
+
+	this->m_isReading = true;
+	this->m_headerBuffer.resize(sizeof(PipelinedResponseHeader));
+
+	// A read is kept outstanding even when idle, so a connection closed by the server is noticed.
+	boost::asio::async_read(this->m_socket, boost::asio::buffer(this->m_headerBuffer),
+		[this, generation](const boost::system::error_code& error, size_t) {
+			if (generation != this->m_generation) {
+				return;
+			}
+
+			if (error) {
+				FailAll(error);
+				return;
+			}
+
+			PipelinedResponseHeader header;
+			if (header.Deserialize(this->m_headerBuffer) != true) {
+				FailAll(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+				return;
+			}
+
+			this->m_serverVersion = header.GetVersion();
+
+			auto found = this->m_pending.find(header.GetRequestId());
+			if (found == this->m_pending.end()) {
+				FailAll(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+				return;
+			}
+
+			PendingRequest pending = found->second;
+			this->m_pending.erase(found);
+
+			// Reading is resumed by the caller, once it has read the payload by itself.
+			if (pending.responseVec == nullptr) {
+				StopDeadline(*pending.deadline);
+				this->m_breaker.RecordSuccess();
+
+				pending.handler(error, header);
+				return;
+			}
+
+			ReadPayload(pending, header);
+		});
+}
+
+void Connection::ReadPayload(PendingRequest pending, PipelinedResponseHeader header) {
+	uint32_t generation = this->m_generation;
+
+	// Laying out the response as the blocking exchange does, without the request ID.
+	std::vector<uint8_t>& responseVec = *pending.responseVec;
+	responseVec.resize(sizeof(BaseResponseHeader) + header.GetPayloadSize());
+	memcpy(responseVec.data(), this->m_headerBuffer.data(), sizeof(BaseResponseHeader));
+
+	boost::asio::async_read(this->m_socket, boost::asio::buffer(responseVec.data() + sizeof(BaseResponseHeader), header.GetPayloadSize()),
+		[this, generation, pending, header](const boost::system::error_code& error, size_t) mutable {
+			StopDeadline(*pending.deadline);
+
+			// This request is no longer pending, so it must be failed here.
+			if (error || generation != this->m_generation) {
+				pending.responseVec->clear();
+				pending.handler(error ? error : boost::asio::error::operation_aborted, header);
+
+				if (generation == this->m_generation) {
+					FailAll(error);
+				}
+				return;
+			}
+
+			this->m_breaker.RecordSuccess();
+
+			pending.handler(error, header);
+			ReadNextHeader();
+		});
+}
+
+void Connection::FailAll(const boost::system::error_code& error) {
+	this->m_generation++;
+	this->m_isConnecting = false;
+	this->m_isReading = false;
+	this->m_writeQueue.clear();
+
+	Close();
+
+	std::unordered_map<requestId_t, PendingRequest> pending;
+	pending.swap(this->m_pending);
+
+	BaseResponseHeader emptyHeader;
+	for (auto& currTuple : pending) {
+		StopDeadline(*currTuple.second.deadline);
+
+		if (currTuple.second.responseVec != nullptr) {
+			currTuple.second.responseVec->clear();
+		}
+		currTuple.second.handler(error, emptyHeader);
+	}
+}
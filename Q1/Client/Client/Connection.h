@@ -0,0 +1,321 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "CircuitBreaker.h"
+#include "Protocol.h"
+
+class Connection;
+
+/**
+	Reads the payload of a single response straight from the socket, in pieces of the reader's choice.
+	Only valid during the call of the consumer it was given to.
+*/
+class PayloadReader {
+public:
+	/**
+		@return	size_t	-	The number of payload bytes not read yet.
+	*/
+	size_t GetRemaining() const { return m_remaining; }
+
+	/**
+		Reads exactly the given number of bytes of the payload.
+
+		@param	data	-	Out parameter for the read bytes.
+		@param	size	-	The number of bytes to read, at most the remaining bytes.
+
+		Throws upon any communication error, or if more than the remaining bytes are requested.
+	*/
+	void Read(void* data, size_t size);
+
+private:
+	friend class Connection;
+
+	PayloadReader(Connection& connection, size_t size, uint32_t generation, uint32_t timeoutMs) :
+		m_connection(connection), m_remaining(size), m_generation(generation), m_timeoutMs(timeoutMs) {}
+
+	// Reads and drops whatever is left, so the next response starts where it should.
+	void Discard();
+
+	Connection& m_connection;
+	size_t m_remaining;
+	uint32_t m_generation;
+	uint32_t m_timeoutMs;
+};
+
+/**
+	This class holds a long-lived connection to the server.
+	The socket is opened on the first request and kept open between requests,
+	so a sequence of requests won't pay for a TCP handshake and a teardown each time.
+
+	A broken connection (e.g. closed by the server after being idle) is
+	re-established transparently on the next request.
+
+	In pipelined mode every request is framed with a request ID, and many requests
+	can be in flight at once. Requests are written and responses are read by
+	a dedicated I/O thread, and each response is matched to its request by its ID,
+	regardless of the order in which the server answers.
+
+	Every request also has a deadline. A request which isn't answered in time means the server
+	has stalled, so the connection is dropped and all its requests fail. Before the connection is pipelined,
+	each write and each read of a request is given the deadline, and the I/O is run by the caller's thread.
+	Connecting has a timeout of its own, and while the server is known to be down
+	requests fail right away, as decided by the circuit breaker, in either mode.
+*/
+class Connection {
+public:
+	// The deadline of a request which isn't given one of its own.
+	static constexpr uint32_t DEFAULT_TIMEOUT_MS = 10 * 1000;
+
+	// Longest a connection attempt may take.
+	static constexpr uint32_t CONNECT_TIMEOUT_MS = 3 * 1000;
+
+	/**
+		Invoked on the I/O thread once a pipelined request has completed.
+		The response vector given with the request is filled only upon success.
+	*/
+	typedef std::function<void(const boost::system::error_code& error, BaseResponseHeader& header)> ResponseHandler;
+
+	// Invoked on the caller's thread to read the payload of a streamed response.
+	typedef std::function<void(PayloadReader& reader)> PayloadConsumer;
+
+	Connection();
+
+	/**
+		A connection run by an io_context it shares with other connections, instead of by an I/O thread of its own.
+		It is always pipelined, and the context must be run by its owner for as long as the connection is used.
+		Before the connection is destroyed it must be shut down, and the context must have run out of work.
+
+		@param	ioContext	-	The shared context.
+	*/
+	explicit Connection(boost::asio::io_context& ioContext);
+
+	~Connection();
+
+	/**
+		Sets the server's endpoint. Any open connection to a previous endpoint is closed.
+
+		@param	ipAddr	-	The server's IP address, already validated by the caller.
+		@param	port	-	The server's port.
+	*/
+	void SetEndpoint(const std::string& ipAddr, uint16_t port);
+
+	/**
+		Switches the connection to pipelined framing, starting the I/O thread.
+		Must be called before the first request is sent.
+	*/
+	void EnablePipelining();
+
+	/**
+		Keeps the connection unpipelined, and switches it to pipelined framing once a response
+		shows the server is of PIPELINED_VERSION or later, so an older server is still understood.
+		Must be called before the first request is sent.
+	*/
+	void EnablePipeliningWhenSupported();
+
+	/**
+		@return	bool	-	True if the connection is pipelined, so requests may be sent without waiting.
+	*/
+	bool IsPipelined() const { return this->m_isPipelined; }
+
+	/**
+		Sends a single request and reads its whole response over the kept-alive socket.
+
+		If the request fails on a reused socket before any byte of the response was read,
+		the server has most likely closed the idle connection, so the request is sent once
+		more over a new connection.
+
+		In pipelined mode the call waits for the matching response, so it must not be
+		called from within a ResponseHandler.
+
+		@param	request		-	The segments of the request, written as a single gather write.
+		@param	o_header	-	Out parameter for the deserialized response header.
+		@param	responseVec	-	Out parameter for the entire response (header and payload).
+		@param	timeoutMs	-	The request's deadline. Before pipelining, that of each write and each read.
+
+		Throws upon any communication error or an invalid response header.
+	*/
+	void Exchange(const RequestSegments& request, BaseResponseHeader& o_header, std::vector<uint8_t>& responseVec,
+		uint32_t timeoutMs = DEFAULT_TIMEOUT_MS);
+
+	/**
+		Sends a single request, and lets the consumer read the response's payload straight from the socket.
+		Only the header is buffered, so the response is never held in memory as a whole.
+
+		In pipelined mode no other response is read until the consumer returns,
+		though other requests are still written meanwhile.
+
+		@param	request		-	The segments of the request, written as a single gather write.
+		@param	o_header	-	Out parameter for the deserialized response header, set before the consumer is invoked.
+		@param	consumer	-	Reads the payload. Whatever it leaves unread is discarded.
+		@param	timeoutMs	-	The deadline of the response header, and of each piece read by the consumer.
+
+		Throws upon any communication error or an invalid response header.
+		An exception thrown by the consumer is passed on once the payload has been discarded.
+	*/
+	void ExchangeStreamed(const RequestSegments& request, BaseResponseHeader& o_header, const PayloadConsumer& consumer,
+		uint32_t timeoutMs = DEFAULT_TIMEOUT_MS);
+
+	/**
+		Queues a request on the pipelined connection and returns immediately.
+		The response is laid out exactly as a response of the blocking Exchange.
+
+		@param	request		-	The segments of the request. Their content is copied, so it may be released right away.
+		@param	responseVec	-	Out parameter for the entire response. Must outlive the handler's call.
+		@param	handler		-	Invoked once the response has been read or the request has failed.
+		@param	timeoutMs	-	The request's deadline.
+	*/
+	void ExchangeAsync(const RequestSegments& request, std::vector<uint8_t>& responseVec, ResponseHandler handler,
+		uint32_t timeoutMs = DEFAULT_TIMEOUT_MS);
+
+	/**
+		Closes the socket if open. The next request shall open a new one.
+	*/
+	void Close();
+
+	/**
+		Fails all the pending requests of a pipelined connection and stops its probing,
+		so the connection no longer keeps its io_context busy. Done by the destructor
+		of a connection with an I/O thread of its own.
+	*/
+	void Shutdown();
+
+	/**
+		@return	uint8_t	-	The version of the server, as of its last response. Zero before any response.
+	*/
+	uint8_t GetServerVersion() const { return this->m_serverVersion; }
+
+private:
+	// A pipelined request waiting to be written. Its payload either points into ownedPayload,
+	// or is borrowed from a caller who is blocked until the frame is released.
+	struct OutgoingFrame {
+		PipelinedRequestHeader header;
+		std::vector<uint8_t> ownedPayload;
+		RequestSegments payload;
+	};
+
+	// A pipelined request waiting for its response.
+	// A streamed request has no response vector, its payload is left for the caller to read.
+	struct PendingRequest {
+		std::vector<uint8_t>* responseVec;
+		ResponseHandler handler;
+		std::shared_ptr<boost::asio::steady_timer> deadline;
+	};
+
+	// An asynchronous operation run on the caller's thread before pipelining, and its outcome.
+	struct BlockingOperation {
+		BlockingOperation() : isDone(false), bytes(0) {}
+
+		void Complete(const boost::system::error_code& operationError, size_t operationBytes) {
+			this->isDone = true;
+			this->error = operationError;
+			this->bytes = operationBytes;
+		}
+
+		bool isDone;
+		boost::system::error_code error;
+		size_t bytes;
+	};
+
+	// Opens the socket if it is not already open, within CONNECT_TIMEOUT_MS. Throws upon failure,
+	// or right away while the circuit breaker is open. Used before pipelining only.
+	void Connect();
+
+	// Runs the context on the caller's thread until the operation is done. If it isn't done in time,
+	// the socket is closed and the operation's error is timed_out. Used before pipelining only.
+	void RunBlocking(BlockingOperation& operation, uint32_t timeoutMs);
+
+	// A write and a read before pipelining, each within the timeout. Return the error, if any.
+	boost::system::error_code WriteBlocking(const RequestSegments& request, uint32_t timeoutMs);
+	boost::system::error_code ReadBlocking(void* data, size_t size, size_t& o_bytesRead, uint32_t timeoutMs);
+
+	// Counts a timed out operation before pipelining against the circuit breaker.
+	void RecordTimeout(const boost::system::error_code& error);
+
+	// Switches to pipelined framing if it is wanted, and the last response shows the server supports it.
+	void UpgradeIfSupported();
+
+	bool IsOpen() const;
+
+	friend class PayloadReader;
+
+	// Writes the request and reads the response header, before pipelining.
+	void ExchangeHeader(const RequestSegments& request, BaseResponseHeader& o_header, std::vector<uint8_t>& responseVec,
+		uint32_t timeoutMs);
+
+	// Reads a piece of a streamed payload. In pipelined mode the read is handed to the I/O thread.
+	void ReadStreamed(void* data, size_t size, uint32_t generation, uint32_t timeoutMs);
+
+	// Invokes the consumer, making sure the whole payload has been read once it returns.
+	void ConsumePayload(const PayloadConsumer& consumer, size_t payloadSize, uint32_t generation, uint32_t timeoutMs);
+
+	/**
+		Makes a frame whose payload is borrowed from the caller's segments, rather than copied.
+		A failed request is completed right away, possibly while its frame is still being written,
+		so the caller must wait for the frame's release before freeing the segments.
+
+		@param	request		-	The request, borrowed until the frame is released.
+		@param	released	-	Set once the I/O thread no longer refers to the frame.
+
+		@return	std::shared_ptr<OutgoingFrame>	-	The frame, to be handed to Enqueue.
+	*/
+	std::shared_ptr<OutgoingFrame> MakeBorrowedFrame(const RequestSegments& request, std::promise<void>& released);
+
+	// Hands a pipelined frame to the I/O thread, which assigns its request ID and queues it.
+	void Enqueue(std::shared_ptr<OutgoingFrame> frame, std::vector<uint8_t>* responseVec, ResponseHandler handler, uint32_t timeoutMs);
+
+	// The following functions run on the I/O thread only. Before pipelining, StartProbing runs on the thread
+	// whose requests run the context.
+	void StartConnect();
+	void StartProbing();
+	void StartDeadline(std::shared_ptr<boost::asio::steady_timer> deadline, uint32_t timeoutMs);
+	static void StopDeadline(boost::asio::steady_timer& deadline);
+	void WriteNext();
+	void ReadNextHeader();
+	void ReadPayload(PendingRequest pending, PipelinedResponseHeader header);
+	void FailAll(const boost::system::error_code& error);
+
+	// Set only if the connection runs its own I/O thread, otherwise the context is shared.
+	std::unique_ptr<boost::asio::io_context> m_ownedIoContext;
+	boost::asio::io_context& m_ioContext;
+
+	boost::asio::ip::tcp::socket m_socket;
+	boost::asio::ip::tcp::endpoint m_endpoint;
+
+	// Pipelining state, owned by the I/O thread.
+	bool m_isPipelined;
+
+	// Set if the connection switches to pipelined framing once the server is known to support it.
+	bool m_isPipeliningWanted;
+	std::thread m_ioThread;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+
+	// Incremented whenever the socket is dropped, so handlers of its operations can tell they are stale.
+	uint32_t m_generation;
+
+	requestId_t m_nextRequestId;
+	bool m_isConnecting;
+	bool m_isReading;
+	bool m_isShuttingDown;
+
+	CircuitBreaker m_breaker;
+	boost::asio::ip::tcp::socket m_probeSocket;
+	boost::asio::steady_timer m_probeTimer;
+
+	std::deque<std::shared_ptr<OutgoingFrame>> m_writeQueue;
+	std::unordered_map<requestId_t, PendingRequest> m_pending;
+	std::vector<uint8_t> m_headerBuffer;
+
+	// Set by every response header, so features of newer servers are used only when available.
+	std::atomic<uint8_t> m_serverVersion;
+};
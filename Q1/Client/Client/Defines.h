@@ -4,11 +4,23 @@
 
 static constexpr uint8_t CLIENT_VERSION = 1;
 
+// Frames of this version carry a request ID, allowing many requests in flight on one connection.
+static constexpr uint8_t PIPELINED_VERSION = 2;
+
+// Requests and responses of X25519 agreement keys are of this version, and are pipelined as well.
+// Servers of an older version don't know them, so they are sent only once the server has answered with this version.
+static constexpr uint8_t KEY_AGREEMENT_VERSION = 3;
+
 static constexpr size_t PUBLIC_KEY_LENGTH = 160;
 static constexpr size_t SYM_KEY_LENGTH = 16;
+static constexpr size_t AGREEMENT_KEY_LENGTH = 32;
 
 // The current RSA encryption uses modulu with 1024 bits,
 // thus the output should be 128 bytes.
 static constexpr size_t ENCRYPTED_SYM_KEY_LENGTH = 128;
 
+// Files are sent in chunks of this many plaintext bytes, so no node holds more than a chunk of a file at once.
+static constexpr size_t FILE_CHUNK_LENGTH = 64 * 1024;
+
 typedef uint8_t publicKey_t[PUBLIC_KEY_LENGTH];
+typedef uint8_t agreementKey_t[AGREEMENT_KEY_LENGTH];
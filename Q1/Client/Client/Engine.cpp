@@ -0,0 +1,328 @@
+#include "Engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+#include "SystemUtils.h"
+
+// Each account's identity is kept in '<account>.info', and its roster in '<account>.state'.
+static constexpr const char* INFO_EXTENSION = ".info";
+static constexpr const char* STATE_EXTENSION = ".state";
+
+// Connections shared by all the accounts. Each is pipelined, so a few are enough for many accounts.
+static constexpr size_t CONNECTION_COUNT = 4;
+
+// Workers mostly wait for the server's responses, so there are several per core.
+static constexpr size_t WORKERS_PER_CORE = 4;
+
+// Every account is polled once per interval, a slice of the accounts per tick.
+static constexpr uint32_t POLL_INTERVAL_MS = 5 * 1000;
+static constexpr uint32_t POLL_TICK_MS = 100;
+
+// Reading commands is held back while this many are waiting to be run.
+static constexpr size_t MAX_PENDING_COMMANDS = 64 * 1024;
+
+Engine::Engine() : m_work(boost::asio::make_work_guard(m_ioContext)), m_pollTimer(m_ioContext),
+					m_pendingCommands(0), m_isStopping(false), m_pollCursor(0), m_pollCredit(0) {}
+
+Engine::~Engine() {
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+		this->m_isStopping = true;
+	}
+
+	boost::asio::post(this->m_ioContext, [this]() { this->m_pollTimer.cancel(); });
+
+	// The I/O thread runs out of work once all the connections have been shut down.
+	for (auto& currConnection : this->m_connections) {
+		currConnection->Shutdown();
+	}
+
+	this->m_work.reset();
+
+	if (this->m_ioThread.joinable() == true) {
+		this->m_ioThread.join();
+	}
+}
+
+bool Engine::Init(const std::string& directory) {
+
+	std::string ipAddr;
+	uint16_t port = 0;
+
+	if (Client::ParseServerInfo(ipAddr, port) == false) {
+		return false;
+	}
+
+	std::vector<std::string> paths = SystemUtils::ListFiles(directory, INFO_EXTENSION);
+
+	if (paths.empty() == true) {
+		std::cout << "No info files found in " << directory << std::endl;
+		return false;
+	}
+
+	size_t connectionCount = std::min(paths.size(), CONNECTION_COUNT);
+
+	for (size_t i = 0; i < connectionCount; i++) {
+		this->m_connections.emplace_back(new Connection(this->m_ioContext));
+		this->m_connections.back()->SetEndpoint(ipAddr, port);
+	}
+
+	// Loading an account sends requests, so the connections must be served by then.
+	this->m_ioThread = std::thread([this]() { this->m_ioContext.run(); });
+
+	this->m_accounts.reserve(paths.size());
+
+	for (const std::string& path : paths) {
+		std::string name = std::filesystem::path(path).stem().string();
+		std::string statePath = path.substr(0, path.size() - strlen(INFO_EXTENSION)) + STATE_EXTENSION;
+
+		// The accounts are spread evenly over the connections.
+		Connection& connection = *this->m_connections[this->m_accounts.size() % connectionCount];
+		std::unique_ptr<Client> client(new Client(path, statePath, connection, this->m_bufferPool));
+
+		if (client->Init() == false) {
+			std::cout << "Failed loading " << path << std::endl;
+			continue;
+		}
+
+		this->m_accountsByName[name] = this->m_accounts.size();
+		this->m_accounts.emplace_back(new Account(name, std::move(client)));
+	}
+
+	return this->m_accounts.empty() == false;
+}
+
+void Engine::Run(std::istream& commands) {
+
+	// The results go where std::cout writes, while anything the clients print goes to the standard error.
+	this->m_results.reset(new std::ostream(std::cout.rdbuf()));
+	std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	boost::asio::post(this->m_ioContext, [this]() { StartPollTimer(); });
+
+	size_t workerCount = std::max<size_t>(std::thread::hardware_concurrency(), 1) * WORKERS_PER_CORE;
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < workerCount; i++) {
+		workers.emplace_back(&Engine::Work, this);
+	}
+
+	std::string line;
+	uint64_t lineNumber = 0;
+
+	while (std::getline(commands, line).fail() == false) {
+
+		lineNumber++;
+
+		std::istringstream args(line);
+		std::string accountName;
+
+		// Blank lines and comments are skipped.
+		if ((args >> accountName).fail() == true || accountName[0] == '#') {
+			continue;
+		}
+
+		if (accountName == "exit") {
+			break;
+		}
+
+		auto found = this->m_accountsByName.find(accountName);
+
+		if (found == this->m_accountsByName.end()) {
+			JsonObject result;
+			result.AddString("account", accountName).AddNumber("line", lineNumber);
+			result.AddString("status", "error").AddString("error", "Unknown account");
+
+			WriteResult(result);
+			continue;
+		}
+
+		// The command is the rest of the line.
+		PendingCommand command;
+		command.lineNumber = lineNumber;
+		std::getline(args >> std::ws, command.line);
+
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+
+		// A long script isn't read into memory at once.
+		this->m_drained.wait(lock, [this]() { return this->m_pendingCommands < MAX_PENDING_COMMANDS; });
+
+		this->m_accounts[found->second]->commands.push_back(std::move(command));
+		this->m_pendingCommands++;
+
+		Schedule(found->second);
+	}
+
+	// Stopping only once every command has been run. Polls still waiting their turn are run as well.
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		this->m_drained.wait(lock, [this]() { return this->m_pendingCommands == 0; });
+
+		this->m_isStopping = true;
+		this->m_scheduled.notify_all();
+	}
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	boost::asio::post(this->m_ioContext, [this]() { this->m_pollTimer.cancel(); });
+
+	std::cout.rdbuf(stdoutBuffer);
+	this->m_results->flush();
+}
+
+void Engine::Schedule(size_t accountIndex) {
+	Account& account = *this->m_accounts[accountIndex];
+
+	if (account.isScheduled == true) {
+		return;
+	}
+
+	account.isScheduled = true;
+	this->m_runQueue.push_back(accountIndex);
+	this->m_scheduled.notify_one();
+}
+
+void Engine::Work() {
+
+	while (true) {
+		size_t accountIndex = 0;
+		PendingCommand command;
+		bool isPoll = false;
+
+		{
+			std::unique_lock<std::mutex> lock(this->m_mutex);
+			this->m_scheduled.wait(lock, [this]() { return this->m_runQueue.empty() == false || this->m_isStopping == true; });
+
+			if (this->m_runQueue.empty() == true) {
+				return;
+			}
+
+			accountIndex = this->m_runQueue.front();
+			this->m_runQueue.pop_front();
+
+			Account& account = *this->m_accounts[accountIndex];
+
+			// A due poll goes first, so an account with many commands still receives its messages.
+			isPoll = account.isPollDue == true || account.commands.empty() == true;
+
+			if (isPoll == true) {
+				account.isPollDue = false;
+			}
+			else {
+				command = std::move(account.commands.front());
+				account.commands.pop_front();
+			}
+		}
+
+		Account& account = *this->m_accounts[accountIndex];
+		bool isMorePending = RunTurn(account, command, isPoll);
+
+		bool isIdle = false;
+
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex);
+
+			if (isPoll == false) {
+				this->m_pendingCommands--;
+				this->m_drained.notify_all();
+			}
+
+			// Back to the end of the run queue, behind every other account waiting its turn.
+			account.isScheduled = false;
+
+			// The rest of the waiting messages are fetched by the account's next turns, a page per turn.
+			if (isMorePending == true) {
+				account.isPollDue = true;
+			}
+
+			if (account.commands.empty() == false || account.isPollDue == true) {
+				Schedule(accountIndex);
+			}
+
+			isIdle = this->m_runQueue.empty();
+		}
+
+		// The results are flushed only once no more turns are waiting.
+		if (isIdle == true) {
+			std::lock_guard<std::mutex> lock(this->m_resultsMutex);
+			this->m_results->flush();
+		}
+	}
+}
+
+bool Engine::RunTurn(Account& account, const PendingCommand& command, bool isPoll) {
+
+	JsonObject result;
+	result.AddString("account", account.name);
+
+	if (isPoll == true) {
+		result.AddString("command", "poll");
+
+		bool isMorePending = false;
+
+		if (account.client->Poll(result, isMorePending) == true) {
+			WriteResult(result);
+		}
+
+		return isMorePending;
+	}
+
+	std::istringstream args(command.line);
+	std::string commandName;
+	args >> commandName;
+
+	result.AddNumber("line", command.lineNumber).AddString("command", commandName);
+
+	account.client->RunCommand(commandName, args, result);
+
+	WriteResult(result);
+
+	return false;
+}
+
+void Engine::StartPollTimer() {
+
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		if (this->m_isStopping == true) {
+			return;
+		}
+
+		// A tick's share of the polls is carried over until it adds up to whole polls, so every account
+		// is polled once per interval, even when there are fewer accounts than ticks per interval.
+		size_t accountCount = this->m_accounts.size();
+
+		this->m_pollCredit += accountCount * POLL_TICK_MS;
+		size_t sliceSize = this->m_pollCredit / POLL_INTERVAL_MS;
+		this->m_pollCredit %= POLL_INTERVAL_MS;
+
+		for (size_t i = 0; i < sliceSize; i++) {
+			this->m_accounts[this->m_pollCursor]->isPollDue = true;
+			Schedule(this->m_pollCursor);
+
+			this->m_pollCursor = (this->m_pollCursor + 1) % accountCount;
+		}
+	}
+
+	this->m_pollTimer.expires_after(std::chrono::milliseconds(POLL_TICK_MS));
+	this->m_pollTimer.async_wait([this](const boost::system::error_code& error) {
+		if (!error) {
+			StartPollTimer();
+		}
+	});
+}
+
+void Engine::WriteResult(const JsonObject& result) {
+	std::string line = result.ToString();
+
+	std::lock_guard<std::mutex> lock(this->m_resultsMutex);
+	*this->m_results << line << '\n';
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "BufferPool.h"
+#include "Client.h"
+#include "Connection.h"
+
+/**
+	This class hosts many identities in a single process, each loaded from an info file of its own.
+
+	The identities share a single io_context, run by a single I/O thread, a small pool of pipelined
+	connections, and a pool of receive buffers. Each identity is left with its roster and its keys,
+	and its private key is parsed only once used.
+
+	The accounts are run by a pool of workers, one per core. An account with work to do waits its turn
+	in a single run queue, and is given a single command or poll per turn, so a busy account can't
+	starve the others. An account is run by a single worker at a time, so its commands keep their order.
+	Waiting messages are polled for every account in turn, spread evenly over the poll interval.
+	A poll fetches a single page, read whole before it is decrypted, and the rest wait for the account's next turns.
+
+	The shared connections are pipelined from the start, so the server must be of PIPELINED_VERSION or later.
+*/
+class Engine {
+public:
+	Engine();
+	~Engine();
+
+	/**
+		Loads every '<account>.info' file in a directory, in the format of 'me.info'.
+		Each account's roster is kept next to its info file, in '<account>.state'.
+		The server is given by 'server.info', the same as for a single client.
+
+		@param	directory	-	The directory of the info files.
+
+		@return	bool	-	True if the server info is valid and any account has been loaded, false otherwise.
+	*/
+	bool Init(const std::string& directory);
+
+	/**
+		Runs commands of the batch mode, one per line, each led by the name of the account it is run by:
+			<account> <command> <arguments>
+		Blank lines and lines starting with '#' are skipped, and an exit line stops reading.
+		Meanwhile, the accounts are polled for waiting messages.
+
+		Results are written as JSON lines, the same as by the batch mode, led by the account's name.
+		A poll is reported only if it has received any message or has failed. Anything the clients
+		would print goes to the standard error, as the clients print from many threads at once.
+
+		Returns once the commands have ended and all of them have been run.
+
+		@param	commands	-	The stream the commands are read from.
+	*/
+	void Run(std::istream& commands);
+
+private:
+	// A command waiting for its account's turn.
+	struct PendingCommand {
+		uint64_t lineNumber;
+		std::string line;
+	};
+
+	struct Account {
+		Account(const std::string& accountName, std::unique_ptr<Client> accountClient) :
+			name(accountName), client(std::move(accountClient)), isScheduled(false), isPollDue(false) {}
+
+		std::string name;
+		std::unique_ptr<Client> client;
+
+		// The following fields are guarded by the engine's mutex.
+		std::deque<PendingCommand> commands;
+
+		// Set while the account is in the run queue or being run.
+		bool isScheduled;
+		bool isPollDue;
+	};
+
+	/**
+		Puts an account at the end of the run queue, unless it is already there or being run.
+		The engine's mutex must be held.
+	*/
+	void Schedule(size_t accountIndex);
+
+	/**
+		Runs the accounts in the run queue, a single turn at a time, until the engine is stopped.
+	*/
+	void Work();
+
+	/**
+		Runs a single turn of an account, which is either its next command or a poll.
+
+		@param	account	-	The account, taken out of the run queue.
+		@param	command	-	The command to be run, if the turn isn't a poll.
+		@param	isPoll	-	True if the turn is a poll.
+
+		@return	bool	-	True if the poll has left messages on the server, so another poll is due right away.
+	*/
+	bool RunTurn(Account& account, const PendingCommand& command, bool isPoll);
+
+	/**
+		Marks the next slice of accounts as due for a poll, and sets the timer for the next slice.
+		Runs on the I/O thread.
+	*/
+	void StartPollTimer();
+
+	void WriteResult(const JsonObject& result);
+
+	boost::asio::io_context m_ioContext;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+	std::thread m_ioThread;
+	boost::asio::steady_timer m_pollTimer;
+
+	// Declared before the accounts, so the clients are destroyed before what they borrow.
+	std::vector<std::unique_ptr<Connection>> m_connections;
+	BufferPool m_bufferPool;
+
+	std::vector<std::unique_ptr<Account>> m_accounts;
+	std::unordered_map<std::string, size_t> m_accountsByName;
+
+	// Guards the run queue and the accounts' pending work.
+	std::mutex m_mutex;
+	std::condition_variable m_scheduled;
+	std::condition_variable m_drained;
+	std::deque<size_t> m_runQueue;
+	size_t m_pendingCommands;
+	bool m_isStopping;
+
+	// The next account to be marked due for a poll, and the share of a poll carried over from the previous ticks,
+	// in accounts times milliseconds. Used by the I/O thread only.
+	size_t m_pollCursor;
+	size_t m_pollCredit;
+
+	std::mutex m_resultsMutex;
+	std::unique_ptr<std::ostream> m_results;
+};
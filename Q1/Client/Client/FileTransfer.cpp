@@ -0,0 +1,192 @@
+#include "FileTransfer.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "AESWrapper.h"
+#include "SystemUtils.h"
+
+static constexpr const char* TRANSFER_STATE_SUFFIX = ".transfer";
+static constexpr const char* PART_FILE_SUFFIX = ".part";
+
+// The chunks of a received file which have been written, a bit per chunk, kept next to its part file.
+static constexpr const char* RECEIVED_SUFFIX = ".received";
+
+// Longest file name accepted from a sender.
+static constexpr size_t MAX_FILE_NAME_LENGTH = 255;
+
+OutgoingTransfer::OutgoingTransfer(const std::string& path, const std::string& friendName, uint64_t fileSize) :
+	m_statePath(path + TRANSFER_STATE_SUFFIX), m_friendName(friendName), m_fileSize(fileSize),
+	m_transferId(0), m_nextSequence(0) {
+
+	// The name takes the first chunk.
+	this->m_chunkCount = (uint32_t)(1 + (fileSize + FILE_CHUNK_LENGTH - 1) / FILE_CHUNK_LENGTH);
+
+	std::ifstream stateFile(this->m_statePath);
+	std::string savedName;
+	uint64_t savedSize = 0;
+
+	if (stateFile >> savedName >> this->m_transferId >> this->m_nextSequence >> savedSize &&
+		savedName == friendName &&
+		savedSize == fileSize &&
+		this->m_nextSequence <= this->m_chunkCount) {
+		return;
+	}
+
+	// Nothing to resume, starting over.
+	AESWrapper::GenerateKey((unsigned char*)&this->m_transferId, sizeof(this->m_transferId));
+	this->m_nextSequence = 0;
+}
+
+uint64_t OutgoingTransfer::GetTransferId() const {
+	return this->m_transferId;
+}
+
+uint32_t OutgoingTransfer::GetNextSequence() const {
+	return this->m_nextSequence;
+}
+
+uint32_t OutgoingTransfer::GetChunkCount() const {
+	return this->m_chunkCount;
+}
+
+bool OutgoingTransfer::IsDone() const {
+	return this->m_nextSequence == this->m_chunkCount;
+}
+
+bool OutgoingTransfer::Advance() {
+	this->m_nextSequence++;
+
+	if (IsDone() == true) {
+		std::remove(this->m_statePath.c_str());
+		return true;
+	}
+
+	std::ofstream stateFile(this->m_statePath, std::ios::trunc);
+	stateFile << this->m_friendName << " " << this->m_transferId << " " << this->m_nextSequence << " " << this->m_fileSize << std::endl;
+
+	return stateFile.good();
+}
+
+/**
+	Marks a chunk of a received file as written, so a file missing a chunk is never reported as received,
+	even if the client was restarted during the transfer.
+
+	@param	receivedPath	-	The path of the transfer's received chunks.
+	@param	sequence		-	The chunk which has been written.
+	@param	chunkCount		-	The number of chunks in the file.
+	@param	o_isComplete	-	Out parameter, set if all the chunks have been written.
+
+	@return	bool	-	True if the chunk has been marked, false otherwise.
+*/
+static bool MarkReceived(const std::string& receivedPath, uint32_t sequence, uint32_t chunkCount, bool& o_isComplete) {
+	std::vector<char> received(((size_t)chunkCount + 7) / 8, 0);
+
+	// Missing if this is the first chunk written, and then no chunk has been marked yet.
+	std::ifstream receivedIn(receivedPath, std::ios::binary);
+	if (receivedIn.is_open() == true) {
+		receivedIn.read(received.data(), received.size());
+		receivedIn.close();
+	}
+
+	received[sequence / 8] |= (char)(1 << (sequence % 8));
+
+	std::ofstream receivedOut(receivedPath, std::ios::binary | std::ios::trunc);
+	receivedOut.write(received.data(), received.size());
+
+	if (receivedOut.good() == false) {
+		return false;
+	}
+
+	o_isComplete = true;
+
+	for (uint32_t i = 0; i < chunkCount && o_isComplete == true; i++) {
+		o_isComplete = (received[i / 8] & (1 << (i % 8))) != 0;
+	}
+
+	return true;
+}
+
+bool IncomingTransfers::HandleChunk(const FileChunkHeader& header, const std::string& plain, std::string& o_path) {
+
+	if (header.sequence >= header.chunkCount ||
+		plain.size() > FILE_CHUNK_LENGTH) {
+		return false;
+	}
+
+	std::ostringstream partStream;
+	partStream << "transfer_" << std::hex << std::setw(16) << std::setfill('0') << header.transferId;
+
+	std::string receivedPath = partStream.str();
+	std::string partPath = receivedPath + PART_FILE_SUFFIX;
+	std::string receivedChunksPath = partPath + RECEIVED_SUFFIX;
+
+	if (header.sequence == 0) {
+		// Keeping only the last path component, so the sender can't choose where the file is written.
+		size_t lastSeparator = plain.find_last_of("/\\:");
+		std::string name = lastSeparator == std::string::npos ? plain : plain.substr(lastSeparator + 1);
+
+		if (name.empty() == false && name != "." && name != ".." &&
+			name.size() <= MAX_FILE_NAME_LENGTH && name.find('\0') == std::string::npos) {
+			this->m_names[header.transferId] = name;
+		}
+	}
+
+	// Creating the file on its first chunk, so even an empty file is received.
+	if (SystemUtils::IsFileExists(partPath) == false) {
+		std::ofstream partFile(partPath, std::ios::binary);
+
+		if (partFile.is_open() == false) {
+			return false;
+		}
+	}
+
+	if (header.sequence != 0) {
+		std::fstream partFile(partPath, std::ios::binary | std::ios::in | std::ios::out);
+
+		if (partFile.is_open() == false) {
+			return false;
+		}
+
+		partFile.seekp((std::streamoff)(header.sequence - 1) * FILE_CHUNK_LENGTH);
+		partFile.write(plain.data(), plain.size());
+
+		if (partFile.good() == false) {
+			return false;
+		}
+	}
+
+	// A chunk lost on the way (e.g. one which failed decrypting) leaves a hole, so the file isn't received until it is sent again.
+	bool isComplete = false;
+
+	if (MarkReceived(receivedChunksPath, header.sequence, header.chunkCount, isComplete) != true) {
+		return false;
+	}
+
+	if (isComplete == false) {
+		return true;
+	}
+
+	// The name is unknown if the client was restarted during the transfer, and an existing file is never overwritten.
+	auto found = this->m_names.find(header.transferId);
+
+	if (found != this->m_names.end() && SystemUtils::IsFileExists(found->second) == false) {
+		receivedPath = found->second;
+	}
+
+	if (found != this->m_names.end()) {
+		this->m_names.erase(found);
+	}
+
+	if (std::rename(partPath.c_str(), receivedPath.c_str()) != 0) {
+		return false;
+	}
+
+	std::remove(receivedChunksPath.c_str());
+
+	o_path = receivedPath;
+	return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "Defines.h"
+#include "MessageBodies.h"
+
+/**
+	This class keeps track of a file being sent, so an interrupted transfer is resumed
+	from the last chunk acknowledged by the server rather than from the start.
+
+	The progress is saved next to the file, in '<path>.transfer', after every acknowledged chunk.
+*/
+class OutgoingTransfer {
+public:
+	/**
+		Resumes the previous transfer of the same file to the same friend, if any was interrupted.
+		Otherwise a new transfer is started, with a new random ID.
+
+		@param	path		-	The path of the file to be sent.
+		@param	friendName	-	The name of the friend the file is sent to.
+		@param	fileSize	-	The size of the file, so a file changed meanwhile is sent from the start.
+	*/
+	OutgoingTransfer(const std::string& path, const std::string& friendName, uint64_t fileSize);
+
+	uint64_t GetTransferId() const;
+	uint32_t GetNextSequence() const;
+	uint32_t GetChunkCount() const;
+
+	/**
+		@return	bool	-	True if all the chunks have been acknowledged.
+	*/
+	bool IsDone() const;
+
+	/**
+		Marks the next chunk as acknowledged, and saves the progress.
+		Once all chunks are acknowledged the saved progress is removed.
+
+		@return	bool	-	True if the progress has been saved, false otherwise.
+	*/
+	bool Advance();
+
+private:
+	std::string m_statePath;
+	std::string m_friendName;
+	uint64_t m_fileSize;
+
+	uint64_t m_transferId;
+	uint32_t m_nextSequence;
+	uint32_t m_chunkCount;
+};
+
+/**
+	This class reassembles received files on disk, one chunk at a time.
+
+	Each chunk is written at its own offset in 'transfer_<ID>.part', so a chunk received twice
+	(e.g. sent again after an interrupted transfer) is harmless. The written chunks are marked in
+	'transfer_<ID>.part.received', and once all of them are written the file is renamed to the name
+	given by the sender, so a file missing a chunk is never reported as received.
+*/
+class IncomingTransfers {
+public:
+	/**
+		@param	header		-	The header of the received chunk.
+		@param	plain		-	The decrypted chunk.
+		@param	o_path		-	Out parameter for the path of the received file, set once the last chunk is written.
+
+		@return	bool	-	True if the chunk is valid and has been written, false otherwise.
+	*/
+	bool HandleChunk(const FileChunkHeader& header, const std::string& plain, std::string& o_path);
+
+private:
+	// The names given by senders to the files currently being received.
+	std::unordered_map<uint64_t, std::string> m_names;
+};
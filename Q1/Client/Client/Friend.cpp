@@ -1,17 +1,65 @@
 #include "Friend.h"
 
-Friend::Friend() : m_isInit(false), m_publicKey(nullptr), m_symkey(nullptr) {}
+#include <string.h>
+
+#include <utility>
+
+Friend::Friend(FriendKeys& keys) : m_isInit(false), m_isChanged(false), m_hasPublicKey(false), m_rawPublicKey(), m_hasAgreementKey(false), m_rawAgreementKey(),
+					m_keys(&keys), m_publicKey(ObjectPool<RSAPublicWrapper>::NO_HANDLE), m_symkey(ObjectPool<AESWrapper>::NO_HANDLE), m_agreedKey(ObjectPool<AESWrapper>::NO_HANDLE) {}
 
 Friend::~Friend() {
-	if (this->m_publicKey) {
-		delete this->m_publicKey;
-		this->m_publicKey = nullptr;
-	}
+	Release();
+}
+
+Friend::Friend(Friend&& other) : m_keys(other.m_keys), m_publicKey(ObjectPool<RSAPublicWrapper>::NO_HANDLE), m_symkey(ObjectPool<AESWrapper>::NO_HANDLE), m_agreedKey(ObjectPool<AESWrapper>::NO_HANDLE) {
+	*this = std::move(other);
+}
 
-	if (this->m_symkey) {
-		delete this->m_symkey;
-		this->m_symkey = nullptr;
+Friend& Friend::operator=(Friend&& other) {
+	if (this == &other) {
+		return *this;
 	}
+
+	Release();
+
+	this->m_isInit = other.m_isInit;
+	this->m_isChanged = other.m_isChanged;
+	this->m_uuid = other.m_uuid;
+	this->m_name = other.m_name;
+
+	this->m_hasPublicKey = other.m_hasPublicKey;
+	memcpy(this->m_rawPublicKey, other.m_rawPublicKey, sizeof(publicKey_t));
+
+	this->m_hasAgreementKey = other.m_hasAgreementKey;
+	memcpy(this->m_rawAgreementKey, other.m_rawAgreementKey, sizeof(agreementKey_t));
+
+	// The wrappers are handed over, along with the pools they belong to.
+	this->m_keys = other.m_keys;
+	this->m_publicKey = other.m_publicKey;
+	this->m_symkey = other.m_symkey;
+	this->m_agreedKey = other.m_agreedKey;
+
+	other.m_publicKey = ObjectPool<RSAPublicWrapper>::NO_HANDLE;
+	other.m_symkey = ObjectPool<AESWrapper>::NO_HANDLE;
+	other.m_agreedKey = ObjectPool<AESWrapper>::NO_HANDLE;
+
+	return *this;
+}
+
+void Friend::DetachKeys() {
+	this->m_publicKey = ObjectPool<RSAPublicWrapper>::NO_HANDLE;
+	this->m_symkey = ObjectPool<AESWrapper>::NO_HANDLE;
+	this->m_agreedKey = ObjectPool<AESWrapper>::NO_HANDLE;
+}
+
+void Friend::Release() {
+	this->m_keys->publicKeys.Destroy(this->m_publicKey);
+	this->m_keys->symKeys.Destroy(this->m_symkey);
+	this->m_keys->symKeys.Destroy(this->m_agreedKey);
+
+	this->m_publicKey = ObjectPool<RSAPublicWrapper>::NO_HANDLE;
+	this->m_symkey = ObjectPool<AESWrapper>::NO_HANDLE;
+	this->m_agreedKey = ObjectPool<AESWrapper>::NO_HANDLE;
 }
 
 bool Friend::Init(const std::string name, const uuid_t uuid) {
@@ -28,12 +76,13 @@ bool Friend::Init(const std::string name, const uuid_t uuid) {
 	}
 
 	this->m_isInit = true;
+	this->m_isChanged = true;
 
 	return true;
 }
 
 bool Friend::HasSym() const {
-	return this->m_symkey != nullptr;
+	return this->m_symkey != ObjectPool<AESWrapper>::NO_HANDLE;
 }
 
 bool Friend::IsUuidEqual(const uuid_t &otherUuid) const {
@@ -41,10 +90,14 @@ bool Friend::IsUuidEqual(const uuid_t &otherUuid) const {
 }
 
 bool Friend::HasPublic() const {
-	return this->m_publicKey != nullptr;
+	return this->m_hasPublicKey;
 }
 
-bool Friend::GetUuid(uuid_t o_uuidBuff) { 
+bool Friend::HasAgreement() const {
+	return this->m_hasAgreementKey;
+}
+
+bool Friend::GetUuid(uuid_t o_uuidBuff) const { 
 	return this->m_uuid.Serialize(o_uuidBuff, sizeof(uuid_t));
 }
 
@@ -58,32 +111,83 @@ std::string Friend::GetName() const {
 
 RSAPublicWrapper* Friend::GetPublicKey() { 
 
-	return this->m_publicKey;
+	if (this->m_publicKey == ObjectPool<RSAPublicWrapper>::NO_HANDLE && this->m_hasPublicKey == true) {
+		this->m_publicKey = this->m_keys->publicKeys.Create((char*)this->m_rawPublicKey, sizeof(publicKey_t));
+	}
+
+	return this->m_keys->publicKeys.Get(this->m_publicKey);
 }
 
 AESWrapper* Friend::GetSymKey() { 
 	
-	if (this->m_symkey != nullptr) {
-		return this->m_symkey;
+	if (this->m_symkey == ObjectPool<AESWrapper>::NO_HANDLE) {
+		this->m_symkey = this->m_keys->symKeys.Create();
+		this->m_isChanged = true;
 	}
 
-	this->m_symkey = new AESWrapper();
-	
-	return this->m_symkey;
+	return this->m_keys->symKeys.Get(this->m_symkey);
+}
+
+AESWrapper* Friend::GetAgreedKey(const X25519Wrapper& own) {
+
+	if (this->m_agreedKey == ObjectPool<AESWrapper>::NO_HANDLE && this->m_hasAgreementKey == true) {
+		unsigned char key[X25519Wrapper::AGREED_KEYLENGTH];
+		own.deriveKey(this->m_rawAgreementKey, sizeof(agreementKey_t), key, sizeof(key));
+
+		this->m_agreedKey = this->m_keys->symKeys.Create(key, sizeof(key));
+		memset(key, 0, sizeof(key));
+	}
+
+	return this->m_keys->symKeys.Get(this->m_agreedKey);
 }
 
 void Friend::SetPublicKey(const publicKey_t key) {
-	if (this->m_publicKey != nullptr) {
+	if (this->m_hasPublicKey == true) {
 		return;
 	}
 
-	this->m_publicKey = new RSAPublicWrapper((char*)key, sizeof(publicKey_t));
+	memcpy(this->m_rawPublicKey, key, sizeof(publicKey_t));
+	this->m_hasPublicKey = true;
+	this->m_isChanged = true;
 }
 
 void Friend::SetSymKey(const unsigned char* key, size_t keyLen) {
-	if (this->m_symkey != nullptr) {
+	if (this->m_symkey != ObjectPool<AESWrapper>::NO_HANDLE) {
 		return;
 	}
 
-	this->m_symkey = new AESWrapper(key, keyLen);
+	this->m_symkey = this->m_keys->symKeys.Create(key, keyLen);
+	this->m_isChanged = true;
+}
+
+bool Friend::SetAgreementKey(const agreementKey_t key) {
+	if (this->m_hasAgreementKey == true) {
+		return memcmp(this->m_rawAgreementKey, key, sizeof(agreementKey_t)) == 0;
+	}
+
+	memcpy(this->m_rawAgreementKey, key, sizeof(agreementKey_t));
+	this->m_hasAgreementKey = true;
+	this->m_isChanged = true;
+
+	return true;
+}
+
+const uint8_t* Friend::GetRawPublicKey() const {
+	return this->m_hasPublicKey == true ? this->m_rawPublicKey : nullptr;
+}
+
+const unsigned char* Friend::GetRawSymKey() const {
+	return this->m_symkey != ObjectPool<AESWrapper>::NO_HANDLE ? this->m_keys->symKeys.Get(this->m_symkey)->getKey() : nullptr;
+}
+
+const uint8_t* Friend::GetRawAgreementKey() const {
+	return this->m_hasAgreementKey == true ? this->m_rawAgreementKey : nullptr;
+}
+
+bool Friend::IsChanged() const {
+	return this->m_isChanged;
+}
+
+void Friend::ClearChanged() {
+	this->m_isChanged = false;
 }
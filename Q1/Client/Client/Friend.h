@@ -4,9 +4,19 @@
 
 #include "Defines.h"
 #include "Validators.h"
+#include "ObjectPool.h"
 
 #include "RSAWrapper.h"
 #include "AESWrapper.h"
+#include "X25519Wrapper.h"
+
+/**
+	The pools the friends' key wrappers are created in, shared by all the friends of a roster.
+*/
+struct FriendKeys {
+	ObjectPool<RSAPublicWrapper> publicKeys;
+	ObjectPool<AESWrapper> symKeys;
+};
 
 /**
 	This class intented to help handling the other clients' data.
@@ -18,9 +28,16 @@
 class Friend {
 public:
 	
-	Friend();
+	/**
+		@param	keys	-	The pools the friend's key wrappers are created in, which must outlive the friend.
+	*/
+	explicit Friend(FriendKeys& keys);
 	~Friend();
 
+	// A friend owns its key wrappers, so it may be moved but never copied.
+	Friend(Friend&& other);
+	Friend& operator=(Friend&& other);
+
 	/**
 		This function initializes the given client with a name and a uuid.
 		If any of the fields is invalid, the function shall fail.
@@ -45,6 +62,11 @@ public:
 	*/
 	bool HasPublic() const;
 
+	/**
+		@return	bool	-	True if the client has an agreement key saved, false otherwise.
+	*/
+	bool HasAgreement() const;
+
 	/**
 		This function compares a given UUID to the client's UUID. 
 	
@@ -61,7 +83,7 @@ public:
 
 		@return	bool	-	True upon success, false otherwise.
 	*/
-	bool GetUuid(uuid_t o_uuidBuff);
+	bool GetUuid(uuid_t o_uuidBuff) const;
 
 	/**
 		This function gets the client's name as a string.
@@ -71,7 +93,10 @@ public:
 	std::string GetName() const;
 
 	/**
-		@return RSAPublicWrapper	-	A pointer to the client's RSAPublicWrapper
+		The public key is parsed on first use, since most friends never get a key sent to them.
+		Throws if the saved key is invalid.
+
+		@return RSAPublicWrapper	-	A pointer to the client's RSAPublicWrapper, nullptr if no key is saved.
 	*/
 	RSAPublicWrapper* GetPublicKey();
 
@@ -79,9 +104,20 @@ public:
 		@return AESWrapper	-	A pointer to the client's AESWrapper
 	*/
 	AESWrapper* GetSymKey();
+
+	/**
+		The key agreed with the client is derived on first use, and kept for the following messages.
+		Throws if the client's agreement key is invalid.
+
+		@param	own	-	The user's own agreement key pair.
+
+		@return AESWrapper	-	A pointer to the agreed key, nullptr if the client has no agreement key.
+	*/
+	AESWrapper* GetAgreedKey(const X25519Wrapper& own);
 	
 	/**
 		This function updates the client's public key.
+		Only the raw key is kept, until it is used.
 
 		@param	key	-	The key to use as the public key.
 	*/
@@ -95,15 +131,76 @@ public:
 	*/
 	void SetSymKey(const unsigned char* key, size_t keyLen);
 
+	/**
+		This function updates the client's agreement key.
+		Since the server won't let a client replace its key, a different key than the saved one is refused.
+
+		@param	key	-	The client's X25519 public key.
+
+		@return	bool	-	True if the key is the client's key from now on, false otherwise.
+	*/
+	bool SetAgreementKey(const agreementKey_t key);
+
+	/**
+		@return	uint8_t*	-	The public key as received, nullptr if none is saved.
+	*/
+	const uint8_t* GetRawPublicKey() const;
+
+	/**
+		@return	unsigned char*	-	The symetric key, nullptr if none is set. Unlike GetSymKey, a key is never created.
+	*/
+	const unsigned char* GetRawSymKey() const;
+
+	/**
+		@return	uint8_t*	-	The agreement key as received, nullptr if none is saved.
+	*/
+	const uint8_t* GetRawAgreementKey() const;
+
+	/**
+		@return	bool	-	True if the friend or any of its keys has changed since last saved, false otherwise.
+	*/
+	bool IsChanged() const;
+
+	/**
+		Marks the friend as saved.
+	*/
+	void ClearChanged();
+
+	/**
+		Forgets the friend's key wrappers without returning them to their pools.
+		Only for when the pools are about to be destroyed, which destroys the wrappers along with them.
+	*/
+	void DetachKeys();
+
 private:
+	Friend(const Friend& other);
+	Friend& operator=(const Friend& other);
+
+	// Returns the key wrappers to their pools.
+	void Release();
+
 	// An indicator to make sure no re-initializtion is made, and data is read only when initialized.
 	bool m_isInit;
 
+	// Set whenever the friend is initialized or gets a key, so only changed friends are saved.
+	bool m_isChanged;
+
 	// The client's UUID and name.
 	UUID m_uuid;
 	Name m_name;
 
-	// The client's key wrappers.
-	RSAPublicWrapper *m_publicKey;
-	AESWrapper *m_symkey;
+	// The client's public key as received, valid only if set.
+	bool m_hasPublicKey;
+	publicKey_t m_rawPublicKey;
+
+	// The client's agreement key as received, valid only if set.
+	bool m_hasAgreementKey;
+	agreementKey_t m_rawAgreementKey;
+
+	FriendKeys* m_keys;
+
+	// The client's key wrappers in m_keys. The public one and the agreed one are created on first use.
+	ObjectPool<RSAPublicWrapper>::Handle m_publicKey;
+	ObjectPool<AESWrapper>::Handle m_symkey;
+	ObjectPool<AESWrapper>::Handle m_agreedKey;
 };
@@ -0,0 +1,176 @@
+#include "JsonObject.h"
+
+JsonObject::JsonObject() : m_json("{") {}
+
+JsonObject& JsonObject::AddString(const std::string& key, const std::string& value) {
+	AddKey(key);
+	AppendString(value, this->m_json);
+
+	return *this;
+}
+
+JsonObject& JsonObject::AddNumber(const std::string& key, uint64_t value) {
+	AddKey(key);
+	this->m_json += std::to_string(value);
+
+	return *this;
+}
+
+JsonObject& JsonObject::AddStrings(const std::string& key, const std::vector<std::string>& values) {
+	AddKey(key);
+	this->m_json += '[';
+
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i > 0) {
+			this->m_json += ',';
+		}
+
+		AppendString(values[i], this->m_json);
+	}
+
+	this->m_json += ']';
+
+	return *this;
+}
+
+JsonObject& JsonObject::AddObjects(const std::string& key, const std::vector<JsonObject>& values) {
+	AddKey(key);
+	this->m_json += '[';
+
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i > 0) {
+			this->m_json += ',';
+		}
+
+		this->m_json += values[i].ToString();
+	}
+
+	this->m_json += ']';
+
+	return *this;
+}
+
+std::string JsonObject::ToString() const {
+	return this->m_json + '}';
+}
+
+void JsonObject::AddKey(const std::string& key) {
+	if (this->m_json.size() > 1) {
+		this->m_json += ',';
+	}
+
+	AppendString(key, this->m_json);
+	this->m_json += ':';
+}
+
+/**
+	@param	value	-	The string.
+	@param	offset	-	The offset of a byte of 0x80 or above in the string.
+
+	@return	size_t	-	The length of the valid UTF-8 sequence starting at the offset, 0 if it isn't valid.
+						Overlong forms, surrogates and code points beyond U+10FFFF are invalid as well.
+*/
+static size_t GetUtf8Length(const std::string& value, size_t offset) {
+	unsigned char lead = (unsigned char)value[offset];
+
+	size_t length = 0;
+
+	// The range of the second byte, which is narrower than that of the rest for some lead bytes.
+	unsigned char secondMin = 0x80;
+	unsigned char secondMax = 0xbf;
+
+	if (lead >= 0xc2 && lead <= 0xdf) {
+		length = 2;
+	}
+	else if (lead >= 0xe0 && lead <= 0xef) {
+		length = 3;
+		secondMin = lead == 0xe0 ? 0xa0 : 0x80;
+		secondMax = lead == 0xed ? 0x9f : 0xbf;
+	}
+	else if (lead >= 0xf0 && lead <= 0xf4) {
+		length = 4;
+		secondMin = lead == 0xf0 ? 0x90 : 0x80;
+		secondMax = lead == 0xf4 ? 0x8f : 0xbf;
+	}
+	else {
+		return 0;
+	}
+
+	if (value.size() - offset < length) {
+		return 0;
+	}
+
+	unsigned char second = (unsigned char)value[offset + 1];
+
+	if (second < secondMin || second > secondMax) {
+		return 0;
+	}
+
+	for (size_t i = 2; i < length; i++) {
+		if (((unsigned char)value[offset + i] & 0xc0) != 0x80) {
+			return 0;
+		}
+	}
+
+	return length;
+}
+
+void JsonObject::AppendString(const std::string& value, std::string& o_json) {
+	const char* digits = "0123456789abcdef";
+
+	o_json += '"';
+
+	for (size_t i = 0; i < value.size(); i++) {
+		char c = value[i];
+
+		// Texts are any bytes a peer has sent, so what isn't valid UTF-8 is replaced, a byte at a time.
+		if ((unsigned char)c >= 0x80) {
+			size_t length = GetUtf8Length(value, i);
+
+			if (length == 0) {
+				o_json += "\\ufffd";
+			}
+			else {
+				o_json.append(value, i, length);
+				i += length - 1;
+			}
+			continue;
+		}
+
+		switch (c) {
+		case '"':
+			o_json += "\\\"";
+			break;
+
+		case '\\':
+			o_json += "\\\\";
+			break;
+
+		case '\n':
+			o_json += "\\n";
+			break;
+
+		case '\r':
+			o_json += "\\r";
+			break;
+
+		case '\t':
+			o_json += "\\t";
+			break;
+
+		default:
+			// Any other control charecter is written by its code.
+			if ((unsigned char)c < 0x20) {
+				o_json += "\\u00";
+				o_json += digits[(unsigned char)c >> 4];
+				o_json += digits[(unsigned char)c & 0xf];
+			}
+			else {
+				o_json += c;
+			}
+			break;
+		}
+	}
+
+	o_json += '"';
+}
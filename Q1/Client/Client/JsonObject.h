@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+	This class builds a single JSON object, e.g. a line of the batch mode's results.
+	Only what the results hold is supported: strings, numbers, and arrays of strings or of objects.
+
+	Strings are escaped as needed, and otherwise written as they are. Bytes which aren't valid UTF-8
+	are replaced by U+FFFD, so a line is always valid JSON.
+*/
+class JsonObject {
+public:
+	JsonObject();
+
+	JsonObject& AddString(const std::string& key, const std::string& value);
+	JsonObject& AddNumber(const std::string& key, uint64_t value);
+	JsonObject& AddStrings(const std::string& key, const std::vector<std::string>& values);
+	JsonObject& AddObjects(const std::string& key, const std::vector<JsonObject>& values);
+
+	/**
+		@return	string	-	The object, as a single line.
+	*/
+	std::string ToString() const;
+
+private:
+	void AddKey(const std::string& key);
+
+	static void AppendString(const std::string& value, std::string& o_json);
+
+	// The object so far, without its closing brace.
+	std::string m_json;
+};
@@ -0,0 +1,86 @@
+#include "KeyPool.h"
+
+#include <algorithm>
+
+KeyPool::KeyPool(size_t depth, size_t threadCount) : m_depth(std::max<size_t>(depth, 1)), m_inProgress(0), m_isStopping(false),
+														m_hits(0), m_misses(0) {
+
+	for (size_t i = 0; i < std::max<size_t>(threadCount, 1); i++) {
+		this->m_workers.emplace_back([this]() { Fill(); });
+	}
+}
+
+KeyPool::~KeyPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+		this->m_isStopping = true;
+	}
+
+	this->m_notFull.notify_all();
+
+	for (std::thread& worker : this->m_workers) {
+		worker.join();
+	}
+}
+
+std::unique_ptr<RSAPrivateWrapper> KeyPool::Take() {
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		if (this->m_ready.empty() == false) {
+			std::unique_ptr<RSAPrivateWrapper> keyPair = std::move(this->m_ready.front());
+			this->m_ready.pop_front();
+
+			this->m_hits++;
+			this->m_notFull.notify_one();
+
+			return keyPair;
+		}
+	}
+
+	this->m_misses++;
+
+	return std::unique_ptr<RSAPrivateWrapper>(new RSAPrivateWrapper());
+}
+
+uint64_t KeyPool::GetHits() const {
+	return this->m_hits;
+}
+
+uint64_t KeyPool::GetMisses() const {
+	return this->m_misses;
+}
+
+void KeyPool::Fill() {
+	std::unique_lock<std::mutex> lock(this->m_mutex);
+
+	while (true) {
+		this->m_notFull.wait(lock, [this]() {
+			return this->m_isStopping == true || this->m_ready.size() + this->m_inProgress < this->m_depth;
+		});
+
+		if (this->m_isStopping == true) {
+			return;
+		}
+
+		this->m_inProgress++;
+		lock.unlock();
+
+		// Generating takes long, so it is done without holding the lock.
+		std::unique_ptr<RSAPrivateWrapper> keyPair;
+
+		try {
+			keyPair.reset(new RSAPrivateWrapper());
+		}
+		catch (...) {
+			// Leaving the pool to the other workers, or to the callers, who will report the error.
+			lock.lock();
+			this->m_inProgress--;
+			return;
+		}
+
+		lock.lock();
+		this->m_inProgress--;
+		this->m_ready.push_back(std::move(keyPair));
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RSAWrapper.h"
+
+/**
+	This class generates RSA key pairs ahead of time on background threads, so registering
+	doesn't wait for a key pair to be generated.
+
+	Up to 'depth' key pairs are kept ready. Taking one wakes the workers to replace it.
+	If none is ready when asked for, one is generated by the caller instead.
+*/
+class KeyPool {
+public:
+	// A key pair takes long enough to generate for one to be ready, by the time the user has chosen a name.
+	static constexpr size_t DEFAULT_DEPTH = 2;
+	static constexpr size_t DEFAULT_THREAD_COUNT = 1;
+
+	/**
+		Starts the workers right away.
+
+		@param	depth		-	The most key pairs kept ready at once, at least one.
+		@param	threadCount	-	The number of workers generating key pairs, at least one.
+	*/
+	KeyPool(size_t depth, size_t threadCount);
+
+	/**
+		Stops the workers, waiting for any key pair being generated.
+	*/
+	~KeyPool();
+
+	/**
+		@return	unique_ptr<RSAPrivateWrapper>	-	A ready key pair if any, a newly generated one otherwise.
+	*/
+	std::unique_ptr<RSAPrivateWrapper> Take();
+
+	/**
+		@return	uint64_t	-	How many key pairs were taken ready from the pool.
+	*/
+	uint64_t GetHits() const;
+
+	/**
+		@return	uint64_t	-	How many key pairs were generated by the caller, since none was ready.
+	*/
+	uint64_t GetMisses() const;
+
+private:
+	KeyPool(const KeyPool&);
+	KeyPool& operator=(const KeyPool&);
+
+	/**
+		The loop of each worker, generating key pairs until the pool is full, and waiting otherwise.
+	*/
+	void Fill();
+
+	size_t m_depth;
+
+	std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::deque<std::unique_ptr<RSAPrivateWrapper>> m_ready;
+
+	// Key pairs being generated, counted against the depth so the workers don't overshoot it.
+	size_t m_inProgress;
+	bool m_isStopping;
+
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+
+	std::vector<std::thread> m_workers;
+};
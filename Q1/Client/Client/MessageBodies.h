@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string.h>
+#include <vector>
+
+#include "ByteView.h"
 #include "Defines.h"
 #include "Validators.h"
 
@@ -12,7 +16,20 @@
 enum class MessageType : uint8_t {
 	GetSymKey = 1,
 	SendSymKey = 2,
-	SendText = 3
+	SendText = 3,
+
+	// A text deflated before being encrypted.
+	SendCompressedText = 4,
+
+	// A single chunk of a file.
+	SendFileChunk = 5,
+
+	// A text sealed with AES-GCM, whose plaintext is led by its inner type (SendText or SendCompressedText).
+	SendSealedText = 6,
+
+	// A text sealed with a key agreed over X25519. The content is the sender's agreement key,
+	// followed by the sealed text as in SendSealedText.
+	SendAgreedText = 7
 };
 
 #pragma pack(push, 1)
@@ -39,7 +56,57 @@ typedef struct _RequestPKBody {
 	}
 } RequestPKBody;
 
-// Opcode 1003
+// Opcode 1006
+// The response (2004) is held by the server until a message arrives or the timeout expires.
+typedef struct _RequestWaitMessagesBody {
+	uint32_t timeoutMs;
+
+	static constexpr size_t GetSize() {
+		return sizeof(RequestWaitMessagesBody);
+	}
+} RequestWaitMessagesBody;
+
+// Opcode 1007
+// Zero means the page is not limited by that measure. The first message is sent even if it exceeds maxBytes.
+typedef struct _RequestGetMessagesPageBody {
+	uint32_t maxBytes;
+	uint32_t maxCount;
+
+	static constexpr size_t GetSize() {
+		return sizeof(RequestGetMessagesPageBody);
+	}
+} RequestGetMessagesPageBody;
+
+// Opcode 1008
+typedef struct _RequestDirectorySyncBody {
+	uint32_t sinceVersion;
+
+	static constexpr size_t GetSize() {
+		return sizeof(RequestDirectorySyncBody);
+	}
+} RequestDirectorySyncBody;
+
+// Opcode 1009
+typedef struct _RequestSetAgreementKeyBody {
+	agreementKey_t agreementKey;
+
+	static constexpr size_t GetSize() {
+		return sizeof(RequestSetAgreementKeyBody);
+	}
+} RequestSetAgreementKeyBody;
+
+// Opcode 1010
+typedef struct _RequestGetAgreementKeyBody {
+	uuid_t uuid;
+
+	static constexpr size_t GetSize() {
+		return sizeof(RequestGetAgreementKeyBody);
+	}
+} RequestGetAgreementKeyBody;
+
+// Opcode 1003 holds a single MessageHeader followed by its content.
+// Opcode 1005 holds a sequence of those, each to its own destination.
+
 // Type 1
 typedef struct _EmptyMessage {
 	static constexpr size_t GetSize() {
@@ -56,6 +123,19 @@ typedef struct _SendSymKeyMessage {
 	}
 } SendSymKeyMessage;
 
+// Type 5
+// The content starts with this header, followed by the encrypted chunk.
+// Chunk 0 holds the file's name, and the rest hold the file's data in order.
+typedef struct _FileChunkHeader {
+	uint64_t transferId;
+	uint32_t sequence;
+	uint32_t chunkCount;
+
+	static constexpr size_t GetSize() {
+		return sizeof(FileChunkHeader);
+	}
+} FileChunkHeader;
+
 class MessageHeader {
 public:
 	MessageHeader() : uuid{ 0 }, messageType(0), contentSize(0) { };
@@ -68,15 +148,16 @@ public:
 		return sizeof(uuid) + sizeof(messageType) + sizeof(contentSize);
 	}
 
-	bool Deserialize(const std::vector<uint8_t>& inVector) {
+	// Reads the header from where it lies, e.g. inside a received payload.
+	bool Deserialize(ByteView inView) {
 
-		if (inVector.size() < MessageHeader::GetSize()) {
+		if (inView.GetSize() < MessageHeader::GetSize()) {
 			return false;
 		}
 
-		memcpy((uint8_t*)&uuid, inVector.data(), sizeof(uuid));
-		memcpy((uint8_t*)&messageType, inVector.data() + sizeof(uuid), sizeof(messageType));
-		memcpy((uint8_t*)&contentSize, inVector.data() + sizeof(uuid) + sizeof(messageType), sizeof(contentSize));
+		memcpy((uint8_t*)&uuid, inView.GetData(), sizeof(uuid));
+		memcpy((uint8_t*)&messageType, inView.GetData() + sizeof(uuid), sizeof(messageType));
+		memcpy((uint8_t*)&contentSize, inView.GetData() + sizeof(uuid) + sizeof(messageType), sizeof(contentSize));
 
 		switch (messageType)
 		{
@@ -101,6 +182,28 @@ public:
 			break;
 
 		case (uint8_t)MessageType::SendText:
+		case (uint8_t)MessageType::SendCompressedText:
+		case (uint8_t)MessageType::SendSealedText:
+			break;
+
+		case (uint8_t)MessageType::SendAgreedText:
+			if (contentSize < sizeof(agreementKey_t)) {
+				memset(uuid, 0, sizeof(uuid));
+				messageType = 0;
+				contentSize = 0;
+
+				return false;
+			}
+			break;
+
+		case (uint8_t)MessageType::SendFileChunk:
+			if (contentSize < FileChunkHeader::GetSize()) {
+				memset(uuid, 0, sizeof(uuid));
+				messageType = 0;
+				contentSize = 0;
+
+				return false;
+			}
 			break;
 
 		default:
@@ -175,6 +278,18 @@ typedef struct _ResponseUsersListNode {
 
 } ResponseUsersListNode;
 
+// Opcode 2008, followed by the users added since the requested version, in the format of opcode 2001.
+// The epoch is drawn when the server starts, so versions given by different runs are told apart.
+typedef struct _ResponseDirectorySyncHeader {
+	uint32_t epoch;
+	uint32_t version;
+
+	static constexpr size_t GetSize() {
+		return sizeof(ResponseDirectorySyncHeader);
+	}
+
+} ResponseDirectorySyncHeader;
+
 // Opcode 2002
 typedef struct _ResponsePKBody {
 	uuid_t uuid;
@@ -186,7 +301,39 @@ typedef struct _ResponsePKBody {
 
 } ResponsePKBody;
 
+// Opcode 2009, echoing the key now registered.
+typedef struct _ResponseSetAgreementKeyBody {
+	agreementKey_t agreementKey;
+
+	static constexpr size_t GetSize() {
+		return sizeof(ResponseSetAgreementKeyBody);
+	}
+
+} ResponseSetAgreementKeyBody;
+
+// Opcode 2010
+typedef struct _ResponseGetAgreementKeyBody {
+	uuid_t uuid;
+	agreementKey_t agreementKey;
+
+	static constexpr size_t GetSize() {
+		return sizeof(ResponseGetAgreementKeyBody);
+	}
+
+} ResponseGetAgreementKeyBody;
+
+// Opcode 2007, followed by the page's messages in the format of opcode 2004.
+typedef struct _ResponseGetMessagesPageHeader {
+	uint8_t morePending;
+
+	static constexpr size_t GetSize() {
+		return sizeof(ResponseGetMessagesPageHeader);
+	}
+
+} ResponseGetMessagesPageHeader;
+
 // Opcode 2003
+// Opcode 2005 holds one of these per message, in the order of the request.
 typedef struct _ResponseSendMessageBody {
 	uuid_t uuid;
 	uint32_t messageId;
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ByteView.h"
+#include "MessageBodies.h"
+
+/**
+	A non-owning reader over the messages in a mailbox's payload, one after the other.
+	Each header is validated where it lies, and each content is viewed rather than copied,
+	so reading the whole mailbox neither copies nor allocates.
+
+	The payload must outlive the reader, and so must it outlive the viewed contents.
+*/
+class MessageView {
+public:
+	MessageView(ByteView payload) : m_payload(payload), m_offset(0), m_error(nullptr) {}
+
+	/**
+		Reads the next message, once its header is valid and its whole content is within the payload.
+
+		@return	bool	-	True if a message was read, false once the payload ended or an invalid message was reached.
+	*/
+	bool Next() {
+		if (m_error != nullptr || m_offset == m_payload.GetSize()) {
+			return false;
+		}
+
+		if (m_payload.GetSize() - m_offset < MessageHeader::GetSize()) {
+			m_error = "Reached an invalid tail length";
+			return false;
+		}
+
+		if (m_header.Deserialize(m_payload.SubView(m_offset, MessageHeader::GetSize())) != true) {
+			m_error = "Read invalid header from server";
+			return false;
+		}
+
+		size_t contentOffset = m_offset + MessageHeader::GetSize();
+
+		if (m_payload.GetSize() - contentOffset < m_header.contentSize) {
+			m_error = "Reached an invalid tail length";
+			return false;
+		}
+
+		m_content = m_payload.SubView(contentOffset, m_header.contentSize);
+		m_offset = contentOffset + m_header.contentSize;
+
+		return true;
+	}
+
+	/**
+		@return	MessageHeader	-	The header of the message last read.
+	*/
+	const MessageHeader& GetHeader() const { return m_header; }
+
+	/**
+		@return	ByteView	-	The content of the message last read, inside the payload.
+	*/
+	ByteView GetContent() const { return m_content; }
+
+	/**
+		@return	char*	-	Why reading stopped before the payload ended, nullptr if it didn't.
+	*/
+	const char* GetError() const { return m_error; }
+
+private:
+	ByteView m_payload;
+	size_t m_offset;
+
+	MessageHeader m_header;
+	ByteView m_content;
+
+	const char* m_error;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+	This class keeps objects of a single type in chunks, so creating many of them takes
+	a single allocation per chunk, and destroying the pool destroys its objects and frees all the chunks at once.
+
+	Objects are referred to by handles rather than owning pointers. A handle stays valid
+	until its object is destroyed, after which its slot is reused by the next object created.
+	Objects never move, so a pointer from Get stays valid for as long as the handle does.
+
+	Each chunk is twice as large as the one before it, so a small fixed table of chunks covers every handle,
+	and Get finds an object without taking a lock.
+
+	Handles may be created, destroyed and resolved from several threads at once.
+*/
+template <typename T>
+class ObjectPool {
+public:
+	typedef uint32_t Handle;
+
+	// A handle referring to no object.
+	static constexpr Handle NO_HANDLE = UINT32_MAX;
+
+	// The number of objects the first allocation makes room for. Kept small, since every roster
+	// has pools of its own, and an engine holds many rosters of only a few friends each.
+	static constexpr size_t FIRST_CHUNK_SIZE = 8;
+
+	// Enough chunks for all but the last few handles, while the first handle of each still fits a 32-bit size_t.
+	static constexpr size_t MAX_CHUNKS = 29;
+
+	ObjectPool() : m_size(0) {
+		for (std::atomic<Slot*>& chunk : this->m_chunks) {
+			chunk = nullptr;
+		}
+	}
+
+	~ObjectPool() {
+		// The objects left are destroyed in place, without returning their slots, then all the chunks are freed.
+		for (Handle handle = 0; handle < this->m_size; handle++) {
+			if (this->m_isAlive[handle] == true) {
+				GetSlot(handle)->~T();
+			}
+		}
+
+		for (std::atomic<Slot*>& chunk : this->m_chunks) {
+			delete[] chunk.load();
+		}
+	}
+
+	/**
+		Constructs a new object with the given arguments, in a free slot if any.
+		If the constructor throws, so does this function, and no slot is taken.
+
+		@return	Handle	-	The handle of the new object.
+	*/
+	template <typename... Args>
+	Handle Create(Args&&... args) {
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		bool isReused = this->m_free.empty() == false;
+		Handle handle = isReused == true ? this->m_free.back() : this->m_size;
+
+		if (isReused == false) {
+			size_t chunkIndex = GetChunkIndex(handle);
+
+			if (chunkIndex == MAX_CHUNKS) {
+				throw std::bad_alloc();
+			}
+
+			// Published only once allocated, so Get never sees a chunk being made.
+			if (this->m_chunks[chunkIndex].load(std::memory_order_relaxed) == nullptr) {
+				this->m_chunks[chunkIndex].store(new Slot[GetChunkSize(chunkIndex)], std::memory_order_release);
+			}
+		}
+
+		new (GetSlot(handle)) T(std::forward<Args>(args)...);
+
+		if (isReused == true) {
+			this->m_free.pop_back();
+			this->m_isAlive[handle] = true;
+		}
+		else {
+			this->m_isAlive.push_back(true);
+			this->m_size++;
+		}
+
+		return handle;
+	}
+
+	/**
+		Destroys an object, and frees its slot for reuse.
+
+		@param	handle	-	The object's handle. Nothing is done for NO_HANDLE.
+	*/
+	void Destroy(Handle handle) {
+		if (handle == NO_HANDLE) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		GetSlot(handle)->~T();
+		this->m_isAlive[handle] = false;
+		this->m_free.push_back(handle);
+	}
+
+	/**
+		@param	handle	-	The object's handle.
+
+		@return	T*	-	The object, nullptr for NO_HANDLE.
+	*/
+	T* Get(Handle handle) {
+		if (handle == NO_HANDLE) {
+			return nullptr;
+		}
+
+		return GetSlot(handle);
+	}
+
+private:
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+	ObjectPool(const ObjectPool&);
+	ObjectPool& operator=(const ObjectPool&);
+
+	static size_t GetChunkSize(size_t chunkIndex) {
+		return FIRST_CHUNK_SIZE << chunkIndex;
+	}
+
+	// The first handle of a chunk, which is the number of slots in all the chunks before it.
+	static size_t GetChunkStart(size_t chunkIndex) {
+		return FIRST_CHUNK_SIZE * ((static_cast<size_t>(1) << chunkIndex) - 1);
+	}
+
+	// MAX_CHUNKS if the handle is beyond the last chunk.
+	static size_t GetChunkIndex(Handle handle) {
+		size_t chunkIndex = 0;
+
+		while (chunkIndex < MAX_CHUNKS && handle >= GetChunkStart(chunkIndex + 1)) {
+			chunkIndex++;
+		}
+
+		return chunkIndex;
+	}
+
+	T* GetSlot(Handle handle) {
+		size_t chunkIndex = GetChunkIndex(handle);
+		Slot* chunk = this->m_chunks[chunkIndex].load(std::memory_order_acquire);
+
+		return reinterpret_cast<T*>(&chunk[handle - GetChunkStart(chunkIndex)]);
+	}
+
+	// Guards creating and destroying objects. Chunks are only ever added, so Get needs no lock.
+	std::mutex m_mutex;
+
+	std::atomic<Slot*> m_chunks[MAX_CHUNKS];
+
+	// The number of slots ever taken, and which of them hold an object.
+	Handle m_size;
+	std::vector<bool> m_isAlive;
+
+	// Slots whose objects were destroyed, reused before new ones are taken.
+	std::vector<Handle> m_free;
+};
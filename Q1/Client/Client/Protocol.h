@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <vector>
 
+#include "ByteView.h"
 #include "Defines.h"
 #include "Validators.h"
 #include "MessageBodies.h"
@@ -21,16 +22,114 @@ enum class Opcode : uint16_t {
 	RequestPK = 1002,
 	RequestSendMessage = 1003,
 	RequestGetMessages = 1004,
+	RequestSendMessages = 1005,
+	RequestWaitMessages = 1006,
+	RequestGetMessagesPage = 1007,
+	RequestDirectorySync = 1008,
+	RequestSetAgreementKey = 1009,
+	RequestGetAgreementKey = 1010,
 
 	ResponseRegister = 2000,
 	ResponseList = 2001,
 	ResponsePK = 2002,
 	ResponseSendMessage = 2003,
 	ResponseGetMessage = 2004,
+	ResponseSendMessages = 2005,
+	ResponseGetMessagesPage = 2007,
+	ResponseDirectorySync = 2008,
+	ResponseSetAgreementKey = 2009,
+	ResponseGetAgreementKey = 2010,
 
 	ResponseFailure = 9000
 };
 
+/**
+	A request described as a list of buffer segments, e.g. the header, a message sub-header
+	and the ciphertext, so it can be written to the socket as a single gather write
+	without being copied into one contiguous buffer first.
+
+	The segments don't own the memory they point to, which must outlive the write,
+	and the list itself has a fixed capacity so it can live on the stack.
+*/
+class RequestSegments {
+public:
+	static constexpr size_t MAX_SEGMENTS = 4;
+
+	RequestSegments() : m_count(0) {}
+
+	void Add(const void* data, size_t size) {
+		Add(ByteView((const uint8_t*)data, size));
+	}
+
+	void Add(ByteView segment) {
+		if (m_count == MAX_SEGMENTS) {
+			throw std::length_error("Too many request segments");
+		}
+
+		// Empty segments would only waste a slot.
+		if (segment.IsEmpty() == false) {
+			m_segments[m_count++] = segment;
+		}
+	}
+
+	void Add(const RequestSegments& other) {
+		for (size_t i = 0; i < other.GetCount(); i++) {
+			Add(other[i]);
+		}
+	}
+
+	size_t GetCount() const { return m_count; }
+
+	const ByteView& operator[](size_t index) const { return m_segments[index]; }
+
+	size_t GetTotalSize() const {
+		size_t total = 0;
+
+		for (size_t i = 0; i < m_count; i++) {
+			total += m_segments[i].GetSize();
+		}
+
+		return total;
+	}
+
+	/**
+		@param	bytes	-	The number of leading bytes to skip.
+
+		@return	RequestSegments	-	The same segments, without their first given bytes.
+	*/
+	RequestSegments Skip(size_t bytes) const {
+		RequestSegments ret;
+
+		for (size_t i = 0; i < m_count; i++) {
+			if (bytes >= m_segments[i].GetSize()) {
+				bytes -= m_segments[i].GetSize();
+				continue;
+			}
+
+			ret.Add(m_segments[i].SubView(bytes));
+			bytes = 0;
+		}
+
+		return ret;
+	}
+
+	/**
+		Copies all the segments into a single contiguous vector.
+	*/
+	void Flatten(std::vector<uint8_t>& o_vector) const {
+		o_vector.clear();
+		o_vector.reserve(GetTotalSize());
+
+		for (size_t i = 0; i < m_count; i++) {
+			o_vector.insert(o_vector.end(), m_segments[i].begin(), m_segments[i].end());
+		}
+	}
+
+private:
+	ByteView m_segments[MAX_SEGMENTS];
+	size_t m_count;
+};
+
 #pragma pack(push, 1)
 
 /**
@@ -42,14 +141,26 @@ enum class Opcode : uint16_t {
 
 class BaseRequestHeader {
 public:
-	BaseRequestHeader(uint16_t _code, uint32_t _size) : clientId{ 0 }, version(CLIENT_VERSION), code(_code), payloadSize(_size) {}
+	BaseRequestHeader(uint16_t _code, uint32_t _size) : clientId{ 0 }, version(GetVersionOf(_code)), code(_code), payloadSize(_size) {}
 
-	BaseRequestHeader(UUID _uuid, uint16_t _code, uint32_t _size) : version(CLIENT_VERSION), code(_code), payloadSize(_size) {
+	BaseRequestHeader(UUID _uuid, uint16_t _code, uint32_t _size) : version(GetVersionOf(_code)), code(_code), payloadSize(_size) {
 		if (_uuid.Serialize(clientId, sizeof(clientId)) == false) {
 			throw std::invalid_argument("Unable to handle currnt UUID for messages");
 		}
 	}
 
+	Opcode GetCode() const { return (Opcode)code; }
+
+	// Requests which older servers don't know are sent with the version which introduced them.
+	static uint8_t GetVersionOf(uint16_t _code) {
+		if (_code == (uint16_t)Opcode::RequestSetAgreementKey ||
+			_code == (uint16_t)Opcode::RequestGetAgreementKey) {
+			return KEY_AGREEMENT_VERSION;
+		}
+
+		return CLIENT_VERSION;
+	}
+
 	const void Serialize(std::vector<uint8_t>& o_vector) const {
 		o_vector.clear();
 		o_vector.resize(sizeof(BaseRequestHeader));
@@ -85,6 +196,7 @@ public:
 
 	Opcode GetCode() { return (Opcode)code; }
 	uint32_t GetPayloadSize() { return payloadSize; }
+	uint8_t GetVersion() { return version; }
 
 	bool Deserialize(const std::vector<uint8_t>& inVector) {
 		memcpy((uint8_t*)&version, inVector.data(), sizeof(version));
@@ -102,6 +214,11 @@ public:
 			code != (uint16_t)Opcode::ResponsePK &&
 			code != (uint16_t)Opcode::ResponseSendMessage &&
 			code != (uint16_t)Opcode::ResponseGetMessage &&
+			code != (uint16_t)Opcode::ResponseSendMessages &&
+			code != (uint16_t)Opcode::ResponseGetMessagesPage &&
+			code != (uint16_t)Opcode::ResponseDirectorySync &&
+			code != (uint16_t)Opcode::ResponseSetAgreementKey &&
+			code != (uint16_t)Opcode::ResponseGetAgreementKey &&
 			code != (uint16_t)Opcode::ResponseFailure) {
 
 			version = 0;
@@ -168,16 +285,21 @@ public:
 	RequestHeader<_code, Body::GetSize()> header;
 	Body body;
 
-	const void Serialize(std::vector<uint8_t>& o_vector) const {
-		o_vector.resize(sizeof(header));
-		header.Serialize(o_vector);
+	/**
+		The header and the body are packed one after the other, so the whole
+		request is a single segment pointing at this instance.
+	*/
+	void GetSegments(RequestSegments& o_segments) const {
+		static_assert(sizeof(header) + Body::GetSize() <= sizeof(StaticRequest), "Request is not contiguous");
 
-		if (Body::GetSize() > 0) {
-			std::vector<uint8_t> payload(Body::GetSize());
-			memcpy(&payload[0], &body, Body::GetSize());
+		o_segments.Add(this, sizeof(header) + Body::GetSize());
+	}
 
-			o_vector.insert(o_vector.end(), payload.begin(), payload.end());
-		}
+	const void Serialize(std::vector<uint8_t>& o_vector) const {
+		RequestSegments segments;
+		GetSegments(segments);
+
+		segments.Flatten(o_vector);
 	}
 
 };
@@ -202,38 +324,117 @@ public:
 			return false;
 		}
 
-		std::vector<uint8_t> payload(inVector.begin() + sizeof(header), inVector.end());
-		memcpy((uint8_t*)&body, payload.data(), sizeof(body));
+		memcpy((uint8_t*)&body, inVector.data() + sizeof(header), sizeof(body));
 
 		return true;
 	}
 };
 
+/**
+	Pipelined frames carry a request ID right after the regular header,
+	so responses can be matched to their requests regardless of their order.
+
+	Requests are built as usual, and only re-framed when sent.
+*/
+typedef uint32_t requestId_t;
+
+class PipelinedRequestHeader : BaseRequestHeader {
+public:
+	PipelinedRequestHeader() : BaseRequestHeader(0, 0), requestId(0) {}
+
+	/**
+		@param	request		-	The request to re-frame. Its header must be entirely within the first segment.
+		@param	_requestId	-	The ID to attach to the request.
+	*/
+	PipelinedRequestHeader(const RequestSegments& request, requestId_t _requestId) : BaseRequestHeader(0, 0), requestId(_requestId) {
+		if (request.GetCount() == 0 ||
+			request[0].GetSize() < sizeof(BaseRequestHeader)) {
+			throw std::invalid_argument("Request is too short to be re-framed");
+		}
+
+		memcpy((BaseRequestHeader*)this, request[0].GetData(), sizeof(BaseRequestHeader));
+
+		// Later versions are pipelined as well.
+		if (version < PIPELINED_VERSION) {
+			version = PIPELINED_VERSION;
+		}
+	}
+
+	void SetRequestId(requestId_t _requestId) { requestId = _requestId; }
+
+	using BaseRequestHeader::GetCode;
+
+private:
+	requestId_t requestId;
+};
+
+class PipelinedResponseHeader : public BaseResponseHeader {
+public:
+	PipelinedResponseHeader() : BaseResponseHeader(), requestId(0) {}
+
+	requestId_t GetRequestId() { return requestId; }
+
+	bool Deserialize(const std::vector<uint8_t>& inVector) {
+
+		if (inVector.size() < sizeof(PipelinedResponseHeader)) {
+			return false;
+		}
+
+		if (BaseResponseHeader::Deserialize(inVector) != true) {
+			return false;
+		}
+
+		memcpy((uint8_t*)&requestId, inVector.data() + sizeof(BaseResponseHeader), sizeof(requestId));
+
+		return version >= PIPELINED_VERSION;
+	}
+
+private:
+	requestId_t requestId;
+};
+
+#pragma pack(pop)
+
+/**
+	DynamicRequest is made for requests whose payload length is known only at run time.
+	The payload is described by segments, so it is never copied, e.g. a message sub-header
+	followed by the ciphertext.
+*/
 class DynamicRequest {
 public:
-	DynamicRequest(UUID _uuid, uint16_t _code, std::vector<uint8_t>& _payload) : header(_uuid, _code, _payload.size()), payload(_payload) {}
+	DynamicRequest(UUID _uuid, uint16_t _code, const RequestSegments& _payload) : header(_uuid, _code, (uint32_t)_payload.GetTotalSize()), payload(_payload) {}
+
+	void GetSegments(RequestSegments& o_segments) const {
+		o_segments.Add(&header, sizeof(header));
+		o_segments.Add(payload);
+	}
 
 	const void Serialize(std::vector<uint8_t>& o_vector) const {
-		o_vector.resize(sizeof(header));
-		header.Serialize(o_vector);
+		RequestSegments segments;
+		GetSegments(segments);
 
-		o_vector.insert(o_vector.end(), payload.begin(), payload.end());
+		segments.Flatten(o_vector);
 	}
 
 private:
 	BaseRequestHeader header;
-	std::vector<uint8_t> payload;
+	RequestSegments payload;
 };
 
-#pragma pack(pop)
-
 typedef StaticRequest<Opcode::RequestRegister, RequestRegisterBody> RequestRegister;
 typedef StaticRequest<Opcode::RequestList, EmptyBody> RequestList;
 typedef StaticRequest<Opcode::RequestPK, RequestPKBody> RequestPK;
 typedef StaticRequest<Opcode::RequestSendMessage, RequestGetSymKeyBody> RequestGetSymKey;
 typedef StaticRequest<Opcode::RequestSendMessage, RequestSendSymKeyBody> RequestSendSymKey;
 typedef StaticRequest<Opcode::RequestGetMessages, EmptyBody> RequestGetMessages;
+typedef StaticRequest<Opcode::RequestWaitMessages, RequestWaitMessagesBody> RequestWaitMessages;
+typedef StaticRequest<Opcode::RequestGetMessagesPage, RequestGetMessagesPageBody> RequestGetMessagesPage;
+typedef StaticRequest<Opcode::RequestDirectorySync, RequestDirectorySyncBody> RequestDirectorySync;
+typedef StaticRequest<Opcode::RequestSetAgreementKey, RequestSetAgreementKeyBody> RequestSetAgreementKey;
+typedef StaticRequest<Opcode::RequestGetAgreementKey, RequestGetAgreementKeyBody> RequestGetAgreementKey;
 
 typedef StaticResponse<Opcode::ResponseRegister, ResponseRegisterBody> ResponseRegister;
 typedef StaticResponse<Opcode::ResponsePK, ResponsePKBody> ResponsePK;
 typedef StaticResponse<Opcode::ResponseSendMessage, ResponseSendMessageBody> ResponseSendMessage;
+typedef StaticResponse<Opcode::ResponseSetAgreementKey, ResponseSetAgreementKeyBody> ResponseSetAgreementKey;
+typedef StaticResponse<Opcode::ResponseGetAgreementKey, ResponseGetAgreementKeyBody> ResponseGetAgreementKey;
@@ -1,16 +1,17 @@
 #include "RSAWrapper.h"
 
+#include <stdexcept>
 
 RSAPublicWrapper::RSAPublicWrapper(const char* key, unsigned int length)
 {
 	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(key), length, true);
-	_publicKey.Load(ss);
+	_encryptor.AccessKey().Load(ss);
 }
 
 RSAPublicWrapper::RSAPublicWrapper(const std::string& key)
 {
 	CryptoPP::StringSource ss(key, true);
-	_publicKey.Load(ss);
+	_encryptor.AccessKey().Load(ss);
 }
 
 RSAPublicWrapper::~RSAPublicWrapper()
@@ -21,49 +22,48 @@ std::string RSAPublicWrapper::getPublicKey() const
 {
 	std::string key;
 	CryptoPP::StringSink ss(key);
-	_publicKey.Save(ss);
+	_encryptor.GetKey().Save(ss);
 	return key;
 }
 
 char* RSAPublicWrapper::getPublicKey(char* keyout, unsigned int length) const
 {
 	CryptoPP::ArraySink as(reinterpret_cast<CryptoPP::byte*>(keyout), length);
-	_publicKey.Save(as);
+	_encryptor.GetKey().Save(as);
 	return keyout;
 }
 
 std::string RSAPublicWrapper::encrypt(const std::string& plain)
 {
-	std::string cipher;
-	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
-	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
-	return cipher;
+	return encrypt(plain.data(), static_cast<unsigned int>(plain.size()));
 }
 
 std::string RSAPublicWrapper::encrypt(const char* plain, unsigned int length)
 {
-	std::string cipher;
-	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
-	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(plain), length, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	if (length > _encryptor.FixedMaxPlaintextLength())
+		throw std::length_error("plain is too long for the key");
+
+	std::string cipher(_encryptor.CiphertextLength(length), '\0');
+	_encryptor.Encrypt(_rng, reinterpret_cast<const CryptoPP::byte*>(plain), length, reinterpret_cast<CryptoPP::byte*>(&cipher[0]));
 	return cipher;
 }
 
 
 RSAPrivateWrapper::RSAPrivateWrapper()
 {
-	_privateKey.Initialize(_rng, BITS);
+	_decryptor.AccessKey().Initialize(_rng, BITS);
 }
 
 RSAPrivateWrapper::RSAPrivateWrapper(const char* key, unsigned int length)
 {
 	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(key), length, true);
-	_privateKey.Load(ss);
+	_decryptor.AccessKey().Load(ss);
 }
 
 RSAPrivateWrapper::RSAPrivateWrapper(const std::string& key)
 {
 	CryptoPP::StringSource ss(key, true);
-	_privateKey.Load(ss);
+	_decryptor.AccessKey().Load(ss);
 }
 
 RSAPrivateWrapper::~RSAPrivateWrapper()
@@ -74,20 +74,20 @@ std::string RSAPrivateWrapper::getPrivateKey() const
 {
 	std::string key;
 	CryptoPP::StringSink ss(key);
-	_privateKey.Save(ss);
+	_decryptor.GetKey().Save(ss);
 	return key;
 }
 
 char* RSAPrivateWrapper::getPrivateKey(char* keyout, unsigned int length) const
 {
 	CryptoPP::ArraySink as(reinterpret_cast<CryptoPP::byte*>(keyout), length);
-	_privateKey.Save(as);
+	_decryptor.GetKey().Save(as);
 	return keyout;
 }
 
 std::string RSAPrivateWrapper::getPublicKey() const
 {
-	CryptoPP::RSAFunction publicKey(_privateKey);
+	CryptoPP::RSAFunction publicKey(_decryptor.GetKey());
 	std::string key;
 	CryptoPP::StringSink ss(key);
 	publicKey.Save(ss);
@@ -96,7 +96,7 @@ std::string RSAPrivateWrapper::getPublicKey() const
 
 char* RSAPrivateWrapper::getPublicKey(char* keyout, unsigned int length) const
 {
-	CryptoPP::RSAFunction publicKey(_privateKey);
+	CryptoPP::RSAFunction publicKey(_decryptor.GetKey());
 	CryptoPP::ArraySink as(reinterpret_cast<CryptoPP::byte*>(keyout), length);
 	publicKey.Save(as);
 	return keyout;
@@ -104,16 +104,20 @@ char* RSAPrivateWrapper::getPublicKey(char* keyout, unsigned int length) const
 
 std::string RSAPrivateWrapper::decrypt(const std::string& cipher)
 {
-	std::string decrypted;
-	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
-	CryptoPP::StringSource ss_cipher(cipher, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
-	return decrypted;
+	return decrypt(cipher.data(), static_cast<unsigned int>(cipher.size()));
 }
 
 std::string RSAPrivateWrapper::decrypt(const char* cipher, unsigned int length)
 {
-	std::string decrypted;
-	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
-	CryptoPP::StringSource ss_cipher(reinterpret_cast<const CryptoPP::byte*>(cipher), length, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
+	if (length != _decryptor.FixedCiphertextLength())
+		throw std::length_error("cipher length must match the key");
+
+	std::string decrypted(_decryptor.MaxPlaintextLength(length), '\0');
+	CryptoPP::DecodingResult result = _decryptor.Decrypt(_rng, reinterpret_cast<const CryptoPP::byte*>(cipher), length, reinterpret_cast<CryptoPP::byte*>(&decrypted[0]));
+
+	if (result.isValidCoding == false)
+		throw std::runtime_error("cipher failed decoding");
+
+	decrypted.resize(result.messageLength);
 	return decrypted;
 }
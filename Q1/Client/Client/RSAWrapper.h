@@ -13,7 +13,9 @@ public:
 
 private:
 	CryptoPP::AutoSeededRandomPool _rng;
-	CryptoPP::RSA::PublicKey _publicKey;
+
+	// The encryptor holds the key, and is kept for reuse by every call.
+	CryptoPP::RSAES_OAEP_SHA_Encryptor _encryptor;
 
 	RSAPublicWrapper(const RSAPublicWrapper& rsapublic);
 	RSAPublicWrapper& operator=(const RSAPublicWrapper& rsapublic);
@@ -38,7 +40,9 @@ public:
 
 private:
 	CryptoPP::AutoSeededRandomPool _rng;
-	CryptoPP::RSA::PrivateKey _privateKey;
+
+	// The decryptor holds the key, and is kept for reuse by every call.
+	CryptoPP::RSAES_OAEP_SHA_Decryptor _decryptor;
 
 	RSAPrivateWrapper(const RSAPrivateWrapper& rsaprivate);
 	RSAPrivateWrapper& operator=(const RSAPrivateWrapper& rsaprivate);
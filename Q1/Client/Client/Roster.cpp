@@ -0,0 +1,53 @@
+#include "Roster.h"
+
+#include <string.h>
+
+Roster::UuidKey::UuidKey(const uuid_t uuid) {
+	memcpy(words, uuid, sizeof(words));
+}
+
+Roster::~Roster() {
+	for (Friend& currFriend : m_friends) {
+		currFriend.DetachKeys();
+	}
+}
+
+Friend* Roster::Add(const std::string& name, const uuid_t uuid) {
+
+	if (m_byName.find(name) != m_byName.end() ||
+		m_byUuid.find(UuidKey(uuid)) != m_byUuid.end()) {
+		return nullptr;
+	}
+
+	Friend newFriend(m_keys);
+
+	if (newFriend.Init(name, uuid) != true) {
+		return nullptr;
+	}
+
+	uint32_t position = (uint32_t)m_friends.size();
+
+	m_friends.push_back(std::move(newFriend));
+	m_byName.emplace(name, position);
+	m_byUuid.emplace(UuidKey(uuid), position);
+
+	return &m_friends.back();
+}
+
+Friend* Roster::FindByName(const std::string& name) {
+	auto found = m_byName.find(name);
+
+	return found == m_byName.end() ? nullptr : &m_friends[found->second];
+}
+
+Friend* Roster::FindByUuid(const uuid_t uuid) {
+	auto found = m_byUuid.find(UuidKey(uuid));
+
+	return found == m_byUuid.end() ? nullptr : &m_friends[found->second];
+}
+
+void Roster::Reserve(size_t count) {
+	m_friends.reserve(m_friends.size() + count);
+	m_byName.reserve(m_byName.size() + count);
+	m_byUuid.reserve(m_byUuid.size() + count);
+}
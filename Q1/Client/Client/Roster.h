@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Friend.h"
+
+/**
+	This class holds all the other clients, each found in constant time either by name or by UUID.
+
+	The friends are kept one after the other in a single vector, in the order they were added,
+	and each index maps a key to a friend's position in it.
+	Friends are never removed, so positions never change, but the vector may move when it grows:
+	pointers to friends are valid only until the next friend is added.
+	Their key wrappers are kept in pools of the roster's own, so they never move, and are freed in bulk along with it.
+*/
+class Roster {
+public:
+	typedef std::vector<Friend>::iterator iterator;
+	typedef std::vector<Friend>::const_iterator const_iterator;
+
+	Roster() {}
+
+	/**
+		The friends' key wrappers are left to their pools, which destroy them in bulk.
+	*/
+	~Roster();
+
+	/**
+		Adds a new friend.
+
+		@param	name	-	The friend's name.
+		@param	uuid	-	The friend's UUID.
+
+		@return	Friend*	-	The added friend, nullptr if either is invalid or already on the roster.
+	*/
+	Friend* Add(const std::string& name, const uuid_t uuid);
+
+	/**
+		@return	Friend*	-	The friend of the given name, nullptr if none.
+	*/
+	Friend* FindByName(const std::string& name);
+
+	/**
+		@return	Friend*	-	The friend of the given UUID, nullptr if none.
+	*/
+	Friend* FindByUuid(const uuid_t uuid);
+
+	/**
+		Makes room for more friends, so adding them doesn't move the roster over and over.
+
+		@param	count	-	The number of friends expected to be added.
+	*/
+	void Reserve(size_t count);
+
+	size_t GetSize() const { return m_friends.size(); }
+
+	iterator begin() { return m_friends.begin(); }
+	iterator end() { return m_friends.end(); }
+	const_iterator begin() const { return m_friends.begin(); }
+	const_iterator end() const { return m_friends.end(); }
+
+private:
+	// A UUID as two words, so it is hashed and compared without being copied into a string.
+	struct UuidKey {
+		UuidKey(const uuid_t uuid);
+
+		bool operator==(const UuidKey& other) const { return words[0] == other.words[0] && words[1] == other.words[1]; }
+
+		uint64_t words[2];
+	};
+
+	struct UuidKeyHash {
+		// UUIDs are random, so their bits are already spread.
+		size_t operator()(const UuidKey& key) const { return (size_t)(key.words[0] ^ key.words[1]); }
+	};
+
+	Roster(const Roster&);
+	Roster& operator=(const Roster&);
+
+	// Declared first, so the pools outlive the friends whose key wrappers they hold.
+	FriendKeys m_keys;
+
+	std::vector<Friend> m_friends;
+
+	// The position of each friend in m_friends.
+	std::unordered_map<std::string, uint32_t> m_byName;
+	std::unordered_map<UuidKey, uint32_t, UuidKeyHash> m_byUuid;
+};
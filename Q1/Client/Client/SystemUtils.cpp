@@ -1,5 +1,6 @@
 
 #include "SystemUtils.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -23,4 +24,19 @@ namespace SystemUtils {
 
 		return ret;
 	}
+
+	std::vector<std::string> ListFiles(const std::string& directory, const std::string& extension) {
+		std::vector<std::string> paths;
+		std::error_code error;
+
+		for (std::filesystem::directory_iterator it(directory, error), end; error.value() == 0 && it != end; it.increment(error)) {
+			if (it->is_regular_file(error) == true && it->path().extension() == extension) {
+				paths.push_back(it->path().string());
+			}
+		}
+
+		std::sort(paths.begin(), paths.end());
+
+		return paths;
+	}
 };
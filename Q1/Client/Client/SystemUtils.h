@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 /**
 * This file holds implementation for system utilities.
@@ -27,4 +28,14 @@ namespace SystemUtils {
 	* @return bool	-	True if exists, false otherwise.
 	*/
 	bool IsFileExists(const std::string& path);
+
+	/**
+	* This function lists the regular files in a directory which have a given extension.
+	*
+	* @param directory	-	The path to the directory.
+	* @param extension	-	The extension of the listed files, including its dot (e.g. ".info").
+	*
+	* @return vector<string>	-	The paths of the files, sorted. Empty if the directory can't be read.
+	*/
+	std::vector<std::string> ListFiles(const std::string& directory, const std::string& extension);
 };
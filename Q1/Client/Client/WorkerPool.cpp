@@ -0,0 +1,92 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t workerCount) : m_task(nullptr), m_taskCount(0), m_batch(0), m_nextTask(0),
+												m_busyWorkers(0), m_isStopping(false) {
+
+	// The calling thread of each batch is the first worker.
+	for (size_t workerIndex = 1; workerIndex < std::max<size_t>(workerCount, 1); workerIndex++) {
+		this->m_workers.emplace_back(&WorkerPool::Work, this, workerIndex);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+		this->m_isStopping = true;
+	}
+
+	this->m_started.notify_all();
+
+	for (std::thread& worker : this->m_workers) {
+		worker.join();
+	}
+}
+
+size_t WorkerPool::GetWorkerCount() const {
+	return this->m_workers.size() + 1;
+}
+
+void WorkerPool::Run(size_t taskCount, const std::function<void(size_t, size_t)>& task) {
+
+	// Nothing worth waking the workers for.
+	if (taskCount <= 1 || this->m_workers.empty() == true) {
+		for (size_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+			task(taskIndex, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex);
+
+		this->m_task = &task;
+		this->m_taskCount = taskCount;
+		this->m_nextTask = 0;
+		this->m_busyWorkers = this->m_workers.size();
+		this->m_batch++;
+	}
+
+	this->m_started.notify_all();
+
+	RunTasks(0);
+
+	// The task is only borrowed, so every worker must be done with it before returning.
+	std::unique_lock<std::mutex> lock(this->m_mutex);
+	this->m_finished.wait(lock, [this]() { return this->m_busyWorkers == 0; });
+
+	this->m_task = nullptr;
+}
+
+void WorkerPool::Work(size_t workerIndex) {
+	uint64_t lastBatch = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(this->m_mutex);
+			this->m_started.wait(lock, [this, lastBatch]() { return this->m_isStopping == true || this->m_batch != lastBatch; });
+
+			if (this->m_isStopping == true) {
+				return;
+			}
+
+			lastBatch = this->m_batch;
+		}
+
+		RunTasks(workerIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex);
+			this->m_busyWorkers--;
+		}
+
+		this->m_finished.notify_one();
+	}
+}
+
+void WorkerPool::RunTasks(size_t workerIndex) {
+	for (size_t taskIndex = this->m_nextTask++; taskIndex < this->m_taskCount; taskIndex = this->m_nextTask++) {
+		(*this->m_task)(taskIndex, workerIndex);
+	}
+}
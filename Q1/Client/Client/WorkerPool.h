@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+	This class keeps a fixed number of workers for the whole of its lifetime, so running tasks
+	in parallel doesn't start and join threads every time.
+
+	Tasks are given in batches. A batch is run by all the workers, the calling thread being one of them,
+	each taking the next task once done with its previous one. Batches are run one at a time.
+*/
+class WorkerPool {
+public:
+	/**
+		Starts the workers right away.
+
+		@param	workerCount	-	The number of workers, the calling thread included, at least one.
+	*/
+	explicit WorkerPool(size_t workerCount);
+
+	/**
+		Stops the workers. No batch may be running.
+	*/
+	~WorkerPool();
+
+	/**
+		@return	size_t	-	The number of workers, the calling thread included.
+	*/
+	size_t GetWorkerCount() const;
+
+	/**
+		Runs a batch of tasks, and returns once all of them are done.
+
+		@param	taskCount	-	The number of tasks to be run.
+		@param	task		-	Invoked with the task's index and the index of the worker running it, below GetWorkerCount.
+								The calling thread is worker 0. It must not throw.
+	*/
+	void Run(size_t taskCount, const std::function<void(size_t, size_t)>& task);
+
+private:
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+
+	/**
+		The loop of each worker, running its share of every batch until the pool is stopped.
+
+		@param	workerIndex	-	The worker's index, from 1.
+	*/
+	void Work(size_t workerIndex);
+
+	/**
+		Runs tasks of the current batch until none is left.
+	*/
+	void RunTasks(size_t workerIndex);
+
+	std::mutex m_mutex;
+	std::condition_variable m_started;
+	std::condition_variable m_finished;
+
+	// The current batch. A new batch is told apart from the previous one by its number.
+	const std::function<void(size_t, size_t)>* m_task;
+	size_t m_taskCount;
+	uint64_t m_batch;
+	std::atomic<size_t> m_nextTask;
+
+	// The workers still running the current batch, the calling thread excluded.
+	size_t m_busyWorkers;
+	bool m_isStopping;
+
+	std::vector<std::thread> m_workers;
+};
@@ -0,0 +1,75 @@
+#include "X25519Wrapper.h"
+
+#include <sha.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+// Keeps the agreement key apart from anything else which may ever be derived from the RSA key.
+static const char SEED_LABEL[] = "MessageU X25519 agreement key";
+
+X25519Wrapper::X25519Wrapper(const char* seed, unsigned int length)
+{
+	CryptoPP::SHA256 hash;
+	hash.Update(reinterpret_cast<const CryptoPP::byte*>(SEED_LABEL), sizeof(SEED_LABEL) - 1);
+	hash.Update(reinterpret_cast<const CryptoPP::byte*>(seed), length);
+	hash.Final(_privateKey);
+
+	// Clamping as RFC 7748 does, so the key is a valid X25519 scalar.
+	_privateKey[0] &= 248;
+	_privateKey[KEYSIZE - 1] &= 127;
+	_privateKey[KEYSIZE - 1] |= 64;
+
+	_domain.GeneratePublicKey(_rng, _privateKey, _publicKey);
+}
+
+X25519Wrapper::~X25519Wrapper()
+{
+	memset(_privateKey, 0, KEYSIZE);
+}
+
+std::string X25519Wrapper::getPublicKey() const
+{
+	return std::string(reinterpret_cast<const char*>(_publicKey), KEYSIZE);
+}
+
+char* X25519Wrapper::getPublicKey(char* keyout, unsigned int length) const
+{
+	if (length < KEYSIZE)
+		throw std::length_error("buffer is too short for the key");
+
+	memcpy_s(keyout, length, _publicKey, KEYSIZE);
+	return keyout;
+}
+
+unsigned char* X25519Wrapper::deriveKey(const unsigned char* otherKey, unsigned int otherLength, unsigned char* keyout, unsigned int length) const
+{
+	if (otherLength != KEYSIZE)
+		throw std::length_error("other key length must be 32 bytes");
+
+	if (length < AGREED_KEYLENGTH)
+		throw std::length_error("buffer is too short for the agreed key");
+
+	CryptoPP::byte shared[KEYSIZE];
+	if (_domain.Agree(shared, _privateKey, otherKey) == false)
+		throw std::runtime_error("invalid other key");
+
+	// Both sides hash the public keys in the same order, whichever is their own.
+	const unsigned char* first = _publicKey;
+	const unsigned char* second = otherKey;
+	if (memcmp(first, second, KEYSIZE) > 0)
+		std::swap(first, second);
+
+	CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+	CryptoPP::SHA256 hash;
+	hash.Update(shared, KEYSIZE);
+	hash.Update(first, KEYSIZE);
+	hash.Update(second, KEYSIZE);
+	hash.Final(digest);
+
+	memcpy_s(keyout, length, digest, AGREED_KEYLENGTH);
+
+	memset(shared, 0, sizeof(shared));
+	memset(digest, 0, sizeof(digest));
+	return keyout;
+}
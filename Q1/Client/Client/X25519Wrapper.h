@@ -0,0 +1,48 @@
+#pragma once
+
+#include <osrng.h>
+#include <xed25519.h>
+
+#include <string>
+
+
+/**
+	Holds the client's X25519 key pair, from which a symmetric key is agreed with any friend
+	knowing the client's public key, without sending the key over.
+
+	The private key is derived from the RSA private key, so the pair is the same on every start
+	and nothing more has to be kept in 'me.info'.
+*/
+class X25519Wrapper
+{
+public:
+	static const unsigned int KEYSIZE = 32;
+	static const unsigned int AGREED_KEYLENGTH = 16;
+
+private:
+	CryptoPP::AutoSeededRandomPool _rng;
+	CryptoPP::x25519 _domain;
+
+	unsigned char _privateKey[KEYSIZE];
+	unsigned char _publicKey[KEYSIZE];
+
+	X25519Wrapper(const X25519Wrapper& x25519);
+	X25519Wrapper& operator=(const X25519Wrapper& x25519);
+public:
+	/**
+		@param	seed	-	The secret the private key is derived from, i.e. the encoded RSA private key.
+	*/
+	X25519Wrapper(const char* seed, unsigned int length);
+	~X25519Wrapper();
+
+	std::string getPublicKey() const;
+	char* getPublicKey(char* keyout, unsigned int length) const;
+
+	/**
+		Agrees on a key with the owner of the other public key, who gets the same key the other way around.
+		The shared secret is hashed along with both public keys, so the key is bound to the pair.
+
+		@return	unsigned char*	-	The key, of AGREED_KEYLENGTH bytes. Throws if the other key is invalid.
+	*/
+	unsigned char* deriveKey(const unsigned char* otherKey, unsigned int otherLength, unsigned char* keyout, unsigned int length) const;
+};
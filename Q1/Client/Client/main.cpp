@@ -1,16 +1,127 @@
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
 #include "Client.h"
+#include "Engine.h"
 
-int main() {
+/**
+	Takes a numeric option out of the arguments, wherever it is given.
+
+	@param	args	-	The arguments, from which the option and its value are removed.
+	@param	name	-	The option's name.
+	@param	o_value	-	Out parameter for the option's value, left as it is if not given.
+
+	@return	bool	-	True if the option is valid or not given at all, false otherwise.
+*/
+static bool TakeOption(std::vector<std::string>& args, const std::string& name, size_t& o_value) {
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] != name) {
+			continue;
+		}
+
+		if (i + 1 == args.size()) {
+			return false;
+		}
+
+		try {
+			size_t length = 0;
+			o_value = std::stoul(args[i + 1], &length);
+
+			if (length != args[i + 1].size() || o_value == 0) {
+				return false;
+			}
+		}
+		catch (...) {
+			return false;
+		}
+
+		args.erase(args.begin() + i, args.begin() + i + 2);
+		return true;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	// "--key-pool-depth <count>" and "--key-pool-threads <count>" set how many key pairs an unregistered
+	// client keeps ready, and how many workers generate them.
+	size_t keyPoolDepth = KeyPool::DEFAULT_DEPTH;
+	size_t keyPoolThreads = KeyPool::DEFAULT_THREAD_COUNT;
+
+	if (TakeOption(args, "--key-pool-depth", keyPoolDepth) == false ||
+		TakeOption(args, "--key-pool-threads", keyPoolThreads) == false) {
+		std::cout << "Key pool options must be given a positive count" << std::endl;
+		return 1;
+	}
+
+	// "--engine <directory>" runs the commands in the standard input over all the accounts in the directory.
+	if (args.size() > 1 && args[0] == "--engine") {
+		Engine engine;
+
+		// The same as the batch mode, what the accounts print while loading goes to the standard error.
+		std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+		if (engine.Init(args[1]) == false) {
+			std::cout << "Failed initializing engine" << std::endl;
+			std::cout.rdbuf(stdoutBuffer);
+			return 1;
+		}
+
+		std::cout.rdbuf(stdoutBuffer);
+
+		engine.Run(std::cin);
+
+		return 0;
+	}
+
+	// "--batch [path]" runs the commands in the given file, or in the standard input, instead of the menu.
+	bool isBatch = args.size() > 0 && args[0] == "--batch";
+
+	// The results are buffered by the streams themselves, rather than by the C library as well.
+	if (isBatch == true) {
+		std::ios::sync_with_stdio(false);
+	}
 
 	Client client;
+	client.SetKeyPool(keyPoolDepth, keyPoolThreads);
+
+	// In batch mode the standard output holds only the results, so anything printed meanwhile goes to the standard error.
+	std::streambuf* stdoutBuffer = std::cout.rdbuf();
+
+	if (isBatch == true) {
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
 
 	if (client.Init() == false) {
 		std::cout << "Failed initializing client" << std::endl;
+		std::cout.rdbuf(stdoutBuffer);
 		return 1;
 	}
 
-	client.Run();
+	if (isBatch == false) {
+		client.Run();
+		return 0;
+	}
+
+	std::ifstream script;
+
+	if (args.size() > 1) {
+		script.open(args[1]);
+
+		if (script.is_open() == false) {
+			std::cout << "Failed opening " << args[1] << std::endl;
+			std::cout.rdbuf(stdoutBuffer);
+			return 1;
+		}
+	}
+
+	std::cout.rdbuf(stdoutBuffer);
+
+	client.RunBatch(args.size() > 1 ? script : std::cin);
 
 	return 0;
 }
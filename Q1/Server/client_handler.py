@@ -1,15 +1,70 @@
-from threading import Lock
+from threading import Lock, Condition, Thread
+from concurrent.futures import ThreadPoolExecutor, wait
 from protocol import *
+import heapq
+import itertools
+import time
 import uuid
 import socket
 import secrets
+import struct
+
+# Seconds a kept-alive connection may stay idle before the server closes it.
+IDLE_TIMEOUT = 60
+
+# Number of threads handling pipelined requests, shared by all connections.
+PIPELINE_WORKERS = 16
+
+# Most bytes of file chunks a mailbox holds at once. Further chunks are refused until the
+# mailbox is fetched, so a file never has to be held as a whole, and senders simply retry.
+MAX_PENDING_CHUNK_BYTES = 4 * 1024 * 1024
+
+# Longest a client may wait for messages, in milliseconds.
+# Kept below the idle timeout, so a waiting connection is never considered idle.
+MAX_WAIT_TIMEOUT_MS = 30 * 1000
 
 # This class represents the relevant data of a single client.
 class ClientData:
     def __init__(self, name, public_key):
         self.name = name
         self.public_key = public_key
+
+        # Registered separately by clients supporting key agreement, None otherwise.
+        self.agreement_key = None
+
         self.recv_messages = []
+        self.waiters = []
+
+        # The bytes of the file chunks in recv_messages, kept as messages are pushed and taken.
+        self.pending_chunk_bytes = 0
+
+
+# This class represents a request waiting for messages to arrive to a mailbox.
+# It is completed exactly once, either by an arriving message or by its deadline.
+class MailboxWaiter:
+    def __init__(self, connection, header, client_id: UUID, deadline):
+        self.connection = connection
+        self.header = header
+        self.client_id = client_id
+        self.deadline = deadline
+        self.done = False
+
+
+# This class represents a single kept-alive connection with a client.
+# Pipelined requests are answered from several threads, so sending is serialized.
+class ClientConnection:
+    def __init__(self, client_socket: socket):
+        self.sock = client_socket
+        self.send_lock = Lock()
+        self.in_flight = []
+
+        # The waiting requests parked by this connection, dropped along with it once closed.
+        self.waiters = []
+        self.is_closed = False
+
+    def send(self, data):
+        with self.send_lock:
+            self.sock.sendall(data)
 
 
 # This class handlers a client request.
@@ -18,6 +73,22 @@ class ClientHandler:
         self.mutex = Lock()
         self.users = {}
 
+        # The list nodes of all users in order of registration. Its length is the directory's version,
+        # so the users added since any version are the tail of the list.
+        self.directory = []
+
+        # The directory is kept in memory only, so its versions are valid only within this run.
+        self.directory_epoch = secrets.randbits(32)
+
+        self.executor = ThreadPoolExecutor(max_workers=PIPELINE_WORKERS)
+
+        # Waiting requests don't hold a thread. They are parked in their mailbox,
+        # and a single thread completes the ones whose deadline has passed.
+        self.waiters_changed = Condition(self.mutex)
+        self.waiter_deadlines = []
+        self.waiter_sequence = itertools.count()
+        Thread(target=self.expire_waiters, daemon=True).start()
+
     # A decorator to lock and free the mutex, preventing race conditioning.
     def locker(func):
         def inner(self, *args, **kwargs):
@@ -54,27 +125,191 @@ class ClientHandler:
     def add_user(self, client: ClientData, uuid: UUID):
         if uuid not in self.users:
             self.users[uuid] = client
+            self.directory.append(UserListResNode(uuid, client.name).raw)
+
+    '''
+        This function returns the directory's version, along with the list nodes of the users
+        added since the given version. An unknown version (e.g. from before a restart) gets the whole directory.
+    '''
+    @locker
+    def get_directory_since(self, version):
+        if version > len(self.directory):
+            version = 0
+
+        return len(self.directory), self.directory[version:]
 
     @locker
     def get_pk_from_uuid(self, uuid: UUID):
         return self.users[uuid].public_key
 
     @locker
-    def push_message(self, uuid: UUID, message: SendMessageReqBody):
+    def get_agreement_key_from_uuid(self, uuid: UUID):
+        return self.users[uuid].agreement_key
+
+    '''
+        A user's agreement key is set once. Setting the same key again is allowed,
+        since clients derive it from their private key and register it on every start.
+    '''
+    @locker
+    def set_agreement_key(self, uuid: UUID, agreement_key):
+        user = self.users[uuid]
+
+        if user.agreement_key is not None and user.agreement_key != agreement_key:
+            return False
+
+        user.agreement_key = agreement_key
+        return True
+
+    @staticmethod
+    def chunk_bytes(messages):
+        return sum(len(message.raw) for message in messages if message.message_type == MessageType.FileChunk)
+
+    # Must be called with the mutex held.
+    def append_message(self, uuid: UUID, message: SendMessageReqBody):
         self.users[uuid].recv_messages.append(message)
 
+        if message.message_type == MessageType.FileChunk:
+            self.users[uuid].pending_chunk_bytes += len(message.raw)
+
+    '''
+        Pushing messages returns the requests waiting on the mailboxes,
+        to be completed once the lock is released.
+        None is returned if the messages are refused.
+    '''
+    @locker
+    def push_message(self, uuid: UUID, message: SendMessageReqBody):
+        if (message.message_type == MessageType.FileChunk and
+            self.users[uuid].pending_chunk_bytes + len(message.raw) > MAX_PENDING_CHUNK_BYTES):
+            return None
+
+        self.append_message(uuid, message)
+        return self.take_waiters(uuid)
+
+    @locker
+    def push_messages(self, messages):
+        # All or nothing, so a failed batch can be safely sent again.
+        chunk_bytes = {}
+        for (uuid, message) in messages:
+            if uuid not in self.users:
+                return None
+
+            if message.message_type == MessageType.FileChunk:
+                if uuid not in chunk_bytes:
+                    chunk_bytes[uuid] = self.users[uuid].pending_chunk_bytes
+
+                chunk_bytes[uuid] += len(message.raw)
+                if chunk_bytes[uuid] > MAX_PENDING_CHUNK_BYTES:
+                    return None
+
+        woken = []
+        for (uuid, message) in messages:
+            self.append_message(uuid, message)
+            woken += self.take_waiters(uuid)
+
+        return woken
+
     @locker
     def get_name_from_uuid(self, uuid: UUID):
         return self.users[uuid].name
 
+    '''
+        This function takes all the messages of the mailbox, as they are.
+    '''
+    @locker
+    def take_messages_from_uuid(self, uuid: UUID):
+        messages = self.users[uuid].recv_messages
+        self.users[uuid].recv_messages = []
+        self.users[uuid].pending_chunk_bytes = 0
+
+        return messages
+
+    '''
+        This function puts messages which couldn't be delivered back at the front of the mailbox,
+        and returns the requests waiting on it meanwhile, to be completed once the lock is released.
+    '''
+    @locker
+    def restore_messages(self, uuid: UUID, messages):
+        self.users[uuid].recv_messages[:0] = messages
+        self.users[uuid].pending_chunk_bytes += self.chunk_bytes(messages)
+        return self.take_waiters(uuid)
+
+    '''
+        This function takes the oldest messages of the mailbox which fit the given limits,
+        and whether any are left behind.
+        The first message is always taken, even if it exceeds the byte limit, so a mailbox can't get stuck.
+        Only the taken messages are removed.
+    '''
+    @locker
+    def take_messages_page_from_uuid(self, uuid: UUID, max_bytes, max_count):
+        recv_messages = self.users[uuid].recv_messages
+
+        page_bytes = 0
+        count = 0
+        for message in recv_messages:
+            if max_count != 0 and count == max_count:
+                break
+
+            if max_bytes != 0 and count > 0 and page_bytes + len(message.raw) > max_bytes:
+                break
+
+            page_bytes += len(message.raw)
+            count += 1
+
+        messages = recv_messages[:count]
+        del recv_messages[:count]
+        self.users[uuid].pending_chunk_bytes -= self.chunk_bytes(messages)
+
+        return messages, len(recv_messages) > 0
+
+    '''
+        This function parks a waiting request on its mailbox.
+        It returns False if messages are already waiting, so there is no need to park.
+    '''
     @locker
-    def get_messages_from_uuid(self, uuid: UUID):
-        send_buffer = bytes()
-        for message in self.users[uuid].recv_messages:
-            send_buffer += message.raw
+    def park_waiter(self, waiter: MailboxWaiter):
+        # The connection has been closed meanwhile, so the request is simply dropped.
+        if waiter.connection.is_closed:
+            waiter.done = True
+            return True
+
+        if len(self.users[waiter.client_id].recv_messages) > 0:
+            return False
 
-        self.users[uuid].recv_messages.clear()
-        return send_buffer
+        # Waiters completed meanwhile are no longer tracked.
+        waiter.connection.waiters = [w for w in waiter.connection.waiters if not w.done]
+        waiter.connection.waiters.append(waiter)
+
+        self.users[waiter.client_id].waiters.append(waiter)
+        heapq.heappush(self.waiter_deadlines, (waiter.deadline, next(self.waiter_sequence), waiter))
+        self.waiters_changed.notify()
+
+        return True
+
+    '''
+        This function drops the waiting requests of a closed connection, so no message is sent over it,
+        and any request still being handled won't park. Their deadlines are left in the heap, and skipped once due.
+    '''
+    @locker
+    def drop_waiters(self, connection: ClientConnection):
+        for waiter in connection.waiters:
+            if waiter.done:
+                continue
+
+            waiter.done = True
+            self.users[waiter.client_id].waiters.remove(waiter)
+
+        connection.waiters = []
+        connection.is_closed = True
+
+    # Must be called with the mutex held.
+    def take_waiters(self, uuid: UUID):
+        waiters = self.users[uuid].waiters
+        self.users[uuid].waiters = []
+
+        for waiter in waiters:
+            waiter.done = True
+
+        return waiters
 
     '''
         This function makes sure that a request received from some client is valid.
@@ -88,10 +323,28 @@ class ClientHandler:
 
     '''
         This function builds and sends an error message to the client.
+        An error to a pipelined request carries the request's ID.
     '''
-    def send_error(self, client_sock: socket):
-        response = ResponseHeader()
-        client_sock.send(response.raw)
+    def send_error(self, connection: ClientConnection, header: RequestHeader = None):
+        request_id = None if header is None else header.request_id
+        response = ResponseHeader(request_id=request_id)
+        connection.send(response.raw)
+
+    '''
+        This function reads exactly `size` bytes from the socket.
+        It returns less bytes only if the client has closed the connection.
+    '''
+    @staticmethod
+    def recv_exact(client_sock: socket, size):
+        data = bytes()
+        while len(data) < size:
+            chunk = client_sock.recv(size - len(data))
+            if not chunk:
+                break
+
+            data += chunk
+
+        return data
 
     #------------------------------------------- HANDLERS -------------------------------------------
 
@@ -113,17 +366,21 @@ class ClientHandler:
 
         return response.raw
 
+    @staticmethod
+    def build_user_list(nodes, client_uuid):
+        # Not including the request sender itself.
+        return b"".join(node for node in nodes if node[:UUID_LEN] != client_uuid)
+
     def handle_user_list(self, client_uuid):
-        send_buffer = bytes()
+        (_, nodes) = self.get_directory_since(0)
 
-        for uuid in self.users:
-            # Not including the request sender itself.
-            if uuid == UUID(bytes=client_uuid):
-                continue
+        return self.build_user_list(nodes, client_uuid)
 
-            send_buffer += UserListResNode(uuid, self.get_name_from_uuid(uuid)).raw
+    def handle_directory_sync(self, payload, client_uuid):
+        body = DirectorySyncReqBody(payload)
+        (version, nodes) = self.get_directory_since(body.since_version)
 
-        return send_buffer
+        return DirectorySyncResHeader(self.directory_epoch, version).raw + self.build_user_list(nodes, client_uuid)
 
     def handle_get_public_key(self, payload):
         body = GetPKReqBody(payload)
@@ -136,33 +393,73 @@ class ClientHandler:
 
         return response.raw
 
-    def handle_send_message(self, payload, uuid):
-        body = SendMessageReqBody(payload)
+    def handle_set_agreement_key(self, payload, client_uuid):
+        body = SetAgreementKeyReqBody(payload)
+
+        if not self.set_agreement_key(UUID(bytes=client_uuid), body.agreement_key):
+            print("Agreement key already set")
+            return None
+
+        return SetAgreementKeyResBody(body.agreement_key).raw
+
+    def handle_get_agreement_key(self, payload):
+        body = GetAgreementKeyReqBody(payload)
 
         if not self.is_registered(UUID(bytes=body.client_id)):
             print("Request for unregistered user")
             return None
 
-        response = SendMessageResBody(body.client_id, secrets.token_bytes(MESSAGE_ID_LENGTH))
+        agreement_key = self.get_agreement_key_from_uuid(UUID(bytes=body.client_id))
 
-        if body.content_size != (len(payload) - body.get_sub_header_size()):
-            print("Content size field doesn't match actual size")
+        # The user's client doesn't support key agreement, so the sender falls back to key transport.
+        if agreement_key is None:
             return None
 
+        return GetAgreementKeyResBody(body.client_id, agreement_key).raw
+
+    '''
+        This function validates a single message record, whose content
+        is expected to be `record_size` bytes long including the sub header.
+    '''
+    @staticmethod
+    def is_message_valid(body: SendMessageReqBody, record_size):
+        if body.content_size != (record_size - body.get_sub_header_size()):
+            print("Content size field doesn't match actual size")
+            return False
+
         # Saving only valid messages.
         if not MessageType.contains(body.message_type):
             print("Message type is invalid")
-            return None
+            return False
 
         # Validating logical relation of the size and the content.
         if (body.message_type == MessageType.GetSK and
             body.content_size != 0):
             print("Unexpected size field for 'GetSymKey' request")
-            return None
+            return False
 
         elif (body.message_type == MessageType.SendSK and
             body.content_size != ENCRYPTED_SYM_KEY_LENGTH):
             print("Unexpected size field for 'SendSymKey' request")
+            return False
+
+        elif (body.message_type == MessageType.FileChunk and
+            body.content_size < FILE_CHUNK_HEADER_LEN):
+            print("Unexpected size field for 'FileChunk' request")
+            return False
+
+        return True
+
+    def handle_send_message(self, payload, uuid):
+        body = SendMessageReqBody(payload)
+
+        if not self.is_registered(UUID(bytes=body.client_id)):
+            print("Request for unregistered user")
+            return None
+
+        response = SendMessageResBody(body.client_id, secrets.token_bytes(MESSAGE_ID_LENGTH))
+
+        if not self.is_message_valid(body, len(payload)):
             return None
 
         # Switching id's, so the message itself will contain the sender's id
@@ -170,50 +467,229 @@ class ClientHandler:
         body.client_id = uuid
 
         body.update()
-        self.push_message(UUID(bytes=dest_id), body)
+        woken = self.push_message(UUID(bytes=dest_id), body)
+        if woken is None:
+            print("Mailbox is full")
+            return None
+
+        self.complete_waiters(woken)
 
         return response.raw
 
+    def handle_send_messages(self, payload, uuid):
+        sub_header_size = SendMessageReqBody.get_sub_header_size()
+        messages = []
+        response = bytes()
+        offset = 0
+
+        # Validating all the records in one pass, before enqueueing any of them.
+        while offset < len(payload):
+            if len(payload) - offset < sub_header_size:
+                print("Reached an invalid tail length")
+                return None
+
+            (_, _, content_size) = struct.unpack_from(SendMessageReqBody.format, payload, offset)
+            record_end = offset + sub_header_size + content_size
+
+            if record_end > len(payload):
+                print("Content size field exceeds the payload")
+                return None
+
+            body = SendMessageReqBody(payload[offset:record_end])
+
+            if not self.is_message_valid(body, record_end - offset):
+                return None
+
+            # Switching id's, so the message itself will contain the sender's id
+            dest_id = body.client_id
+            body.client_id = uuid
+            body.update()
+
+            messages.append((UUID(bytes=dest_id), body))
+            response += SendMessageResBody(dest_id, secrets.token_bytes(MESSAGE_ID_LENGTH)).raw
+            offset = record_end
+
+        if len(messages) == 0:
+            print("No messages to send")
+            return None
+
+        woken = self.push_messages(messages)
+        if woken is None:
+            print("Request for unregistered user, or a mailbox is full")
+            return None
+
+        self.complete_waiters(woken)
+
+        return response
+
+    # The messages are only taken under the lock, and joined once it has been released.
     def handle_get_messages(self, uuid):
-        return self.get_messages_from_uuid(UUID(bytes=uuid))
+        messages = self.take_messages_from_uuid(UUID(bytes=uuid))
+        return bytes().join(message.raw for message in messages)
+
+    def handle_get_messages_page(self, payload, uuid):
+        body = GetMessagesPageReqBody(payload)
+        messages, more_pending = self.take_messages_page_from_uuid(UUID(bytes=uuid), body.max_bytes, body.max_count)
+
+        return bytes().join([GetMessagesPageResHeader(more_pending).raw] + [message.raw for message in messages])
+
+    '''
+        The response to a wait request is sent once messages arrive to the mailbox
+        or the given timeout expires, whichever comes first. Either way it has the
+        format of a get messages response, possibly with no messages at all.
+    '''
+    def handle_wait_messages(self, connection, header: RequestHeader, payload):
+        body = WaitMessagesReqBody(payload)
+        timeout_ms = min(body.timeout_ms, MAX_WAIT_TIMEOUT_MS)
+
+        waiter = MailboxWaiter(connection, header, UUID(bytes=header.client_id),
+                               time.monotonic() + timeout_ms / 1000)
+
+        if not self.park_waiter(waiter):
+            self.complete_waiter(waiter)
+
+    def complete_waiter(self, waiter: MailboxWaiter):
+        messages = self.take_messages_from_uuid(waiter.client_id)
+
+        try:
+            response_body = bytes().join(message.raw for message in messages)
+            self.send_response(waiter.connection, waiter.header, Opcodes.GetMessagesRes, response_body)
+
+        except OSError:
+            # The connection was lost meanwhile, so the messages are kept for the next request.
+            if len(messages) > 0:
+                self.complete_waiters(self.restore_messages(waiter.client_id, messages))
+
+    def complete_waiters(self, waiters):
+        for waiter in waiters:
+            self.complete_waiter(waiter)
+
+    def expire_waiters(self):
+        while True:
+            expired = []
+
+            with self.waiters_changed:
+                now = time.monotonic()
+
+                while len(self.waiter_deadlines) > 0 and self.waiter_deadlines[0][0] <= now:
+                    (_, _, waiter) = heapq.heappop(self.waiter_deadlines)
+
+                    # Already completed by an arriving message.
+                    if waiter.done:
+                        continue
+
+                    waiter.done = True
+                    self.users[waiter.client_id].waiters.remove(waiter)
+                    expired.append(waiter)
+
+                if len(expired) == 0:
+                    timeout = None
+                    if len(self.waiter_deadlines) > 0:
+                        timeout = self.waiter_deadlines[0][0] - now
+
+                    self.waiters_changed.wait(timeout)
+                    continue
+
+            self.complete_waiters(expired)
 
     #-------------------------------------- MAIN CLASS FUNCTION --------------------------------------
 
     def handle_client_thread(self, client_socket: socket):
+        connection = ClientConnection(client_socket)
+
         try:
-            self.handle_client(client_socket)
+            # The connection is kept alive, handling requests until the client
+            # closes it or it stays idle for too long.
+            client_socket.settimeout(IDLE_TIMEOUT)
+            while self.handle_client(connection):
+                pass
+
+        except (socket.timeout, ConnectionError):
+            pass
+
         finally:
+            # Nothing is sent to waiting requests of a closed connection, so their messages stay in the mailbox.
+            self.drop_waiters(connection)
+
+            # Pipelined requests still being handled are answered before closing.
+            wait(connection.in_flight)
             client_socket.close()
 
-    def handle_client(self, client_socket: socket):
+    '''
+        This function reads a single request from the connection and handles it.
+        Pipelined requests are handed to the worker threads, so the next request
+        can be read right away and the responses may be sent out of order.
+
+        It returns True if the connection can be used for the next request, False otherwise.
+    '''
+    def handle_client(self, connection: ClientConnection):
         # Validate header:
-        data = client_socket.recv(REQ_HEADER_LEN)
+        data = self.recv_exact(connection.sock, REQ_HEADER_LEN)
+
+        # The client has closed the connection between requests.
+        if len(data) == 0:
+            return False
 
         if len(data) != REQ_HEADER_LEN:
-            self.send_error(client_socket)
+            self.send_error(connection)
             print("Invalid structure")
-            return
+            return False
 
         header = RequestHeader(data)
 
         if header.is_valid() is False:
-            self.send_error(client_socket)
+            self.send_error(connection)
             print("Invalid header")
-            return
+            return False
+
+        if header.is_pipelined():
+            data = self.recv_exact(connection.sock, REQUEST_ID_LEN)
+
+            if len(data) != REQUEST_ID_LEN:
+                self.send_error(connection)
+                print("Invalid structure")
+                return False
+
+            header.set_request_id(data)
 
         # Validate body:
-        payload = client_socket.recv(header.payload_size)
+        payload = self.recv_exact(connection.sock, header.payload_size)
 
         if len(payload) != header.payload_size:
-            self.send_error(client_socket)
+            self.send_error(connection, header)
             print("Invalid len ({} != {})".format(len(payload), header.payload_size))
-            return
+            return False
 
-        if self.is_sender_valid(header) is False:
-            self.send_error(client_socket)
-            print("Received message from invalid source")
-            return
+        if header.is_pipelined():
+            connection.in_flight = [f for f in connection.in_flight if not f.done()]
+            connection.in_flight.append(self.executor.submit(self.handle_request, connection, header, payload))
+        else:
+            self.handle_request(connection, header, payload)
 
+        return True
+
+    '''
+        This function handles a single request whose frame has been read entirely,
+        and sends its response.
+    '''
+    def handle_request(self, connection: ClientConnection, header: RequestHeader, payload):
+        try:
+            if self.is_sender_valid(header) is False:
+                self.send_error(connection, header)
+                print("Received message from invalid source")
+                return
+
+            self.dispatch_request(connection, header, payload)
+
+        except OSError:
+            # The connection was lost meanwhile, nobody is waiting for the response.
+            pass
+
+    def send_response(self, connection: ClientConnection, header: RequestHeader, opcode, body):
+        response_header = ResponseHeader(code=opcode, payload_size=len(body), request_id=header.request_id)
+        connection.send(response_header.raw + bytes(body))
+
+    def dispatch_request(self, connection: ClientConnection, header: RequestHeader, payload):
         # Let's go
         try:
             if header.code == Opcodes.RegisterReq:
@@ -224,10 +700,22 @@ class ClientHandler:
                 response_body = self.handle_user_list(header.client_id)
                 response_opcode = Opcodes.UserListRes
 
+            elif header.code == Opcodes.DirectorySyncReq:
+                response_body = self.handle_directory_sync(payload, header.client_id)
+                response_opcode = Opcodes.DirectorySyncRes
+
             elif header.code == Opcodes.GetPKReq:
                 response_body = self.handle_get_public_key(payload)
                 response_opcode = Opcodes.GetPKRes
 
+            elif header.code == Opcodes.SetAgreementKeyReq:
+                response_body = self.handle_set_agreement_key(payload, header.client_id)
+                response_opcode = Opcodes.SetAgreementKeyRes
+
+            elif header.code == Opcodes.GetAgreementKeyReq:
+                response_body = self.handle_get_agreement_key(payload)
+                response_opcode = Opcodes.GetAgreementKeyRes
+
             elif header.code == Opcodes.SendMessageReq:
                 response_body = self.handle_send_message(payload, header.client_id)
                 response_opcode = Opcodes.SendMessageRes
@@ -236,19 +724,31 @@ class ClientHandler:
                 response_body = self.handle_get_messages(header.client_id)
                 response_opcode = Opcodes.GetMessagesRes
 
+            elif header.code == Opcodes.GetMessagesPageReq:
+                response_body = self.handle_get_messages_page(payload, header.client_id)
+                response_opcode = Opcodes.GetMessagesPageRes
+
+            elif header.code == Opcodes.SendMessagesReq:
+                response_body = self.handle_send_messages(payload, header.client_id)
+                response_opcode = Opcodes.SendMessagesRes
+
+            elif header.code == Opcodes.WaitMessagesReq:
+                # Responds on its own, possibly long after returning.
+                self.handle_wait_messages(connection, header, payload)
+                return
+
             else:
-                self.send_error(client_socket)
+                self.send_error(connection, header)
                 return
 
             if response_body is None:
-                self.send_error(client_socket)
+                self.send_error(connection, header)
             else:
-                response_header = ResponseHeader(code=response_opcode, payload_size=len(response_body))
-                client_socket.send(response_header.raw + bytes(response_body))
+                self.send_response(connection, header, response_opcode, response_body)
 
         except ValueError as e:
             '''
                 Short cut for sending error to client.
                 Expecting to catch any invalid UUID accesses and more.
             '''
-            self.send_error(client_socket)
+            self.send_error(connection, header)
@@ -17,19 +17,30 @@ message class as described in python's official 'struct'
 documentation.
 '''
 
-SERVER_VERSION = 1
+SERVER_VERSION = 3
+
+# Requests of this version onwards are followed by a request ID, which is echoed in the response.
+PIPELINED_VERSION = 2
+
+# Requests for X25519 agreement keys must be of this version onwards, so only clients aware of them send them.
+KEY_AGREEMENT_VERSION = 3
 
 NAME_LEN = 255
 
 PUBLIC_KEY_LEN = 160
+AGREEMENT_KEY_LEN = 32
 SYM_KEY_LENGTH = 16
 ENCRYPTED_SYM_KEY_LENGTH = 128
 
+# Transfer ID, sequence number and chunk count, preceding the encrypted chunk of a file.
+FILE_CHUNK_HEADER_LEN = 8 + 4 + 4
+
 UUID_LEN = 16
 MESSAGE_ID_LENGTH = 4
 
 # Header = UUID, version, code, size
 REQ_HEADER_LEN = UUID_LEN + 1 + 2 + 4
+REQUEST_ID_LEN = 4
 
 
 @unique
@@ -39,12 +50,23 @@ class Opcodes(IntEnum):
     GetPKReq = 1002
     SendMessageReq = 1003
     GetMessagesReq = 1004
+    SendMessagesReq = 1005
+    WaitMessagesReq = 1006
+    GetMessagesPageReq = 1007
+    DirectorySyncReq = 1008
+    SetAgreementKeyReq = 1009
+    GetAgreementKeyReq = 1010
 
     RegisterRes = 2000
     UserListRes = 2001
     GetPKRes = 2002
     SendMessageRes = 2003
     GetMessagesRes = 2004
+    SendMessagesRes = 2005
+    GetMessagesPageRes = 2007
+    DirectorySyncRes = 2008
+    SetAgreementKeyRes = 2009
+    GetAgreementKeyRes = 2010
 
     CommunicationError = 9000
 
@@ -59,7 +81,17 @@ class Opcodes(IntEnum):
             value == cls.UserListReq or
             value == cls.GetPKReq or
             value == cls.SendMessageReq or
-            value == cls.GetMessagesReq)
+            value == cls.GetMessagesReq or
+            value == cls.SendMessagesReq or
+            value == cls.WaitMessagesReq or
+            value == cls.GetMessagesPageReq or
+            value == cls.DirectorySyncReq or
+            value == cls.SetAgreementKeyReq or
+            value == cls.GetAgreementKeyReq)
+
+    @classmethod
+    def is_key_agreement(cls, value):
+        return value == cls.SetAgreementKeyReq or value == cls.GetAgreementKeyReq
 
 
 # Used for messages between users
@@ -69,6 +101,18 @@ class MessageType(IntEnum):
     SendSK = 2
     Text = 3
 
+    # A text deflated by the sender before being encrypted, relayed as any other text.
+    CompressedText = 4
+
+    # A single chunk of a file.
+    FileChunk = 5
+
+    # A text sealed with AES-GCM, relayed as any other text.
+    SealedText = 6
+
+    # A text sealed with a key agreed over X25519, led by the sender's agreement key.
+    AgreedText = 7
+
     # Implementing an easy search function for enums.
     @classmethod
     def contains(cls, value):
@@ -85,6 +129,15 @@ class RequestHeader:
          self.code,
          self.payload_size) = struct.unpack(self.format, bytestream)
 
+        # Set only for pipelined requests, once read.
+        self.request_id = None
+
+    def is_pipelined(self):
+        return self.version >= PIPELINED_VERSION
+
+    def set_request_id(self, bytestream):
+        (self.request_id, ) = struct.unpack("<L", bytestream)
+
     def is_valid(self):
         if self.version > SERVER_VERSION:
             return False
@@ -92,6 +145,9 @@ class RequestHeader:
         if not Opcodes.is_request(self.code):
             return False
 
+        if Opcodes.is_key_agreement(self.code) and self.version < KEY_AGREEMENT_VERSION:
+            return False
+
         ''' 
             match-case was only added on later python versions.
             
@@ -101,8 +157,8 @@ class RequestHeader:
             User list and get messages requests have no body, thus
             a zero is expected as the payload size.
             
-            Send message can have any possible length, thus
-            no validation is possible.
+            Send message (and send messages) can have any possible
+            length, thus no validation is possible.
         '''
         if self.code == Opcodes.RegisterReq:
             return self.payload_size == RegisterReqBody.get_size()
@@ -119,6 +175,24 @@ class RequestHeader:
         elif self.code == Opcodes.GetMessagesReq:
             return self.payload_size == 0
 
+        elif self.code == Opcodes.SendMessagesReq:
+            return True
+
+        elif self.code == Opcodes.WaitMessagesReq:
+            return self.payload_size == WaitMessagesReqBody.get_size()
+
+        elif self.code == Opcodes.GetMessagesPageReq:
+            return self.payload_size == GetMessagesPageReqBody.get_size()
+
+        elif self.code == Opcodes.DirectorySyncReq:
+            return self.payload_size == DirectorySyncReqBody.get_size()
+
+        elif self.code == Opcodes.SetAgreementKeyReq:
+            return self.payload_size == SetAgreementKeyReqBody.get_size()
+
+        elif self.code == Opcodes.GetAgreementKeyReq:
+            return self.payload_size == GetAgreementKeyReqBody.get_size()
+
         else:
             return False
 
@@ -148,7 +222,7 @@ class GetPKReqBody:
         return UUID_LEN
 
 
-#  OPCODE 1003
+#  OPCODE 1003, and each record of OPCODE 1005
 class SendMessageReqBody:
     format = f"<{UUID_LEN}sBL"
 
@@ -168,12 +242,79 @@ class SendMessageReqBody:
         return UUID_LEN + 1 + 4
 
 
+#  OPCODE 1006
+class WaitMessagesReqBody:
+    format = "<L"
+
+    def __init__(self, bytestream):
+        (self.timeout_ms, ) = struct.unpack(self.format, bytestream)
+
+    @staticmethod
+    def get_size():
+        return 4
+
+
+#  OPCODE 1007
+class GetMessagesPageReqBody:
+    format = "<LL"
+
+    # Zero means the page is not limited by that measure.
+    def __init__(self, bytestream):
+        (self.max_bytes,
+         self.max_count) = struct.unpack(self.format, bytestream)
+
+    @staticmethod
+    def get_size():
+        return 4 + 4
+
+
+#  OPCODE 1008
+class DirectorySyncReqBody:
+    format = "<L"
+
+    def __init__(self, bytestream):
+        (self.since_version, ) = struct.unpack(self.format, bytestream)
+
+    @staticmethod
+    def get_size():
+        return 4
+
+
+#  OPCODE 1009
+class SetAgreementKeyReqBody:
+    format = f"<{AGREEMENT_KEY_LEN}s"
+
+    def __init__(self, bytestream):
+        (self.agreement_key, ) = struct.unpack(self.format, bytestream)
+
+    @staticmethod
+    def get_size():
+        return AGREEMENT_KEY_LEN
+
+
+#  OPCODE 1010
+class GetAgreementKeyReqBody:
+    format = f"<{UUID_LEN}s"
+
+    def __init__(self, bytestream):
+        (self.client_id, ) = struct.unpack(self.format, bytestream)
+
+    @staticmethod
+    def get_size():
+        return UUID_LEN
+
+
 # ############################################ RESPONSES ############################################ #
 class ResponseHeader:
     format = "<BHL"
+    pipelined_format = "<BHLL"
 
-    def __init__(self, version = SERVER_VERSION, code = Opcodes.CommunicationError, payload_size = 0):
-        self.raw = struct.pack(self.format, version, code, payload_size)
+    def __init__(self, version = SERVER_VERSION, code = Opcodes.CommunicationError, payload_size = 0, request_id = None):
+        # Responses to pipelined requests carry the request's ID.
+        if request_id is None:
+            self.raw = struct.pack(self.format, version, code, payload_size)
+        else:
+            self.raw = struct.pack(self.pipelined_format, version, code, payload_size, request_id)
 
 
 #  OPCODE 2000
@@ -192,6 +333,15 @@ class UserListResNode:
         self.raw = struct.pack(self.format, client_id.bytes, client_name)
 
 
+#  OPCODE 2008, followed by the users added since the requested version, in the format of OPCODE 2001
+#  The epoch is drawn when the server starts, so versions given by different runs are told apart.
+class DirectorySyncResHeader:
+    format = "<LL"
+
+    def __init__(self, epoch, version):
+        self.raw = struct.pack(self.format, epoch, version)
+
+
 #  OPCODE 2002
 class GetPKResBody:
     format = f"<{UUID_LEN}s{PUBLIC_KEY_LEN}s"
@@ -200,7 +350,31 @@ class GetPKResBody:
         self.raw = struct.pack(self.format, client_id, pk)
 
 
-#  OPCODE 2003
+#  OPCODE 2009, echoing the key now registered
+class SetAgreementKeyResBody:
+    format = f"<{AGREEMENT_KEY_LEN}s"
+
+    def __init__(self, agreement_key):
+        self.raw = struct.pack(self.format, agreement_key)
+
+
+#  OPCODE 2010
+class GetAgreementKeyResBody:
+    format = f"<{UUID_LEN}s{AGREEMENT_KEY_LEN}s"
+
+    def __init__(self, client_id, agreement_key):
+        self.raw = struct.pack(self.format, client_id, agreement_key)
+
+
+#  OPCODE 2007, followed by the page's messages in the format of OPCODE 2004
+class GetMessagesPageResHeader:
+    format = "<B"
+
+    def __init__(self, more_pending: bool):
+        self.raw = struct.pack(self.format, 1 if more_pending else 0)
+
+
+#  OPCODE 2003, and each record of OPCODE 2005
 class SendMessageResBody:
     format = f"<{UUID_LEN}s{MESSAGE_ID_LENGTH}s"
 